@@ -0,0 +1,48 @@
+#include "Runtime.h"
+
+#include "../Natives.h"
+
+Runtime::Runtime(std::initializer_list<const char*> globals) : m_stack(STACK_MAX) {
+	m_stack_top = m_stack.data();
+	m_heap.add_roots(this);
+	for (const auto* name : globals) {
+		m_globals.slot(name);
+	}
+	m_globals.define("clock", Value(m_heap.make<ToyClock>()));
+}
+
+Runtime::~Runtime() {
+	m_heap.remove_roots(this);
+}
+
+bool Runtime::run(const AotProto& script) {
+	try {
+		Value* frame = m_stack.data();
+		m_stack_top = frame + script.frame_size;
+		script.code(*this, nullptr, frame);
+		m_stack_top = m_stack.data();
+		return true;
+	}
+	catch (const RuntimeError& e) {
+		std::cout << "\n[line " << e.token().line() << "] " << e.what() << "\n";
+		m_stack_top = m_stack.data();
+		m_tail_function = nullptr;
+		return false;
+	}
+}
+
+void Runtime::mark_roots(Heap& heap) {
+	m_globals.mark(heap);
+	for (const Value* slot = m_stack.data(); slot < m_stack_top; slot++) {
+		heap.mark(*slot);
+	}
+}
+
+Value Runtime::call_native(Value* callee, int argument_count, int line) {
+	if (!callee->is_callable()) {
+		error(line, "Can only call functions and classes.");
+	}
+	auto* native = callee->as_callable();
+	check_arity(native->arity(), argument_count, line);
+	return native->call(nullptr, { callee + 1, static_cast<size_t>(argument_count) });
+}
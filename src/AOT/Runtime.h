@@ -0,0 +1,277 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <initializer_list>
+#include <iostream>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Heap.h"
+#include "../Upvalue.h"
+#include "../Value.h"
+#include "../Lexer/Environment.h"
+#include "../Lexer/Errors.h"
+
+class Runtime;
+class AotFunction;
+
+// What toyc knows about a function declaration, one per declaration in the
+// generated code
+struct AotProto {
+	const char* name{""};
+	int arity{0};
+	// Slots for the locals followed by the temporaries the code uses
+	int frame_size{0};
+	Value (*code)(Runtime& runtime, AotFunction* self, Value* frame){nullptr};
+};
+
+// A function of a compiled script, stored in a CLOSURE Value like the VM's closures
+class AotFunction final : public Object {
+public:
+	AotFunction(const AotProto& proto) : m_proto(proto) { }
+
+	const AotProto& proto() const {
+		return m_proto;
+	}
+	Value& upvalue(int index) {
+		return m_upvalues[index]->value();
+	}
+	const std::vector<Upvalue*>& upvalues() const {
+		return m_upvalues;
+	}
+	// Upvalues are captured in the order the resolver numbered them
+	void capture(Upvalue* upvalue) {
+		m_upvalues.push_back(upvalue);
+	}
+	std::string to_string() const override {
+		return "<fn " + std::string(m_proto.name) + ">";
+	}
+	void trace(Heap& heap) override {
+		for (auto* upvalue : m_upvalues) {
+			heap.mark(upvalue);
+		}
+	}
+	size_t size() const override {
+		return sizeof(AotFunction) + m_upvalues.capacity() * sizeof(Upvalue*);
+	}
+private:
+	const AotProto& m_proto;
+	std::vector<Upvalue*> m_upvalues{};
+};
+
+/*
+ * What scripts compiled by toyc link against.
+ *
+ * Generated functions keep their locals and temporaries in frames on the
+ * runtime's stack, so everything they hold stays visible to the collector.
+ * A call's arguments are the topmost temporaries of the caller and become
+ * the first slots of the callee's frame in place, like in the tree-walker.
+ * Locals captured by inner functions are boxed in a closed Upvalue stored
+ * in their slot, closures share the box instead of pointing into the stack.
+ *
+ * The operations check their operands like the other engines and report
+ * errors with the line of the node they were generated for. Like the
+ * bytecode VM, a runtime error ends the script.
+ */
+class Runtime final : public HeapRoots {
+public:
+	// Global names in the order the resolver gave them slots
+	Runtime(std::initializer_list<const char*> globals);
+	~Runtime() override;
+
+	// Runs the top level code, returns false if it ended with a runtime error
+	bool run(const AotProto& script);
+
+	// String literals are never collected, like the ones the parser makes
+	Value literal(const char* value) {
+		return m_heap.make_literal(value);
+	}
+
+	void mark_roots(Heap& heap) override;
+
+	/*
+	 * Operators
+	 */
+	static bool is_truthy(const Value& value) {
+		if (value.is_bool()) return value.as_bool();
+		return !value.is_nil();
+	}
+	static Value negate(const Value& operand, int line) {
+		if (!operand.is_number()) error(line, "Operand must be a number.");
+		return Value(-operand.as_double());
+	}
+	Value add(const Value& left, const Value& right, int line) {
+		if (left.is_number() && right.is_number()) [[likely]] {
+			return Value(left.as_double() + right.as_double());
+		}
+		// Allow either to be strings
+		if (left.is_string() || right.is_string()) {
+			return m_heap.make_string(left.as_string() + right.as_string());
+		}
+		error(line, "Invalid operands.");
+	}
+	static Value subtract(const Value& left, const Value& right, int line) {
+		check_number_operands(left, right, line);
+		return Value(left.as_double() - right.as_double());
+	}
+	static Value multiply(const Value& left, const Value& right, int line) {
+		check_number_operands(left, right, line);
+		return Value(left.as_double() * right.as_double());
+	}
+	static Value divide(const Value& left, const Value& right, int line) {
+		check_number_operands(left, right, line);
+		if (right.as_double() == 0.0) error(line, "Division by zero.");
+		return Value(left.as_double() / right.as_double());
+	}
+	static Value greater(const Value& left, const Value& right, int line) {
+		check_number_operands(left, right, line);
+		return Value(left.as_double() > right.as_double());
+	}
+	static Value greater_equal(const Value& left, const Value& right, int line) {
+		check_number_operands(left, right, line);
+		return Value(left.as_double() >= right.as_double());
+	}
+	static Value less(const Value& left, const Value& right, int line) {
+		check_number_operands(left, right, line);
+		return Value(left.as_double() < right.as_double());
+	}
+	static Value less_equal(const Value& left, const Value& right, int line) {
+		check_number_operands(left, right, line);
+		return Value(left.as_double() <= right.as_double());
+	}
+	static Value equal(const Value& left, const Value& right, int) {
+		return Value(left == right);
+	}
+	static Value not_equal(const Value& left, const Value& right, int) {
+		return Value(left != right);
+	}
+
+	/*
+	 * Variables
+	 */
+	const Value& global(int slot, int line) {
+		return m_globals.get(slot, global_name(slot, line));
+	}
+	void assign_global(int slot, const Value& value, int line) {
+		m_globals.assign(slot, global_name(slot, line), value);
+	}
+	void define_global(int slot, const Value& value) {
+		m_globals.define(slot, value);
+	}
+
+	// Moves the value of a captured local into a box and leaves the box in its slot
+	void box(Value* slot) {
+		auto* box = m_heap.make<Upvalue>(slot);
+		box->close();
+		*slot = Value(Value::Type::CLOSURE, box);
+	}
+	static Upvalue* box_of(const Value& slot) {
+		return static_cast<Upvalue*>(slot.as_object());
+	}
+	static Value& unbox(const Value& slot) {
+		return box_of(slot)->value();
+	}
+
+	AotFunction* make_function(const AotProto& proto) {
+		return m_heap.make<AotFunction>(proto);
+	}
+
+	/*
+	 * Calls
+	 */
+	// The callee is followed by its arguments, the topmost temporaries of the calling frame
+	Value call(Value* callee, int argument_count, int line) {
+		if (callee->is_closure()) [[likely]] {
+			auto* function = static_cast<AotFunction*>(callee->as_object());
+			check_arity(function->proto().arity, argument_count, line);
+			return call_function(function, callee + 1, argument_count, line);
+		}
+		return call_native(callee, argument_count, line);
+	}
+	// `return f(...)`: the returning function's frame is replaced by the
+	// callee's instead of growing the stack, call_function runs it once the
+	// caller's code has returned
+	Value tail_call(Value* callee, int argument_count, int line) {
+		if (!callee->is_closure()) {
+			return call_native(callee, argument_count, line);
+		}
+		auto* function = static_cast<AotFunction*>(callee->as_object());
+		check_arity(function->proto().arity, argument_count, line);
+		m_tail_function = function;
+		m_tail_arguments = { callee + 1, static_cast<size_t>(argument_count) };
+		return Value(nullptr);
+	}
+
+	/*
+	 * Statements
+	 */
+	void print(const Value& value) {
+		std::cout << value.to_string() << "\n";
+	}
+	void sleep(const Value& value, int line) {
+		if (!value.is_number()) error(line, "sleep only accepts numbers");
+		std::this_thread::sleep_for(std::chrono::milliseconds((int)value.as_double()));
+	}
+
+private:
+	[[noreturn]] static void error(int line, const std::string& message) {
+		throw RuntimeError(Token(TokenType::TOKEN_EOF, "", line), message);
+	}
+	static void check_number_operands(const Value& left, const Value& right, int line) {
+		if (left.is_number() && right.is_number()) [[likely]] return;
+		error(line, "Operands must be numbers.");
+	}
+	static void check_arity(int arity, int argument_count, int line) {
+		if (argument_count == arity) [[likely]] return;
+		error(line, "Expected " + std::to_string(arity) + " arguments but got "
+			+ std::to_string(argument_count) + ".");
+	}
+	// The globals report errors with the name of the variable
+	Token global_name(int slot, int line) const {
+		return Token(TokenType::IDENTIFIER, m_globals.name(slot), line);
+	}
+
+	Value call_native(Value* callee, int argument_count, int line);
+
+	Value call_function(AotFunction* function, Value* frame, int argument_count, int line) {
+		Value* const caller_top = m_stack_top;
+		// Trampoline for tail calls, each one replaces the frame of the call before it
+		while (true) {
+			const auto& proto = function->proto();
+			if (m_stack.data() + m_stack.size() - frame < proto.frame_size) {
+				error(line, "Stack overflow.");
+			}
+			m_stack_top = frame + proto.frame_size;
+			// The arguments are the first slots, the rest may hold values of
+			// an earlier call the collector must no longer see
+			std::fill(frame + argument_count, m_stack_top, Value(nullptr));
+
+			auto result = proto.code(*this, function, frame);
+			if (!m_tail_function) {
+				m_stack_top = caller_top;
+				return result;
+			}
+			function = m_tail_function;
+			m_tail_function = nullptr;
+			// The slot below a frame holds its callee, which keeps the running function alive
+			frame[-1] = Value(Value::Type::CLOSURE, function);
+			// The arguments move down from the top of the returned frame into the parameter slots
+			std::copy(m_tail_arguments.begin(), m_tail_arguments.end(), frame);
+			argument_count = static_cast<int>(m_tail_arguments.size());
+			m_tail_arguments = {};
+		}
+	}
+
+	// Frames are never moved, the generated code keeps pointers into them
+	static constexpr size_t STACK_MAX = 64 * 1024;
+
+	Heap m_heap{};
+	GlobalEnvironment m_globals{};
+	std::vector<Value> m_stack;
+	Value* m_stack_top{nullptr};
+	// Callee of a pending tail call and its arguments at the top of the returning frame
+	AotFunction* m_tail_function{nullptr};
+	std::span<Value> m_tail_arguments{};
+};
@@ -0,0 +1,635 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../Lexer/Expr.h"
+#include "../Lexer/Stmt.h"
+#include "../Lexer/Environment.h"
+
+/*
+ * Translates a resolved script into a C++ translation unit for the Runtime.
+ *
+ * Every function declaration becomes a C++ function taking its frame, the
+ * top level code becomes one more taking the script's frame. Expressions are
+ * flattened into statements storing into temporaries, which are frame slots
+ * past the locals the resolver allocated:
+ *	print a + f(b);
+ * becomes
+ *	f[3] = f[0];				// a, f(b) could change it
+ *	f[5] = rt.global(2, 1);		// the callee, then the arguments
+ *	f[6] = f[1];
+ *	f[4] = rt.call(f + 5, 1, 1);
+ *	f[2] = rt.add(f[3], f[4], 1);
+ *	rt.print(f[2]);
+ * which keeps the left to right evaluation order C++ doesn't guarantee for
+ * operands and lets the collector see every value in flight.
+ *
+ * Control flow maps onto C++ control flow: loops become `while (true)`
+ * loops testing their condition first, `continue` in a for loop jumps to
+ * a label in front of the increment.
+ */
+class Transpiler {
+public:
+	Transpiler(const GlobalEnvironment& globals) : m_globals(globals) { }
+
+	// frame_size is the number of slots the resolver gave the locals of top level blocks
+	std::string transpile(const std::vector<StmtPtr>& statements, int frame_size) {
+		FunctionState script{};
+		script.name = "script";
+		script.display_name = "script";
+		script.frame_size = frame_size;
+		script.scopes.emplace_back();
+		find_boxed(script, statements);
+		m_current = &script;
+		for (const auto& statement : statements) {
+			emit_statement(statement);
+		}
+		line("return Value(nullptr);");
+		m_current = nullptr;
+		add_function(script);
+
+		std::string out;
+		out += "// Generated by toyc, do not edit.\n";
+		out += "// Build with the Toy runtime: the src directory on the include path, linked with toy_runtime\n";
+		out += "#include \"AOT/Runtime.h\"\n\n";
+		out += "namespace {\n\n";
+		if (!m_strings.empty()) {
+			out += "Value strings[" + std::to_string(m_strings.size()) + "]{};\n\n";
+		}
+		for (const auto& function : m_functions) {
+			out += "Value " + function.name + "(Runtime& rt, AotFunction* self, Value* f);\n";
+		}
+		out += "\n";
+		for (const auto& function : m_functions) {
+			out += function.proto + "\n";
+		}
+		for (const auto& function : m_functions) {
+			out += "\n" + function.code;
+		}
+		out += "\n} // namespace\n\n";
+
+		out += "int main() {\n";
+		out += "\tRuntime rt({";
+		for (int slot = 0; slot < m_globals.size(); slot++) {
+			out += (slot == 0 ? " " : ", ") + string_literal(m_globals.name(slot));
+		}
+		out += " });\n";
+		for (size_t i = 0; i < m_strings.size(); i++) {
+			out += "\tstrings[" + std::to_string(i) + "] = rt.literal(" + string_literal(m_strings[i]) + ");\n";
+		}
+		out += "\treturn rt.run(proto_script) ? 0 : 70;\n";
+		out += "}\n";
+		return out;
+	}
+
+private:
+	struct Loop {
+		// Label in front of the increment, empty for while loops
+		std::string continue_label{};
+		bool continue_used{false};
+	};
+
+	struct FunctionState {
+		// Of the generated C++ function and of the Toy function
+		std::string name{};
+		std::string display_name{};
+		int arity{0};
+		std::string body{};
+		int indent{1};
+		// Slots the resolver gave the locals, temporaries come after them
+		int frame_size{0};
+		int temporaries{0};
+		int max_temporaries{0};
+		// Slots holding boxes, because an inner function captures them
+		std::vector<bool> boxed{};
+		// Local slots declared in each open scope, redeclaring one assigns to it
+		std::vector<std::vector<int>> scopes{};
+		std::vector<Loop> loops{};
+	};
+
+	struct GeneratedFunction {
+		std::string name{};
+		std::string proto{};
+		std::string code{};
+	};
+
+	// C++ code reading a value, all code computing it was emitted before
+	struct Operand {
+		std::string code{};
+		// Can't be changed by code emitted later: constants and temporaries
+		bool stable{false};
+	};
+
+	void line(const std::string& code) {
+		m_current->body.append(m_current->indent, '\t');
+		m_current->body += code;
+		m_current->body += "\n";
+	}
+	void open(const std::string& code) {
+		line(code);
+		m_current->indent++;
+	}
+	void close(const std::string& code = "}") {
+		m_current->indent--;
+		line(code);
+	}
+
+	void add_function(const FunctionState& function) {
+		GeneratedFunction generated{};
+		generated.name = function.name;
+		generated.proto = "const AotProto proto_" + function.name + "{ " + string_literal(function.display_name) + ", "
+			+ std::to_string(function.arity) + ", " + std::to_string(function.frame_size + function.max_temporaries)
+			+ ", " + function.name + " };";
+		generated.code = "Value " + function.name + "(Runtime& rt, AotFunction* self, Value* f) {\n"
+			+ function.body + "}\n";
+		m_functions.push_back(std::move(generated));
+	}
+
+	// Marks the slots of function the functions declared in statements capture
+	static void find_boxed(FunctionState& function, const std::vector<StmtPtr>& statements) {
+		for (const auto& statement : statements) {
+			find_boxed(function, statement);
+		}
+	}
+	static void find_boxed(FunctionState& function, StmtPtr stmt) {
+		if (!stmt) return;
+		switch (stmt->node_kind()) {
+			case StmtKind::BLOCK:
+				find_boxed(function, static_cast<Block*>(stmt)->statements());
+				break;
+			case StmtKind::IF: {
+				auto* if_stmt = static_cast<If*>(stmt);
+				find_boxed(function, if_stmt->then_branch());
+				find_boxed(function, if_stmt->else_branch());
+				break;
+			}
+			case StmtKind::WHILE:
+				find_boxed(function, static_cast<While*>(stmt)->body());
+				break;
+			case StmtKind::FOR: {
+				auto* for_stmt = static_cast<For*>(stmt);
+				find_boxed(function, for_stmt->initializer());
+				find_boxed(function, for_stmt->body());
+				break;
+			}
+			case StmtKind::FUNCTION:
+				// Only its own captures, the body's belong to the inner function
+				for (const auto& upvalue : static_cast<Function*>(stmt)->upvalues()) {
+					if (!upvalue.is_local) continue;
+					if (upvalue.index >= static_cast<int>(function.boxed.size())) {
+						function.boxed.resize(upvalue.index + 1, false);
+					}
+					function.boxed[upvalue.index] = true;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	bool is_boxed(int slot) const {
+		return slot < static_cast<int>(m_current->boxed.size()) && m_current->boxed[slot];
+	}
+
+	// Temporaries are slots past the locals, allocated like a stack
+	int allocate_temporaries(int count) {
+		const int first = m_current->frame_size + m_current->temporaries;
+		m_current->temporaries += count;
+		m_current->max_temporaries = std::max(m_current->max_temporaries, m_current->temporaries);
+		return first;
+	}
+	static std::string slot(int index) {
+		return "f[" + std::to_string(index) + "]";
+	}
+
+	/*
+	 * Statements
+	 */
+	void emit_statement(StmtPtr stmt) {
+		// Temporaries only live as long as the statement using them
+		const int temporaries = m_current->temporaries;
+		switch (stmt->node_kind()) {
+			case StmtKind::EXPRESSION:
+				emit_expr(static_cast<Expression*>(stmt)->expression());
+				break;
+			case StmtKind::PRINT:
+				line("rt.print(" + emit_expr(static_cast<Print*>(stmt)->expression()).code + ");");
+				break;
+			case StmtKind::SLEEP: {
+				auto* sleep = static_cast<Sleep*>(stmt);
+				line("rt.sleep(" + emit_expr(sleep->expression()).code + ", " + std::to_string(sleep->token().line()) + ");");
+				break;
+			}
+			case StmtKind::VAR: {
+				auto* var = static_cast<Var*>(stmt);
+				const auto value = var->initializer() ? emit_expr(var->initializer()).code : "Value(nullptr)";
+				declare(var->kind(), var->slot(), value);
+				break;
+			}
+			case StmtKind::FUNCTION:
+				emit_function(static_cast<Function*>(stmt));
+				break;
+			case StmtKind::BLOCK:
+				open("{");
+				emit_block(static_cast<Block*>(stmt)->statements());
+				close();
+				break;
+			case StmtKind::IF: {
+				auto* if_stmt = static_cast<If*>(stmt);
+				open("if (Runtime::is_truthy(" + emit_expr(if_stmt->condition()).code + ")) {");
+				emit_branch(if_stmt->then_branch());
+				if (if_stmt->else_branch()) {
+					close("} else {");
+					m_current->indent++;
+					emit_branch(if_stmt->else_branch());
+				}
+				close();
+				break;
+			}
+			case StmtKind::WHILE: {
+				auto* while_stmt = static_cast<While*>(stmt);
+				open("while (true) {");
+				emit_condition(while_stmt->condition());
+				emit_loop_body(while_stmt->body(), {});
+				close();
+				break;
+			}
+			case StmtKind::FOR:
+				emit_for(static_cast<For*>(stmt));
+				break;
+			case StmtKind::BREAK:
+				line("break;");
+				break;
+			case StmtKind::CONTINUE: {
+				auto& loop = m_current->loops.back();
+				if (loop.continue_label.empty()) {
+					line("continue;");
+				} else {
+					line("goto " + loop.continue_label + ";");
+					loop.continue_used = true;
+				}
+				break;
+			}
+			case StmtKind::RETURN:
+				emit_return(static_cast<Return*>(stmt));
+				break;
+		}
+		m_current->temporaries = temporaries;
+	}
+
+	void emit_block(const std::vector<StmtPtr>& statements) {
+		m_current->scopes.emplace_back();
+		for (const auto& statement : statements) {
+			emit_statement(statement);
+		}
+		m_current->scopes.pop_back();
+	}
+	// The braces of a Block branch double as the braces of the if
+	void emit_branch(StmtPtr stmt) {
+		if (stmt->node_kind() == StmtKind::BLOCK) {
+			emit_block(static_cast<Block*>(stmt)->statements());
+		} else {
+			emit_statement(stmt);
+		}
+	}
+	// Leaves the innermost loop once condition is falsey
+	void emit_condition(ExprPtr condition) {
+		const int temporaries = m_current->temporaries;
+		line("if (!Runtime::is_truthy(" + emit_expr(condition).code + ")) break;");
+		m_current->temporaries = temporaries;
+	}
+	void emit_loop_body(StmtPtr body, std::string continue_label) {
+		m_current->loops.push_back({ std::move(continue_label) });
+		emit_branch(body);
+		if (m_current->loops.back().continue_used) {
+			line(m_current->loops.back().continue_label + ":;");
+		}
+		m_current->loops.pop_back();
+	}
+
+	void emit_for(For* stmt) {
+		// The resolver declared the initializer in the enclosing scope
+		if (stmt->initializer()) {
+			emit_statement(stmt->initializer());
+		}
+		open("while (true) {");
+		if (stmt->condition()) {
+			emit_condition(stmt->condition());
+		}
+		emit_loop_body(stmt->body(), "continue_" + std::to_string(m_labels++));
+		if (stmt->increment()) {
+			const int temporaries = m_current->temporaries;
+			emit_expr(stmt->increment());
+			m_current->temporaries = temporaries;
+		}
+		close();
+	}
+
+	void emit_return(Return* stmt) {
+		if (!stmt->value()) {
+			line("return Value(nullptr);");
+			return;
+		}
+		if (!stmt->tail_call()) {
+			line("return " + emit_expr(stmt->value()).code + ";");
+			return;
+		}
+		auto* call = static_cast<Call*>(stmt->value());
+		const int callee = emit_call_operands(call);
+		line("return rt.tail_call(f + " + std::to_string(callee) + ", " + std::to_string(call->arguments().size())
+			+ ", " + std::to_string(call->paren().line()) + ");");
+	}
+
+	// Declarations are either globals or locals of the current frame
+	void declare(VariableKind kind, int slot, const std::string& value) {
+		if (kind == VariableKind::GLOBAL) {
+			line("rt.define_global(" + std::to_string(slot) + ", " + value + ");");
+			return;
+		}
+		auto& scope = m_current->scopes.back();
+		const bool redeclared = std::find(scope.begin(), scope.end(), slot) != scope.end();
+		if (!redeclared) {
+			scope.push_back(slot);
+		}
+		if (!is_boxed(slot)) {
+			line(this->slot(slot) + " = " + value + ";");
+		} else if (redeclared) {
+			line("Runtime::unbox(" + this->slot(slot) + ") = " + value + ";");
+		} else {
+			// Every execution of a declaration makes a new variable for closures to capture
+			line(this->slot(slot) + " = " + value + ";");
+			line("rt.box(f + " + std::to_string(slot) + ");");
+		}
+	}
+
+	void emit_function(Function* stmt) {
+		const auto name = "fn_" + std::to_string(m_function_count++) + "_" + std::string(stmt->name().lexeme());
+
+		FunctionState function{};
+		function.name = name;
+		function.display_name = std::string(stmt->name().lexeme());
+		function.arity = static_cast<int>(stmt->params().size());
+		function.frame_size = stmt->frame_size();
+		function.scopes.emplace_back();
+		find_boxed(function, stmt->body());
+
+		auto* enclosing = m_current;
+		m_current = &function;
+		// Parameters occupy the first slots of the frame
+		for (int i = 0; i < static_cast<int>(stmt->params().size()); i++) {
+			function.scopes.back().push_back(i);
+			if (is_boxed(i)) {
+				line("rt.box(f + " + std::to_string(i) + ");");
+			}
+		}
+		for (const auto& statement : stmt->body()) {
+			emit_statement(statement);
+		}
+		line("return Value(nullptr);");
+		m_current = enclosing;
+		add_function(function);
+
+		open("{");
+		line("auto* function = rt.make_function(proto_" + name + ");");
+		declare(stmt->kind(), stmt->slot(), "Value(Value::Type::CLOSURE, function)");
+		for (const auto& upvalue : stmt->upvalues()) {
+			line(upvalue.is_local
+				? "function->capture(Runtime::box_of(" + slot(upvalue.index) + "));"
+				: "function->capture(self->upvalues()[" + std::to_string(upvalue.index) + "]);");
+		}
+		close();
+	}
+
+	/*
+	 * Expressions
+	 */
+	// Constants and locals are read in place, anything else is computed into a temporary
+	Operand emit_expr(ExprPtr expr) {
+		switch (expr->node_kind()) {
+			case ExprKind::LITERAL:
+				return { literal(static_cast<Literal*>(expr)->value()), true };
+			case ExprKind::GROUPING:
+				return emit_expr(static_cast<Grouping*>(expr)->expression());
+			case ExprKind::VARIABLE: {
+				auto* variable = static_cast<Variable*>(expr);
+				if (variable->kind() != VariableKind::GLOBAL) {
+					return { read(variable->kind(), variable->slot()), false };
+				}
+				break;
+			}
+			case ExprKind::ASSIGN: {
+				auto* assign = static_cast<Assign*>(expr);
+				auto value = emit_expr(assign->value());
+				emit_store(assign, value.code);
+				return value;
+			}
+			default:
+				break;
+		}
+		const int temporary = allocate_temporaries(1);
+		emit_expr(expr, temporary);
+		return { slot(temporary), true };
+	}
+
+	// Computes expr into the frame slot target
+	void emit_expr(ExprPtr expr, int target) {
+		const auto to = slot(target) + " = ";
+		switch (expr->node_kind()) {
+			case ExprKind::LITERAL:
+			case ExprKind::ASSIGN:
+				line(to + emit_expr(expr).code + ";");
+				break;
+			case ExprKind::GROUPING:
+				emit_expr(static_cast<Grouping*>(expr)->expression(), target);
+				break;
+			case ExprKind::VARIABLE: {
+				auto* variable = static_cast<Variable*>(expr);
+				if (variable->kind() == VariableKind::GLOBAL) {
+					line(to + "rt.global(" + std::to_string(variable->slot()) + ", " + std::to_string(variable->name().line()) + ");");
+				} else {
+					line(to + read(variable->kind(), variable->slot()) + ";");
+				}
+				break;
+			}
+			case ExprKind::UNARY: {
+				auto* unary = static_cast<Unary*>(expr);
+				const auto operand = emit_expr(unary->right()).code;
+				if (unary->op().type() == TokenType::BANG) {
+					line(to + "Value(!Runtime::is_truthy(" + operand + "));");
+				} else {
+					line(to + "Runtime::negate(" + operand + ", " + std::to_string(unary->op().line()) + ");");
+				}
+				break;
+			}
+			case ExprKind::BINARY: {
+				auto* binary = static_cast<Binary*>(expr);
+				auto left = emit_expr(binary->left());
+				// Read the variable before the rhs gets a chance to change it
+				if (!left.stable && has_side_effects(binary->right())) {
+					const int temporary = allocate_temporaries(1);
+					line(slot(temporary) + " = " + left.code + ";");
+					left = { slot(temporary), true };
+				}
+				const auto right = emit_expr(binary->right());
+				line(to + "rt." + binary_operation(binary->op().type()) + "(" + left.code + ", " + right.code
+					+ ", " + std::to_string(binary->op().line()) + ");");
+				break;
+			}
+			case ExprKind::LOGICAL: {
+				// The lhs is the result unless it doesn't decide the outcome
+				auto* logical = static_cast<Logical*>(expr);
+				emit_expr(logical->left(), target);
+				const bool is_or = logical->op().type() == TokenType::OR;
+				open(std::string("if (") + (is_or ? "!" : "") + "Runtime::is_truthy(" + slot(target) + ")) {");
+				emit_expr(logical->right(), target);
+				close();
+				break;
+			}
+			case ExprKind::CALL: {
+				auto* call = static_cast<Call*>(expr);
+				const int callee = emit_call_operands(call);
+				line(to + "rt.call(f + " + std::to_string(callee) + ", " + std::to_string(call->arguments().size())
+					+ ", " + std::to_string(call->paren().line()) + ");");
+				break;
+			}
+		}
+	}
+
+	// Evaluates the callee and the arguments into consecutive temporaries,
+	// returns the callee's slot. The arguments become the callee's frame
+	int emit_call_operands(Call* call) {
+		const auto& arguments = call->arguments();
+		const int callee = allocate_temporaries(static_cast<int>(arguments.size()) + 1);
+		emit_expr(call->callee(), callee);
+		for (int i = 0; i < static_cast<int>(arguments.size()); i++) {
+			emit_expr(arguments[i], callee + 1 + i);
+		}
+		return callee;
+	}
+
+	std::string read(VariableKind kind, int index) const {
+		if (kind == VariableKind::UPVALUE) {
+			return "self->upvalue(" + std::to_string(index) + ")";
+		}
+		return is_boxed(index) ? "Runtime::unbox(" + slot(index) + ")" : slot(index);
+	}
+
+	void emit_store(Assign* expr, const std::string& value) {
+		switch (expr->kind()) {
+			case VariableKind::LOCAL:
+			case VariableKind::UPVALUE:
+				line(read(expr->kind(), expr->slot()) + " = " + value + ";");
+				break;
+			case VariableKind::GLOBAL:
+				line("rt.assign_global(" + std::to_string(expr->slot()) + ", " + value + ", " + std::to_string(expr->name().line()) + ");");
+				break;
+		}
+	}
+
+	// Whether evaluating expr could change a variable
+	static bool has_side_effects(ExprPtr expr) {
+		switch (expr->node_kind()) {
+			case ExprKind::ASSIGN:
+			case ExprKind::CALL:
+				return true;
+			case ExprKind::GROUPING:
+				return has_side_effects(static_cast<Grouping*>(expr)->expression());
+			case ExprKind::UNARY:
+				return has_side_effects(static_cast<Unary*>(expr)->right());
+			case ExprKind::BINARY: {
+				auto* binary = static_cast<Binary*>(expr);
+				return has_side_effects(binary->left()) || has_side_effects(binary->right());
+			}
+			case ExprKind::LOGICAL: {
+				auto* logical = static_cast<Logical*>(expr);
+				return has_side_effects(logical->left()) || has_side_effects(logical->right());
+			}
+			default:
+				return false;
+		}
+	}
+
+	static const char* binary_operation(TokenType type) {
+		switch (type) {
+			case TokenType::PLUS: return "add";
+			case TokenType::MINUS: return "subtract";
+			case TokenType::STAR: return "multiply";
+			case TokenType::SLASH: return "divide";
+			case TokenType::GREATER: return "greater";
+			case TokenType::GREATER_EQUAL: return "greater_equal";
+			case TokenType::LESS: return "less";
+			case TokenType::LESS_EQUAL: return "less_equal";
+			case TokenType::EQUAL_EQUAL: return "equal";
+			case TokenType::BANG_EQUAL: return "not_equal";
+			default: return "unknown_operator";
+		}
+	}
+
+	std::string literal(const Value& value) {
+		switch (value.type()) {
+			case Value::Type::NUMBER: return "Value(" + number_literal(value.as_double()) + ")";
+			case Value::Type::BOOL: return value.as_bool() ? "Value(true)" : "Value(false)";
+			case Value::Type::STRING: return "strings[" + std::to_string(string_index(value.as_string())) + "]";
+			default: return "Value(nullptr)";
+		}
+	}
+
+	static std::string number_literal(double value) {
+		if (std::isnan(value)) return "std::numeric_limits<double>::quiet_NaN()";
+		if (std::isinf(value)) return value > 0 ? "std::numeric_limits<double>::infinity()" : "-std::numeric_limits<double>::infinity()";
+		// Enough digits to read back the same double
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+		std::string literal = buffer;
+		if (literal.find_first_of(".e") == std::string::npos) {
+			literal += ".0";
+		}
+		return literal;
+	}
+
+	static std::string string_literal(const std::string& value) {
+		std::string literal = "\"";
+		for (const char c : value) {
+			switch (c) {
+				case '"': literal += "\\\""; break;
+				case '\\': literal += "\\\\"; break;
+				case '\n': literal += "\\n"; break;
+				case '\r': literal += "\\r"; break;
+				case '\t': literal += "\\t"; break;
+				default:
+					if (static_cast<unsigned char>(c) < 0x20) {
+						// Octal escapes stop after three digits, unlike hex ones
+						char escape[5];
+						std::snprintf(escape, sizeof(escape), "\\%03o", static_cast<unsigned char>(c));
+						literal += escape;
+					} else {
+						literal += c;
+					}
+			}
+		}
+		return literal + "\"";
+	}
+
+	// Identical literals share one string
+	int string_index(const std::string& value) {
+		if (const auto it = m_string_indices.find(value); it != m_string_indices.end()) {
+			return it->second;
+		}
+		const int index = static_cast<int>(m_strings.size());
+		m_strings.push_back(value);
+		m_string_indices.emplace(value, index);
+		return index;
+	}
+
+private:
+	const GlobalEnvironment& m_globals;
+	FunctionState* m_current{nullptr};
+	std::vector<GeneratedFunction> m_functions{};
+	int m_function_count{0};
+	std::vector<std::string> m_strings{};
+	std::unordered_map<std::string, int> m_string_indices{};
+	int m_labels{0};
+};
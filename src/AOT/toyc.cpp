@@ -0,0 +1,60 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include "../Toy.h"
+
+/*
+ * Ahead of time compiler: translates a script into C++ that the system
+ * compiler builds into a native executable, linked against toy_runtime.
+ *
+ *	toyc [--no-optimize] [-o <output.cpp>] <script>
+ *	c++ -std=c++20 -O2 -I<repository>/src script.cpp <toy_runtime library>
+ *
+ * The output defaults to the script's path with a .cpp extension. The CMake
+ * function toy_add_executable does both steps for a script in the build.
+ */
+int main(int argc, char* argv[]) {
+	Toy toy;
+	std::string script{};
+	std::string output{};
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		if (arg == "--no-optimize") {
+			toy.set_optimize(false);
+		} else if (arg == "-o" && i + 1 < argc) {
+			output = argv[++i];
+		} else {
+			script = arg;
+		}
+	}
+	if (script.empty()) {
+		std::cerr << "Usage: toyc [--no-optimize] [-o <output.cpp>] <script>\n";
+		return 64;
+	}
+	if (output.empty()) {
+		output = std::filesystem::path(script).replace_extension(".cpp").string();
+	}
+
+	std::ifstream file(script);
+	if (!file) {
+		std::cerr << "Could not open file \"" << script << "\".\n";
+		return 74;
+	}
+	std::stringstream source;
+	source << file.rdbuf();
+
+	// Nothing is written for a script with errors
+	std::stringstream code;
+	if (!toy.transpile(source.str(), code)) {
+		return 65;
+	}
+	std::ofstream out(output, std::ios::binary);
+	if (!(out << code.rdbuf())) {
+		std::cerr << "Could not write \"" << output << "\".\n";
+		return 74;
+	}
+	return 0;
+}
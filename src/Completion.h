@@ -0,0 +1,46 @@
+#pragma once
+#include "Value.h"
+
+// How a statement finished executing. break, continue and return are handed
+// back up through the enclosing statements until a loop or function call
+// consumes them, instead of unwinding the native stack with an exception.
+// TAIL_CALL is a return whose value is still to be computed by a call the
+// interpreter has set aside, the function call consuming it makes that call
+// in place of itself.
+class Completion {
+public:
+	enum class Type : uint8_t {
+		NORMAL,
+		BREAK,
+		CONTINUE,
+		RETURN,
+		TAIL_CALL,
+	};
+
+	Completion() = default;
+	Completion(Type type) : m_type(type) { }
+
+	static Completion return_value(Value value) {
+		Completion completion(Type::RETURN);
+		completion.m_value = std::move(value);
+		return completion;
+	}
+
+	Type type() const {
+		return m_type;
+	}
+	bool is_normal() const {
+		return m_type == Type::NORMAL;
+	}
+	// Leaves the enclosing function, with or without a value yet
+	bool is_return() const {
+		return m_type == Type::RETURN || m_type == Type::TAIL_CALL;
+	}
+	// The returned value, only set for Type::RETURN
+	Value& value() {
+		return m_value;
+	}
+private:
+	Type m_type{Type::NORMAL};
+	Value m_value{nullptr};
+};
@@ -0,0 +1,171 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Object.h"
+#include "Value.h"
+
+class Heap;
+
+// Anything holding Values the collector can't find by tracing other objects
+// (the interpreter's frames and temporaries, the VM stack, globals)
+class HeapRoots {
+public:
+	virtual ~HeapRoots() = default;
+	virtual void mark_roots(Heap& heap) = 0;
+};
+
+/*
+ * Owns every Object created while running a script and frees the ones that
+ * can no longer be reached with a simple mark and sweep.
+ * A collection is started by an allocation once the live bytes pass a
+ * threshold, so callers must keep every object they still need reachable
+ * from a root while they allocate.
+ */
+class Heap {
+public:
+	struct Config {
+		// No collection happens until this many bytes are live
+		size_t initial_threshold{1024 * 1024};
+		// After a collection the next one is scheduled at live bytes * growth_factor
+		double growth_factor{2.0};
+		// Collect on every allocation, useful to shake out missing roots
+		bool stress{false};
+	};
+
+	struct Stats {
+		size_t collections{0};
+		size_t objects_allocated{0};
+		size_t objects_freed{0};
+		size_t bytes_freed{0};
+		size_t live_bytes{0};
+		size_t peak_live_bytes{0};
+		std::chrono::nanoseconds pause_time{0};
+	};
+
+	Heap() = default;
+	Heap(Config config) : m_config(config), m_next_collection(config.initial_threshold) { }
+	Heap(const Heap&) = delete;
+	Heap& operator=(const Heap&) = delete;
+	~Heap() {
+		while (m_objects) {
+			auto* next = m_objects->m_next;
+			delete m_objects;
+			m_objects = next;
+		}
+	}
+
+	template<typename T, typename... Args>
+	T* make(Args&&... args) {
+		// Collect before the new object exists so it can't be swept before the caller roots it
+		if (m_config.stress || m_stats.live_bytes > m_next_collection) {
+			collect();
+		}
+		auto* object = new T(std::forward<Args>(args)...);
+		object->m_next = m_objects;
+		m_objects = object;
+
+		const auto size = object->size();
+		m_stats.objects_allocated++;
+		m_stats.live_bytes += size;
+		m_stats.peak_live_bytes = std::max(m_stats.peak_live_bytes, m_stats.live_bytes);
+		return object;
+	}
+
+	Value make_string(std::string value) {
+		return Value(make<ToyString>(std::move(value)));
+	}
+
+	// Strings referenced from tokens and the AST, which aren't traced, so
+	// they are never collected
+	Value make_literal(std::string value) {
+		auto* string = make<ToyString>(std::move(value));
+		string->m_pinned = true;
+		return Value(string);
+	}
+
+	void add_roots(HeapRoots* roots) {
+		m_roots.push_back(roots);
+	}
+	void remove_roots(HeapRoots* roots) {
+		m_roots.erase(std::remove(m_roots.begin(), m_roots.end(), roots), m_roots.end());
+	}
+
+	void mark(const Value& value) {
+		if (value.is_object()) {
+			mark(value.as_object());
+		}
+	}
+	void mark(Object* object) {
+		if (!object || object->m_marked) return;
+		object->m_marked = true;
+		m_gray.push_back(object);
+	}
+
+	void collect() {
+		const auto start = std::chrono::steady_clock::now();
+
+		for (auto* roots : m_roots) {
+			roots->mark_roots(*this);
+		}
+		while (!m_gray.empty()) {
+			auto* object = m_gray.back();
+			m_gray.pop_back();
+			object->trace(*this);
+		}
+		sweep();
+
+		m_next_collection = std::max(m_config.initial_threshold,
+			static_cast<size_t>(m_stats.live_bytes * m_config.growth_factor));
+		m_stats.collections++;
+		m_stats.pause_time += std::chrono::steady_clock::now() - start;
+	}
+
+	const Stats& stats() const {
+		return m_stats;
+	}
+
+private:
+	void sweep() {
+		// Objects like environments grow after they are allocated, so live
+		// bytes are recounted rather than adjusted
+		size_t live_bytes = 0;
+		Object** link = &m_objects;
+		while (*link) {
+			auto* object = *link;
+			if (object->m_marked || object->m_pinned) {
+				object->m_marked = false;
+				live_bytes += object->size();
+				link = &object->m_next;
+				continue;
+			}
+			*link = object->m_next;
+
+			m_stats.objects_freed++;
+			m_stats.bytes_freed += object->size();
+			delete object;
+		}
+		m_stats.live_bytes = live_bytes;
+	}
+
+private:
+	Config m_config{};
+	Stats m_stats{};
+	size_t m_next_collection{Config{}.initial_threshold};
+	Object* m_objects{nullptr};
+	std::vector<Object*> m_gray{};
+	std::vector<HeapRoots*> m_roots{};
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Heap::Stats& stats) {
+	return os << "[gc] collections: " << stats.collections
+		<< ", allocated: " << stats.objects_allocated << " objects"
+		<< ", freed: " << stats.objects_freed << " objects / " << stats.bytes_freed << " bytes"
+		<< ", live: " << stats.live_bytes << " bytes (peak " << stats.peak_live_bytes << ")"
+		<< ", pause: " << std::chrono::duration<double, std::milli>(stats.pause_time).count() << " ms";
+}
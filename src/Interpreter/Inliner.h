@@ -0,0 +1,350 @@
+#pragma once
+#include <initializer_list>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../Lexer/AstArena.h"
+#include "../Lexer/Expr.h"
+#include "../Lexer/Stmt.h"
+
+/*
+ * Static pass run after the Resolver, expanding calls of tiny global
+ * functions in place so they skip the frame, the argument copies and the
+ * block the call would run.
+ *
+ * A function qualifies when it is declared once at the top level, captures
+ * nothing and its body is a single `return` of at most MAX_NODES nodes
+ * built from literals, its parameters, globals and operators. Such a body
+ * has no side effects and calls nothing, so it can't recurse. Its name
+ * must only ever be called, never passed around as a value.
+ *
+ * A call site is expanded when its arguments are literals or locals: those
+ * are free to read any number of times, or not at all, so the parameters
+ * are simply replaced by them. The expansion is recorded on the Call next
+ * to the original, which stays as the fallback. The interpreter only uses
+ * the expansion once the call site's inline cache has checked the global
+ * still holds the function it was expanded from, a rebinding of the name
+ * invalidates the cache and sends the call back through the regular path.
+ */
+class Inliner {
+public:
+	// Largest body, in nodes, that is copied into call sites
+	static constexpr int MAX_NODES = 12;
+
+	Inliner(AstArena& arena) : m_arena(arena) { }
+
+	void inline_calls(const std::vector<StmtPtr>& statements) {
+		for (const auto& statement : statements) {
+			if (statement->node_kind() == StmtKind::FUNCTION) {
+				add_candidate(static_cast<Function*>(statement));
+			}
+		}
+		for (const auto& statement : statements) {
+			find_escapes(statement);
+		}
+		for (const auto& statement : statements) {
+			inline_calls(statement);
+		}
+	}
+
+	// One line per expanded call site and per function that was too big
+	std::string report() const {
+		return m_report.str();
+	}
+
+private:
+	struct Candidate {
+		Function* function{nullptr};
+		ExprPtr body{nullptr};
+		int declarations{0};
+		bool escapes{false};
+	};
+
+	void add_candidate(Function* function) {
+		if (function->kind() != VariableKind::GLOBAL) return;
+		auto& candidate = m_candidates[function->slot()];
+		candidate.declarations++;
+		candidate.function = function;
+		candidate.body = nullptr;
+
+		if (!function->upvalues().empty()) return;
+		// The parser wraps the body in a block
+		const auto* body = &function->body();
+		while (body->size() == 1 && (*body)[0]->node_kind() == StmtKind::BLOCK) {
+			body = &static_cast<Block*>((*body)[0])->statements();
+		}
+		if (body->size() != 1 || (*body)[0]->node_kind() != StmtKind::RETURN) return;
+		auto* value = static_cast<Return*>((*body)[0])->value();
+		if (!value) return;
+		const int nodes = count_nodes(value, static_cast<int>(function->params().size()));
+		if (nodes > MAX_NODES) {
+			m_report << "not inlined " << function->name().lexeme() << ": " << nodes
+				<< " nodes is over the budget of " << MAX_NODES << "\n";
+			return;
+		}
+		if (nodes > 0) {
+			candidate.body = value;
+		}
+	}
+	Candidate* candidate(Call* call) {
+		if (call->callee()->node_kind() != ExprKind::VARIABLE) return nullptr;
+		auto* callee = static_cast<Variable*>(call->callee());
+		if (callee->kind() != VariableKind::GLOBAL) return nullptr;
+		const auto it = m_candidates.find(callee->slot());
+		return it == m_candidates.end() ? nullptr : &it->second;
+	}
+
+	// Size of an expression that can be copied, 0 if it can't.
+	// The only locals of a body that is a single return are its parameters
+	static int count_nodes(ExprPtr expr, int arity) {
+		switch (expr->node_kind()) {
+			case ExprKind::LITERAL:
+				return 1;
+			case ExprKind::VARIABLE: {
+				auto* variable = static_cast<Variable*>(expr);
+				return variable->kind() == VariableKind::GLOBAL
+					|| (variable->kind() == VariableKind::LOCAL && variable->slot() < arity) ? 1 : 0;
+			}
+			case ExprKind::GROUPING:
+				return sum_nodes({ static_cast<Grouping*>(expr)->expression() }, arity);
+			case ExprKind::UNARY:
+				return sum_nodes({ static_cast<Unary*>(expr)->right() }, arity);
+			case ExprKind::BINARY:
+				return sum_nodes({ static_cast<Binary*>(expr)->left(), static_cast<Binary*>(expr)->right() }, arity);
+			case ExprKind::LOGICAL:
+				return sum_nodes({ static_cast<Logical*>(expr)->left(), static_cast<Logical*>(expr)->right() }, arity);
+			case ExprKind::ASSIGN:
+			case ExprKind::CALL:
+				return 0;
+		}
+		return 0;
+	}
+	static int sum_nodes(std::initializer_list<ExprPtr> children, int arity) {
+		int nodes = 1;
+		for (auto* child : children) {
+			const int count = count_nodes(child, arity);
+			if (count == 0) return 0;
+			nodes += count;
+		}
+		return nodes;
+	}
+
+	// Any reference to a function other than calling it could hand it to code that calls it differently
+	void find_escapes(StmtPtr stmt) {
+		if (!stmt) return;
+		switch (stmt->node_kind()) {
+			case StmtKind::BLOCK:
+				for (const auto& statement : static_cast<Block*>(stmt)->statements()) find_escapes(statement);
+				break;
+			case StmtKind::EXPRESSION:
+				find_escapes(static_cast<Expression*>(stmt)->expression());
+				break;
+			case StmtKind::PRINT:
+				find_escapes(static_cast<Print*>(stmt)->expression());
+				break;
+			case StmtKind::SLEEP:
+				find_escapes(static_cast<Sleep*>(stmt)->expression());
+				break;
+			case StmtKind::RETURN:
+				find_escapes(static_cast<Return*>(stmt)->value());
+				break;
+			case StmtKind::VAR:
+				find_escapes(static_cast<Var*>(stmt)->initializer());
+				break;
+			case StmtKind::FUNCTION:
+				for (const auto& statement : static_cast<Function*>(stmt)->body()) find_escapes(statement);
+				break;
+			case StmtKind::IF:
+				find_escapes(static_cast<If*>(stmt)->condition());
+				find_escapes(static_cast<If*>(stmt)->then_branch());
+				find_escapes(static_cast<If*>(stmt)->else_branch());
+				break;
+			case StmtKind::WHILE:
+				find_escapes(static_cast<While*>(stmt)->condition());
+				find_escapes(static_cast<While*>(stmt)->body());
+				break;
+			case StmtKind::FOR:
+				find_escapes(static_cast<For*>(stmt)->initializer());
+				find_escapes(static_cast<For*>(stmt)->condition());
+				find_escapes(static_cast<For*>(stmt)->increment());
+				find_escapes(static_cast<For*>(stmt)->body());
+				break;
+			case StmtKind::BREAK:
+			case StmtKind::CONTINUE:
+				break;
+		}
+	}
+	void find_escapes(ExprPtr expr) {
+		if (!expr) return;
+		switch (expr->node_kind()) {
+			case ExprKind::VARIABLE: {
+				auto* variable = static_cast<Variable*>(expr);
+				if (variable->kind() != VariableKind::GLOBAL) break;
+				if (const auto it = m_candidates.find(variable->slot()); it != m_candidates.end()) {
+					it->second.escapes = true;
+				}
+				break;
+			}
+			case ExprKind::ASSIGN:
+				find_escapes(static_cast<Assign*>(expr)->value());
+				break;
+			case ExprKind::CALL: {
+				auto* call = static_cast<Call*>(expr);
+				// Only the callee itself is a call of it
+				if (!candidate(call)) find_escapes(call->callee());
+				for (const auto& argument : call->arguments()) find_escapes(argument);
+				break;
+			}
+			case ExprKind::BINARY:
+				find_escapes(static_cast<Binary*>(expr)->left());
+				find_escapes(static_cast<Binary*>(expr)->right());
+				break;
+			case ExprKind::LOGICAL:
+				find_escapes(static_cast<Logical*>(expr)->left());
+				find_escapes(static_cast<Logical*>(expr)->right());
+				break;
+			case ExprKind::UNARY:
+				find_escapes(static_cast<Unary*>(expr)->right());
+				break;
+			case ExprKind::GROUPING:
+				find_escapes(static_cast<Grouping*>(expr)->expression());
+				break;
+			case ExprKind::LITERAL:
+				break;
+		}
+	}
+
+	void inline_calls(StmtPtr stmt) {
+		if (!stmt) return;
+		switch (stmt->node_kind()) {
+			case StmtKind::BLOCK:
+				for (const auto& statement : static_cast<Block*>(stmt)->statements()) inline_calls(statement);
+				break;
+			case StmtKind::EXPRESSION:
+				inline_calls(static_cast<Expression*>(stmt)->expression());
+				break;
+			case StmtKind::PRINT:
+				inline_calls(static_cast<Print*>(stmt)->expression());
+				break;
+			case StmtKind::SLEEP:
+				inline_calls(static_cast<Sleep*>(stmt)->expression());
+				break;
+			case StmtKind::RETURN:
+				inline_calls(static_cast<Return*>(stmt)->value());
+				break;
+			case StmtKind::VAR:
+				inline_calls(static_cast<Var*>(stmt)->initializer());
+				break;
+			case StmtKind::FUNCTION:
+				for (const auto& statement : static_cast<Function*>(stmt)->body()) inline_calls(statement);
+				break;
+			case StmtKind::IF:
+				inline_calls(static_cast<If*>(stmt)->condition());
+				inline_calls(static_cast<If*>(stmt)->then_branch());
+				inline_calls(static_cast<If*>(stmt)->else_branch());
+				break;
+			case StmtKind::WHILE:
+				inline_calls(static_cast<While*>(stmt)->condition());
+				inline_calls(static_cast<While*>(stmt)->body());
+				break;
+			case StmtKind::FOR:
+				inline_calls(static_cast<For*>(stmt)->initializer());
+				inline_calls(static_cast<For*>(stmt)->condition());
+				inline_calls(static_cast<For*>(stmt)->increment());
+				inline_calls(static_cast<For*>(stmt)->body());
+				break;
+			case StmtKind::BREAK:
+			case StmtKind::CONTINUE:
+				break;
+		}
+	}
+	void inline_calls(ExprPtr expr) {
+		if (!expr) return;
+		switch (expr->node_kind()) {
+			case ExprKind::CALL: {
+				auto* call = static_cast<Call*>(expr);
+				inline_calls(call->callee());
+				for (const auto& argument : call->arguments()) inline_calls(argument);
+				inline_call(call);
+				break;
+			}
+			case ExprKind::ASSIGN:
+				inline_calls(static_cast<Assign*>(expr)->value());
+				break;
+			case ExprKind::BINARY:
+				inline_calls(static_cast<Binary*>(expr)->left());
+				inline_calls(static_cast<Binary*>(expr)->right());
+				break;
+			case ExprKind::LOGICAL:
+				inline_calls(static_cast<Logical*>(expr)->left());
+				inline_calls(static_cast<Logical*>(expr)->right());
+				break;
+			case ExprKind::UNARY:
+				inline_calls(static_cast<Unary*>(expr)->right());
+				break;
+			case ExprKind::GROUPING:
+				inline_calls(static_cast<Grouping*>(expr)->expression());
+				break;
+			case ExprKind::VARIABLE:
+			case ExprKind::LITERAL:
+				break;
+		}
+	}
+
+	void inline_call(Call* call) {
+		auto* target = candidate(call);
+		if (!target || !target->body || target->declarations != 1 || target->escapes) return;
+		// A wrong argument count is an error the call reports
+		auto* function = target->function;
+		if (call->arguments().size() != function->params().size()) return;
+		for (const auto& argument : call->arguments()) {
+			if (!is_trivial(argument)) return;
+		}
+
+		call->set_inlined_function(function);
+		call->set_inlined_body(substitute(target->body, call->arguments()));
+		m_report << "inlined " << function->name().lexeme() << " at line " << call->paren().line() << "\n";
+	}
+	// Reading these has no effect and can't fail
+	static bool is_trivial(ExprPtr argument) {
+		if (argument->node_kind() == ExprKind::LITERAL) return true;
+		return argument->node_kind() == ExprKind::VARIABLE
+			&& static_cast<Variable*>(argument)->kind() != VariableKind::GLOBAL;
+	}
+
+	// Copies a body with its parameters replaced by the arguments. Operators are
+	// copied so every call site quickens on its own operand types, leaves are shared
+	ExprPtr substitute(ExprPtr expr, const std::vector<ExprPtr>& arguments) {
+		switch (expr->node_kind()) {
+			case ExprKind::VARIABLE: {
+				auto* variable = static_cast<Variable*>(expr);
+				return variable->kind() == VariableKind::LOCAL ? arguments[variable->slot()] : expr;
+			}
+			case ExprKind::GROUPING:
+				return m_arena.make<Grouping>(substitute(static_cast<Grouping*>(expr)->expression(), arguments));
+			case ExprKind::UNARY: {
+				auto* unary = static_cast<Unary*>(expr);
+				return m_arena.make<Unary>(unary->op(), substitute(unary->right(), arguments));
+			}
+			case ExprKind::BINARY: {
+				auto* binary = static_cast<Binary*>(expr);
+				auto* left = substitute(binary->left(), arguments);
+				return m_arena.make<Binary>(left, binary->op(), substitute(binary->right(), arguments));
+			}
+			case ExprKind::LOGICAL: {
+				auto* logical = static_cast<Logical*>(expr);
+				auto* left = substitute(logical->left(), arguments);
+				return m_arena.make<Logical>(left, logical->op(), substitute(logical->right(), arguments));
+			}
+			default:
+				return expr;
+		}
+	}
+
+	AstArena& m_arena;
+	// Global slot to the function declared in it
+	std::unordered_map<int, Candidate> m_candidates{};
+	std::ostringstream m_report{};
+};
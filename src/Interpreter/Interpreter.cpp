@@ -1 +1,48 @@
-#include "Interpreter.h"
\ No newline at end of file
+#include "Interpreter.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/resource.h>
+#endif
+
+uintptr_t Interpreter::native_stack_limit() {
+	const char marker{};
+	const auto top = reinterpret_cast<uintptr_t>(&marker);
+	// Lowest address of the current thread's stack, 0 when the platform doesn't tell
+	uintptr_t low = 0;
+#if defined(_WIN32)
+	ULONG_PTR stack_low = 0;
+	ULONG_PTR stack_high = 0;
+	GetCurrentThreadStackLimits(&stack_low, &stack_high);
+	low = stack_low;
+#elif defined(__APPLE__)
+	const auto high = reinterpret_cast<uintptr_t>(pthread_get_stackaddr_np(pthread_self()));
+	low = high - pthread_get_stacksize_np(pthread_self());
+#elif defined(__linux__)
+	pthread_attr_t attributes;
+	if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+		void* address = nullptr;
+		size_t size = 0;
+		if (pthread_attr_getstack(&attributes, &address, &size) == 0) {
+			low = reinterpret_cast<uintptr_t>(address);
+		}
+		pthread_attr_destroy(&attributes);
+	}
+#endif
+#ifndef _WIN32
+	// Scripts run on the main thread, whose stack may grow as far as the soft limit
+	if (low == 0) {
+		rlimit limit{};
+		if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < top) {
+			low = top - static_cast<uintptr_t>(limit.rlim_cur);
+		}
+	}
+#endif
+	if (low == 0 || low >= top) {
+		// Nothing to go by, assume the smallest default main thread stack
+		low = top - 1024 * 1024;
+	}
+	return low + std::min<uintptr_t>(NATIVE_STACK_RESERVE, (top - low) / 4);
+}
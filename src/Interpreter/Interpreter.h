@@ -1,366 +1,888 @@
-#pragma once
-#include <utility>
-#include <vector>
-#include <thread>
-
-
-#include "../Lexer/Errors.h"
-#include "../Lexer/Expr.h"
-#include "../Lexer/Stmt.h"
-#include "../Lexer/Environment.h"
-#include "../Toy.h"
-
-class ToyCallable : public Value {
-public:
-	virtual int arity() = 0;
-	virtual ValuePtr call(Interpreter*, std::vector<ValuePtr> arguments) = 0;
-};
-
-class ToyClock final : public ToyCallable {
-public:
-	int arity() override { return 0; }
-	ValuePtr call(Interpreter*, std::vector<ValuePtr>) override {
-		auto now = std::chrono::system_clock::now();
-		auto seconds = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
-		return create_value((double)seconds.count() / 1000.0);
-	}
-	std::string to_string() const override {
-		return "<native fn>";
-	}
-};
-
-class ReturnException : public std::exception {
-public:
-	ReturnException(ValuePtr value) : m_value(std::move(value)) {}
-	ValuePtr value() const {
-		return m_value;
-	}
-private:
-	ValuePtr m_value{nullptr};
-};
-
-class ToyFunction;
-
-class Interpreter final : public ExprVisitor, public StmtVisitor {
-public:
-	Interpreter(Toy& toy) : m_toy(toy), m_globals(std::make_shared<Environment>()), m_environment(m_globals) {
-		m_globals->define("clock", create_value<ToyClock>());
-	}
-
-	void interpret(const std::vector<StmtPtr>& statements) {
-		try {
-			for (auto statement : statements) {
-				execute(statement);
-			}
-		}
-		catch (const RuntimeError& e) {
-			m_toy.runtime_error(e);
-		}
-		catch (const ReturnException&) {
-			// TODO: print out value?
-		}
-	}
-
-	std::shared_ptr<Environment> globals() {
-		return m_globals;
-	}
-
-	//std::shared_ptr<Environment> environment() {
-	//	return m_environment;
-	//}
-
-	void execute(StmtPtr stmt) {
-		stmt->accept(this);
-	}
-
-	class EnvironmentTracker {
-	public:
-		EnvironmentTracker(std::shared_ptr<Environment>& current) : m_previous(current), m_current(current) { }
-		~EnvironmentTracker() {
-			m_current = m_previous;
-		}
-	private:
-		std::shared_ptr<Environment> m_previous;
-		std::shared_ptr<Environment>& m_current;
-	};
-	// Takes copy of current environment
-	void execute_block(std::vector<StmtPtr> statements, std::shared_ptr<Environment> environment) {
-		EnvironmentTracker eb(m_environment);
-		try {
-			m_environment = environment;
-			for (auto statement : statements) {
-				execute(statement);
-			}
-		}
-		catch (const RuntimeError& err) {
-			m_toy.runtime_error(err);
-		}
-	}
-private:
-
-	void visit_stmt(If* stmt) override {
-		if (is_truthy(evaluate(stmt->condition()))) {
-			execute(stmt->then_branch());
-		}
-		else if (stmt->else_branch()) {
-			execute(stmt->else_branch());
-		}
-	}
-
-	void visit_stmt(Block* stmt) override {
-		execute_block(stmt->statements(), std::make_shared<Environment>(m_environment));
-	}
-
-	class BreakException : public std::exception {};
-	void visit_stmt(Break*) override {
-		throw BreakException{};
-	}
-
-	class ContinueException : public std::exception {};
-	void visit_stmt(Continue*) override {
-		throw ContinueException{};
-	}
-
-	ValuePtr visit_expr(Literal* expr) override {
-		return expr->value();
-	}
-	ValuePtr visit_expr(Logical* expr) override {
-		auto left = evaluate(expr->left());
-		// Short circuit OR if lhs is true
-		if (expr->op().type() == TokenType::OR) {
-			if (is_truthy(left)) return left;
-		}
-		// Short circuit AND if lhs false
-		else if (!is_truthy(left)) {
-			return left;
-		}
-		return evaluate(expr->right());
-	}
-	ValuePtr visit_expr(Grouping* expr) override {
-		return evaluate(expr->expression());
-	}
-	ValuePtr visit_expr(Unary* expr) override {
-		auto right = evaluate(expr->right());
-		switch(expr->op().type()) {
-			case TokenType::BANG:
-				return create_value(!is_truthy(right));
-			case TokenType::MINUS:
-				check_number_operand(expr->op(), right);
-				return create_value(-right->as_double());
-		}
-		return nullptr;
-	}
-	ValuePtr visit_expr(Binary* expr) override {
-		const auto left = evaluate(expr->left());
-		const auto right = evaluate(expr->right());
-
-		switch (expr->op().type()) {
-			// Comparison
-			case TokenType::GREATER:
-				check_number_operands(expr->op(), left, right);
-				return create_value(left->as_double() > right->as_double());
-			case TokenType::GREATER_EQUAL:
-				check_number_operands(expr->op(), left, right);
-				return create_value(left->as_double() >= right->as_double());
-			case TokenType::LESS:
-				check_number_operands(expr->op(), left, right);
-				return create_value(left->as_double() < right->as_double());
-			case TokenType::LESS_EQUAL:
-				check_number_operands(expr->op(), left, right);
-				return create_value(left->as_double() <= right->as_double());
-
-			case TokenType::BANG_EQUAL: 
-				return create_value(left != right);
-			case TokenType::EQUAL_EQUAL: 
-				return create_value(left == right);
-
-			// Arithmetic
-			case TokenType::MINUS:
-				check_number_operands(expr->op(), left, right);
-				return create_value(left->as_double() - right->as_double());
-			case TokenType::PLUS:
-				if (left->is_number() && right->is_number()) {
-					return create_value(left->as_double() + right->as_double());
-				}
-				//if (left.is_string() && right.is_string()) {
-				//	return left.as_string() + right.as_string();
-				//}
-				// Allow either to be strings
-				if (left->is_string() || right->is_string()) {
-					return create_value(left->as_string() + right->as_string());
-				}
-				//throw RuntimeError(expr->op(), "Operands must be two numbers or two strings.");
-				throw RuntimeError(expr->op(), "Invalid operands.");
-			case TokenType::SLASH:
-				check_number_operands(expr->op(), left, right);
-				if (right->as_double() == 0.0) {
-					throw RuntimeError(expr->op(), "Division by zero.");
-				}
-				return create_value(left->as_double() / right->as_double());
-			case TokenType::STAR:
-				check_number_operands(expr->op(), left, right);
-				return create_value(left->as_double() * right->as_double());
-		}
-		return nullptr;
-	}
-	ValuePtr visit_expr(Call* expr) override {
-		auto callee = evaluate(expr->callee());
-
-		std::vector<ValuePtr> arguments{};
-		arguments.reserve(expr->arguments().size());
-		for (const auto& argument : expr->arguments()) {
-			arguments.push_back(evaluate(argument));
-		}
-
-		if (auto* function = dynamic_cast<ToyCallable*>(callee.get()); function) {
-			if (arguments.size() != function->arity()) {
-				throw RuntimeError(expr->paren(),
-					"Expected " + std::to_string(function->arity()) + " arguments but got "
-					+ std::to_string(arguments.size()) + ".");
-			}
-			return function->call(this, arguments);
-		}
-
-		throw RuntimeError(expr->paren(), "Can only call functions and classes.");
-	}
-
-	void visit_stmt(Expression* stmt) override {
-		evaluate(stmt->expression());
-	}
-
-	void visit_stmt(Function* stmt) {
-		m_environment->define(stmt->name().lexeme(), create_value<ToyFunction>(stmt, m_environment));
-	}
-
-	void visit_stmt(For* stmt) override {
-		if (stmt->initializer()) {
-			execute(stmt->initializer());
-		}
-		while (!stmt->condition() || is_truthy(evaluate(stmt->condition()))) {
-			try {
-				execute(stmt->body());
-			}
-			catch (const BreakException&) {
-				break;
-			}
-			catch (const ContinueException&) { }
-
-			if (stmt->increment()) {
-				evaluate(stmt->increment());
-			}
-		}
-	}
-
-	void visit_stmt(Print* stmt) override {
-		auto value = evaluate(stmt->expression());
-		std::cout << value->to_string() << "\n";
-	}
-
-
-	void visit_stmt(Return* stmt) override {
-		ValuePtr value = nullptr;
-		if (stmt->value()) {
-			value = evaluate(stmt->value());
-		}
-		else {
-			value = create_value(nullptr);
-		}
-		throw ReturnException(value);
-	}
-
-	void visit_stmt(Sleep* stmt) override {
-		auto value = evaluate(stmt->expression());
-		if (!value->is_number()) {
-			throw RuntimeError(stmt->token(), "sleep only accepts numbers");
-		}
-		std::this_thread::sleep_for(std::chrono::milliseconds((int)value->as_double()));
-	}
-
-	void visit_stmt(Var* stmt) override {
-		// Don't require initializer, set to nil
-		ValuePtr value = nullptr;
-		if (stmt->initializer()) {
-			value = evaluate(stmt->initializer());
-		} else {
-			value = create_value(nullptr);
-		}
-		m_environment->define(stmt->name().lexeme(), value);
-	}
-
-	void visit_stmt(While* stmt) override {
-		while (is_truthy(evaluate(stmt->condition()))) {
-			try {
-				execute(stmt->body());
-			}
-			catch (const BreakException&) {
-				break;
-			}
-			catch (const ContinueException&) { }
-		}
-	}
-
-	ValuePtr visit_expr(Variable* expr) override {
-		return m_environment->get(expr->name());
-	}
-
-	ValuePtr visit_expr(Assign* expr) {
-		auto value = evaluate(expr->value());
-		m_environment->assign(expr->name(), value);
-		return value;
-	}
-
-	ValuePtr evaluate(ExprPtr expr) {
-		return expr->accept(this);
-	}
-	bool is_truthy(ValuePtr value) {
-		if (value->is_bool()) return value->as_bool();
-
-		if (value->is_nil()) return false;
-
-		return true;
-
-	}
-
-	void check_number_operand(Token op, ValuePtr operand) const {
-		if (operand->is_number()) return;
-		throw RuntimeError(op, "Operand must be a number.");
-	}
-	void check_number_operands(Token op, ValuePtr left, ValuePtr right) const {
-		if (left->is_number() && right->is_number()) return;
-		throw RuntimeError(op, "Operands must be numbers.");
-	}
-
-private:
-	Toy& m_toy;
-	std::shared_ptr<Environment> m_globals{};
-	std::shared_ptr<Environment> m_environment{};
-};
-
-class ToyFunction final : public ToyCallable {
-public:
-	ToyFunction(Function* declaration, std::shared_ptr<Environment> closure) {
-		m_declaration = declaration;
-		m_closure = closure;
-	}
-	int arity() override { return m_declaration->params().size(); }
-	ValuePtr call(Interpreter* interpreter, std::vector<ValuePtr> arguments) override {
-		auto environment = std::make_shared<Environment>(m_closure);
-		
-		for (int i = 0; i < m_declaration->params().size(); i++) {
-			environment->define(m_declaration->params().at(i).lexeme(), arguments.at(i));
-		}
-
-		try {
-			interpreter->execute_block(m_declaration->body(), environment);
-		} catch (const ReturnException& e) { 
-			return e.value();
-		}
-		return create_value(nullptr);
-	}
-	std::string to_string() const override {
-		return "<fn " + m_declaration->name().lexeme() + ">";
-	}
-private:
-	Function* m_declaration{nullptr};
-	std::shared_ptr<Environment> m_closure{nullptr};
-};
+#pragma once
+#include <algorithm>
+#include <span>
+#include <utility>
+#include <vector>
+#include <thread>
+
+
+#include "../Lexer/Errors.h"
+#include "../Lexer/Expr.h"
+#include "../Lexer/Stmt.h"
+#include "../Lexer/Environment.h"
+#include "../Natives.h"
+#include "../Upvalue.h"
+#include "../Toy.h"
+#include "../JIT/Jit.h"
+
+class ToyFunction;
+
+class Interpreter final : public ExprVisitor, public StmtVisitor, public HeapRoots {
+public:
+	Interpreter(Toy& toy, Heap& heap) : m_toy(toy), m_heap(heap), m_stack(STACK_MAX), m_jit(toy.m_jit_config) {
+		m_frame = m_stack.data();
+		m_stack_top = m_stack.data();
+		m_heap.add_roots(this);
+		m_globals.define("clock", Value(m_heap.make<ToyClock>()));
+	}
+	~Interpreter() override {
+		m_heap.remove_roots(this);
+	}
+
+	// frame_size is the number of slots the resolver gave the locals of top level blocks
+	void interpret(const std::vector<StmtPtr>& statements, int frame_size) {
+		m_native_stack_limit = native_stack_limit();
+		m_frame = m_stack.data();
+		m_stack_top = m_frame + frame_size;
+		try {
+			for (auto statement : statements) {
+				// A top level return ends the script
+				if (!execute(statement).is_normal()) {
+					// TODO: print out value?
+					break;
+				}
+			}
+		}
+		catch (const RuntimeError& e) {
+			m_toy.runtime_error(e);
+		}
+	}
+
+	GlobalEnvironment& globals() {
+		return m_globals;
+	}
+
+	Heap& heap() {
+		return m_heap;
+	}
+
+	const Jit& jit() const {
+		return m_jit;
+	}
+
+	void mark_roots(Heap& heap) override {
+		m_globals.mark(heap);
+		for (const Value* slot = m_stack.data(); slot < m_stack_top; slot++) {
+			heap.mark(*slot);
+		}
+		for (auto* upvalue = m_open_upvalues; upvalue; upvalue = upvalue->next) {
+			heap.mark(upvalue);
+		}
+		heap.mark(m_function);
+		heap.mark(m_tail_function);
+		for (const auto& value : m_temporaries) {
+			heap.mark(value);
+		}
+	}
+
+	// With TOY_SWITCH_DISPATCH nodes are dispatched on their kind tag instead
+	// of through accept. Interpreter is final, so the visit called for each
+	// kind is known at compile time and can be inlined into the switch.
+	// Hot kinds come first
+	Completion execute(StmtPtr stmt) {
+#ifdef TOY_SWITCH_DISPATCH
+		switch (stmt->node_kind()) {
+			[[likely]] case StmtKind::EXPRESSION: return visit_stmt(static_cast<Expression*>(stmt));
+			[[likely]] case StmtKind::IF: return visit_stmt(static_cast<If*>(stmt));
+			[[likely]] case StmtKind::RETURN: return visit_stmt(static_cast<Return*>(stmt));
+			[[likely]] case StmtKind::VAR: return visit_stmt(static_cast<Var*>(stmt));
+			case StmtKind::BLOCK: return visit_stmt(static_cast<Block*>(stmt));
+			case StmtKind::FOR: return visit_stmt(static_cast<For*>(stmt));
+			case StmtKind::WHILE: return visit_stmt(static_cast<While*>(stmt));
+			case StmtKind::PRINT: return visit_stmt(static_cast<Print*>(stmt));
+			case StmtKind::BREAK: return visit_stmt(static_cast<Break*>(stmt));
+			case StmtKind::CONTINUE: return visit_stmt(static_cast<Continue*>(stmt));
+			case StmtKind::FUNCTION: return visit_stmt(static_cast<Function*>(stmt));
+			case StmtKind::SLEEP: return visit_stmt(static_cast<Sleep*>(stmt));
+		}
+		assert(false && "Unknown statement kind");
+		return {};
+#else
+		return stmt->accept(this);
+#endif
+	}
+
+	// Calls a function in a new frame starting at its arguments, which must
+	// be the topmost values on the stack
+	Value call_function(ToyFunction* function, std::span<Value> arguments);
+	// Sets up the current frame for a call to function, the arguments
+	// already sit in its first slots
+	void enter_frame(ToyFunction* function, size_t argument_count);
+
+	// Saves the caller's frame and restores it on scope exit, closing the
+	// upvalues still pointing into the callee's frame first
+	class FrameTracker {
+	public:
+		FrameTracker(Interpreter& interpreter)
+			: m_interpreter(interpreter), m_frame(interpreter.m_frame), m_stack_top(interpreter.m_stack_top), m_function(interpreter.m_function) { }
+		~FrameTracker() {
+			m_interpreter.close_upvalues(m_interpreter.m_frame);
+			m_interpreter.m_frame = m_frame;
+			m_interpreter.m_stack_top = m_stack_top;
+			m_interpreter.m_function = m_function;
+		}
+	private:
+		Interpreter& m_interpreter;
+		Value* m_frame;
+		Value* m_stack_top;
+		ToyFunction* m_function;
+	};
+	// Values held by native code while it evaluates something that may
+	// allocate are pushed onto the temporaries, this pops them on scope exit
+	class TemporaryRoots {
+	public:
+		TemporaryRoots(std::vector<Value>& temporaries) : m_temporaries(temporaries), m_size(temporaries.size()) { }
+		~TemporaryRoots() {
+			m_temporaries.resize(m_size);
+		}
+	private:
+		std::vector<Value>& m_temporaries;
+		size_t m_size;
+	};
+	// Pops the values pushed onto the stack during its scope on scope exit
+	class StackMark {
+	public:
+		StackMark(Interpreter& interpreter) : m_interpreter(interpreter), m_top(interpreter.m_stack_top) { }
+		~StackMark() {
+			if (m_top) {
+				m_interpreter.m_stack_top = m_top;
+			}
+		}
+		Value* top() const {
+			return m_top;
+		}
+		// Leaves the pushed values to whoever consumes them next
+		void keep() {
+			m_top = nullptr;
+		}
+	private:
+		Interpreter& m_interpreter;
+		Value* m_top;
+	};
+	// Executes the body of a loop once per iteration.
+	// A Block body is unpacked once for the whole loop instead of being
+	// visited every iteration. Its locals live in
+	// fixed frame slots, so iterations simply reuse them. Only when a closure
+	// captured one of them are the upvalues closed after each iteration, which
+	// gives every iteration its own captured variables.
+	class LoopBody {
+	public:
+		LoopBody(Interpreter& interpreter, StmtPtr body)
+			: m_interpreter(interpreter), m_body(body), m_block(body->node_kind() == StmtKind::BLOCK ? static_cast<Block*>(body) : nullptr) { }
+		Completion execute() {
+			if (!m_block) {
+				return m_interpreter.execute(m_body);
+			}
+			auto completion = m_interpreter.execute_block(m_block->statements());
+			if (m_block->close_from() >= 0) {
+				m_interpreter.close_upvalues(m_interpreter.m_frame + m_block->close_from());
+			}
+			return completion;
+		}
+	private:
+		Interpreter& m_interpreter;
+		StmtPtr m_body;
+		Block* m_block;
+	};
+	// Stops at the first statement that doesn't complete normally and hands its completion to the caller
+	Completion execute_block(const std::vector<StmtPtr>& statements) {
+		try {
+			for (auto statement : statements) {
+				auto completion = execute(statement);
+				if (!completion.is_normal()) {
+					return completion;
+				}
+			}
+		}
+		catch (const StackOverflowError&) {
+			throw;
+		}
+		catch (const RuntimeError& err) {
+			m_toy.runtime_error(err);
+		}
+		return {};
+	}
+private:
+
+	Completion visit_stmt(If* stmt) override {
+		if (is_truthy(evaluate(stmt->condition()))) {
+			return execute(stmt->then_branch());
+		}
+		else if (stmt->else_branch()) {
+			return execute(stmt->else_branch());
+		}
+		return {};
+	}
+
+	Completion visit_stmt(Block* stmt) override {
+		auto completion = execute_block(stmt->statements());
+		// Captured locals outlive the block, the rest of its slots are simply reused
+		if (stmt->close_from() >= 0) {
+			close_upvalues(m_frame + stmt->close_from());
+		}
+		return completion;
+	}
+
+	Completion visit_stmt(Break*) override {
+		return Completion::Type::BREAK;
+	}
+
+	Completion visit_stmt(Continue*) override {
+		return Completion::Type::CONTINUE;
+	}
+
+	Value visit_expr(Literal* expr) override {
+		return expr->value();
+	}
+	Value visit_expr(Logical* expr) override {
+		auto left = evaluate(expr->left());
+		// Short circuit OR if lhs is true
+		if (expr->op().type() == TokenType::OR) {
+			if (is_truthy(left)) return left;
+		}
+		// Short circuit AND if lhs false
+		else if (!is_truthy(left)) {
+			return left;
+		}
+		return evaluate(expr->right());
+	}
+	Value visit_expr(Grouping* expr) override {
+		return evaluate(expr->expression());
+	}
+	Value visit_expr(Unary* expr) override {
+		if (expr->number_operand()) {
+			return Value(-evaluate_number(expr->right()));
+		}
+		auto right = evaluate(expr->right());
+		switch(expr->op().type()) {
+			case TokenType::BANG:
+				return Value(!is_truthy(right));
+			case TokenType::MINUS:
+				check_number_operand(expr->op(), right);
+				return Value(-right.as_double());
+		}
+		return nullptr;
+	}
+	Value visit_expr(Binary* expr) override {
+		if (expr->number_operands()) {
+			return number_binary(expr);
+		}
+		const auto left = evaluate(expr->left());
+		// The rhs may call functions that allocate, so keep the lhs alive until we're done with it
+		TemporaryRoots roots(m_temporaries);
+		if (left.is_object()) m_temporaries.push_back(left);
+		const auto right = evaluate(expr->right());
+
+		// Quickened variants only check the operand types they were specialized for
+		switch (expr->specialization()) {
+			case BinarySpecialization::NUMBER_ADD:
+				if (left.is_number() && right.is_number()) return Value(left.as_double() + right.as_double());
+				break;
+			case BinarySpecialization::NUMBER_SUBTRACT:
+				if (left.is_number() && right.is_number()) return Value(left.as_double() - right.as_double());
+				break;
+			case BinarySpecialization::NUMBER_MULTIPLY:
+				if (left.is_number() && right.is_number()) return Value(left.as_double() * right.as_double());
+				break;
+			case BinarySpecialization::NUMBER_DIVIDE:
+				// Division by zero is left to the generic path to report
+				if (left.is_number() && right.is_number() && right.as_double() != 0.0) {
+					return Value(left.as_double() / right.as_double());
+				}
+				break;
+			case BinarySpecialization::NUMBER_GREATER:
+				if (left.is_number() && right.is_number()) return Value(left.as_double() > right.as_double());
+				break;
+			case BinarySpecialization::NUMBER_GREATER_EQUAL:
+				if (left.is_number() && right.is_number()) return Value(left.as_double() >= right.as_double());
+				break;
+			case BinarySpecialization::NUMBER_LESS:
+				if (left.is_number() && right.is_number()) return Value(left.as_double() < right.as_double());
+				break;
+			case BinarySpecialization::NUMBER_LESS_EQUAL:
+				if (left.is_number() && right.is_number()) return Value(left.as_double() <= right.as_double());
+				break;
+			case BinarySpecialization::STRING_CONCAT:
+				if (left.is_string() && right.is_string()) return m_heap.make_string(left.as_string() + right.as_string());
+				break;
+			case BinarySpecialization::UNINITIALIZED:
+				expr->set_specialization(specialize(expr->op(), left, right));
+				return binary(expr, left, right);
+			case BinarySpecialization::GENERIC:
+				return binary(expr, left, right);
+		}
+		// The guard failed, the types aren't stable after all
+		expr->set_specialization(BinarySpecialization::GENERIC);
+		return binary(expr, left, right);
+	}
+
+	// Picks the variant for the operand types of a node's first evaluation
+	static BinarySpecialization specialize(const Token& op, const Value& left, const Value& right) {
+		if (left.is_number() && right.is_number()) {
+			switch (op.type()) {
+				case TokenType::PLUS: return BinarySpecialization::NUMBER_ADD;
+				case TokenType::MINUS: return BinarySpecialization::NUMBER_SUBTRACT;
+				case TokenType::STAR: return BinarySpecialization::NUMBER_MULTIPLY;
+				case TokenType::SLASH: return BinarySpecialization::NUMBER_DIVIDE;
+				case TokenType::GREATER: return BinarySpecialization::NUMBER_GREATER;
+				case TokenType::GREATER_EQUAL: return BinarySpecialization::NUMBER_GREATER_EQUAL;
+				case TokenType::LESS: return BinarySpecialization::NUMBER_LESS;
+				case TokenType::LESS_EQUAL: return BinarySpecialization::NUMBER_LESS_EQUAL;
+				default: break;
+			}
+		}
+		if (op.type() == TokenType::PLUS && left.is_string() && right.is_string()) {
+			return BinarySpecialization::STRING_CONCAT;
+		}
+		return BinarySpecialization::GENERIC;
+	}
+
+	// Operands TypeInference proved to be numbers are computed as doubles,
+	// nested proven nodes never box their intermediate results
+	double evaluate_number(ExprPtr expr) {
+		switch (expr->node_kind()) {
+			case ExprKind::LITERAL:
+				return proven_number(static_cast<Literal*>(expr)->value());
+			case ExprKind::VARIABLE:
+				if (static_cast<Variable*>(expr)->kind() == VariableKind::LOCAL) {
+					return proven_number(m_frame[static_cast<Variable*>(expr)->slot()]);
+				}
+				break;
+			case ExprKind::GROUPING:
+				return evaluate_number(static_cast<Grouping*>(expr)->expression());
+			case ExprKind::UNARY:
+				if (static_cast<Unary*>(expr)->number_operand()) {
+					return -evaluate_number(static_cast<Unary*>(expr)->right());
+				}
+				break;
+			case ExprKind::BINARY: {
+				auto* binary = static_cast<Binary*>(expr);
+				if (binary->number_operands() && is_arithmetic(binary->op().type())) {
+					const double left = evaluate_number(binary->left());
+					return arithmetic(binary->op(), left, evaluate_number(binary->right()));
+				}
+				break;
+			}
+			default:
+				break;
+		}
+		return proven_number(evaluate(expr));
+	}
+	// Nothing checks the proof in release builds, a wrong one would read another type's bits
+	static double proven_number(const Value& value) {
+		assert(value.is_number() && "TypeInference proved a non-number to be a number");
+		return value.as_double();
+	}
+	Value number_binary(Binary* expr) {
+		const double left = evaluate_number(expr->left());
+		const double right = evaluate_number(expr->right());
+		switch (expr->op().type()) {
+			case TokenType::GREATER: return Value(left > right);
+			case TokenType::GREATER_EQUAL: return Value(left >= right);
+			case TokenType::LESS: return Value(left < right);
+			case TokenType::LESS_EQUAL: return Value(left <= right);
+			// Equality of numbers has a tolerance, Value implements it
+			case TokenType::BANG_EQUAL: return Value(Value(left) != Value(right));
+			case TokenType::EQUAL_EQUAL: return Value(Value(left) == Value(right));
+			default: return Value(arithmetic(expr->op(), left, right));
+		}
+	}
+	static bool is_arithmetic(TokenType op) {
+		return op == TokenType::PLUS || op == TokenType::MINUS || op == TokenType::STAR || op == TokenType::SLASH;
+	}
+	static double arithmetic(const Token& op, double left, double right) {
+		switch (op.type()) {
+			case TokenType::PLUS: return left + right;
+			case TokenType::MINUS: return left - right;
+			case TokenType::STAR: return left * right;
+			default:
+				if (right == 0.0) {
+					throw RuntimeError(op, "Division by zero.");
+				}
+				return left / right;
+		}
+	}
+
+	// Unspecialized evaluation, checks everything
+	Value binary(Binary* expr, const Value& left, const Value& right) {
+		switch (expr->op().type()) {
+			// Comparison
+			case TokenType::GREATER:
+				check_number_operands(expr->op(), left, right);
+				return Value(left.as_double() > right.as_double());
+			case TokenType::GREATER_EQUAL:
+				check_number_operands(expr->op(), left, right);
+				return Value(left.as_double() >= right.as_double());
+			case TokenType::LESS:
+				check_number_operands(expr->op(), left, right);
+				return Value(left.as_double() < right.as_double());
+			case TokenType::LESS_EQUAL:
+				check_number_operands(expr->op(), left, right);
+				return Value(left.as_double() <= right.as_double());
+
+			case TokenType::BANG_EQUAL: 
+				return Value(left != right);
+			case TokenType::EQUAL_EQUAL: 
+				return Value(left == right);
+
+			// Arithmetic
+			case TokenType::MINUS:
+				check_number_operands(expr->op(), left, right);
+				return Value(left.as_double() - right.as_double());
+			case TokenType::PLUS:
+				if (left.is_number() && right.is_number()) {
+					return Value(left.as_double() + right.as_double());
+				}
+				//if (left.is_string() && right.is_string()) {
+				//	return left.as_string() + right.as_string();
+				//}
+				// Allow either to be strings
+				if (left.is_string() || right.is_string()) {
+					return m_heap.make_string(left.as_string() + right.as_string());
+				}
+				//throw RuntimeError(expr->op(), "Operands must be two numbers or two strings.");
+				throw RuntimeError(expr->op(), "Invalid operands.");
+			case TokenType::SLASH:
+				check_number_operands(expr->op(), left, right);
+				if (right.as_double() == 0.0) {
+					throw RuntimeError(expr->op(), "Division by zero.");
+				}
+				return Value(left.as_double() / right.as_double());
+			case TokenType::STAR:
+				check_number_operands(expr->op(), left, right);
+				return Value(left.as_double() * right.as_double());
+		}
+		return nullptr;
+	}
+	Value visit_expr(Call* expr) override {
+		if (is_inlined(expr)) {
+			return evaluate_inlined(expr);
+		}
+		StackMark mark(*this);
+		auto* function = evaluate_call(expr);
+		return function->call(this, { mark.top() + 1, m_stack_top });
+	}
+
+	// The Inliner's expansion of a call only runs once the call site's cache
+	// holds the function it was expanded from, evaluate_call checks that
+	bool is_inlined(Call* expr) const {
+		return expr->inlined_body() && expr->cached_version() == m_globals.version();
+	}
+	// An error ends the expanded body the way it would have ended the function's block
+	Value evaluate_inlined(Call* expr) {
+		try {
+			return evaluate(expr->inlined_body());
+		}
+		catch (const StackOverflowError&) {
+			throw;
+		}
+		catch (const RuntimeError& err) {
+			m_toy.runtime_error(err);
+		}
+		return Value(nullptr);
+	}
+
+	static bool is_declared_by(ToyCallable* callable, Function* declaration);
+
+	// Evaluates the callee and the arguments of a call and checks they fit.
+	// Both are pushed onto the stack, callee first, so the arguments end up
+	// where the callee's frame starts. The caller pops them
+	ToyCallable* evaluate_call(Call* expr) {
+		const auto argument_count = expr->arguments().size();
+		if (m_stack.data() + m_stack.size() - m_stack_top <= static_cast<ptrdiff_t>(argument_count)) {
+			throw StackOverflowError(expr->paren());
+		}
+
+		// Inline cache: a global callee that hasn't been overwritten since it
+		// was cached was already checked to be callable with this many arguments
+		auto* cached = expr->cached_version() == m_globals.version() ? expr->cached_callee() : nullptr;
+		// Still rooted by its slot, the arguments could overwrite the global
+		Value* callee = m_stack_top;
+		push(cached ? Value(cached) : evaluate(expr->callee()));
+		for (const auto& argument : expr->arguments()) {
+			push(evaluate(argument));
+		}
+		if (cached) {
+			return cached;
+		}
+
+		if (!callee->is_callable()) {
+			throw RuntimeError(expr->paren(), "Can only call functions and classes.");
+		}
+		auto* function = callee->as_callable();
+		if (argument_count != function->arity()) {
+			throw RuntimeError(expr->paren(),
+				"Expected " + std::to_string(function->arity()) + " arguments but got "
+				+ std::to_string(argument_count) + ".");
+		}
+		if (expr->global_callee()) {
+			// The global was rebound to something else, the call stays a call
+			if (expr->inlined_function() && !is_declared_by(function, expr->inlined_function())) {
+				expr->set_inlined_body(nullptr);
+			}
+			expr->set_cached_callee(function);
+			expr->set_cached_version(m_globals.version());
+		}
+		return function;
+	}
+
+	Completion visit_stmt(Expression* stmt) override {
+		evaluate(stmt->expression());
+		return {};
+	}
+
+	Completion visit_stmt(Function* stmt);
+
+	Completion visit_stmt(For* stmt) override {
+		// The initializer is declared in the enclosing scope, its variable is
+		// shared by every iteration
+		if (stmt->initializer()) {
+			execute(stmt->initializer());
+		}
+		Completion result{};
+		LoopBody body(*this, stmt->body());
+		while (!stmt->condition() || is_truthy(evaluate(stmt->condition()))) {
+			auto completion = body.execute();
+			if (completion.type() == Completion::Type::BREAK) {
+				break;
+			}
+			if (completion.is_return()) {
+				result = completion;
+				break;
+			}
+
+			if (stmt->increment()) {
+				evaluate(stmt->increment());
+			}
+		}
+		return result;
+	}
+
+	Completion visit_stmt(Print* stmt) override {
+		auto value = evaluate(stmt->expression());
+		std::cout << value.to_string() << "\n";
+		return {};
+	}
+
+
+	Completion visit_stmt(Return* stmt) override;
+
+	Completion evaluate_return(Return* stmt) {
+		Value value = nullptr;
+		if (stmt->value()) {
+			value = evaluate(stmt->value());
+		}
+		else {
+			value = Value(nullptr);
+		}
+		return Completion::return_value(std::move(value));
+	}
+
+	Completion visit_stmt(Sleep* stmt) override {
+		auto value = evaluate(stmt->expression());
+		if (!value.is_number()) {
+			throw RuntimeError(stmt->token(), "sleep only accepts numbers");
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds((int)value.as_double()));
+		return {};
+	}
+
+	Completion visit_stmt(Var* stmt) override {
+		// Don't require initializer, set to nil
+		Value value = nullptr;
+		if (stmt->initializer()) {
+			value = evaluate(stmt->initializer());
+		} else {
+			value = Value(nullptr);
+		}
+		define(stmt->kind(), stmt->slot(), std::move(value));
+		return {};
+	}
+
+	Completion visit_stmt(While* stmt) override {
+		LoopBody body(*this, stmt->body());
+		while (is_truthy(evaluate(stmt->condition()))) {
+			auto completion = body.execute();
+			if (completion.type() == Completion::Type::BREAK) {
+				break;
+			}
+			if (completion.is_return()) {
+				return completion;
+			}
+		}
+		return {};
+	}
+
+	Value visit_expr(Variable* expr) override;
+
+	Value visit_expr(Assign* expr) override;
+
+	// Declarations are either globals or locals of the current frame
+	void define(VariableKind kind, int slot, Value value) {
+		if (kind == VariableKind::GLOBAL) {
+			m_globals.define(slot, std::move(value));
+		} else {
+			m_frame[slot] = std::move(value);
+		}
+	}
+
+	// Returns the open upvalue for a frame slot, creating it if this is the first capture.
+	// Open upvalues are kept sorted by slot, highest first
+	Upvalue* capture_upvalue(Value* local) {
+		Upvalue* previous = nullptr;
+		Upvalue* upvalue = m_open_upvalues;
+		while (upvalue && upvalue->location() > local) {
+			previous = upvalue;
+			upvalue = upvalue->next;
+		}
+		if (upvalue && upvalue->location() == local) {
+			return upvalue;
+		}
+
+		auto* created = m_heap.make<Upvalue>(local);
+		created->next = upvalue;
+		if (previous) {
+			previous->next = created;
+		} else {
+			m_open_upvalues = created;
+		}
+		return created;
+	}
+	// Moves the values of every upvalue at or above last off the stack
+	void close_upvalues(const Value* last) {
+		while (m_open_upvalues && m_open_upvalues->location() >= last) {
+			auto* upvalue = m_open_upvalues;
+			upvalue->close();
+			m_open_upvalues = upvalue->next;
+		}
+	}
+
+	Value evaluate(ExprPtr expr) {
+#ifdef TOY_SWITCH_DISPATCH
+		switch (expr->node_kind()) {
+			[[likely]] case ExprKind::VARIABLE: return visit_expr(static_cast<Variable*>(expr));
+			[[likely]] case ExprKind::LITERAL: return visit_expr(static_cast<Literal*>(expr));
+			[[likely]] case ExprKind::BINARY: return visit_expr(static_cast<Binary*>(expr));
+			[[likely]] case ExprKind::CALL: return visit_expr(static_cast<Call*>(expr));
+			case ExprKind::ASSIGN: return visit_expr(static_cast<Assign*>(expr));
+			case ExprKind::LOGICAL: return visit_expr(static_cast<Logical*>(expr));
+			case ExprKind::UNARY: return visit_expr(static_cast<Unary*>(expr));
+			case ExprKind::GROUPING: return visit_expr(static_cast<Grouping*>(expr));
+		}
+		assert(false && "Unknown expression kind");
+		return nullptr;
+#else
+		return expr->accept(this);
+#endif
+	}
+	// Slots above the current frame are rooted like the frame itself
+	void push(Value value) {
+		*m_stack_top++ = value;
+	}
+	bool is_truthy(const Value& value) {
+		if (value.is_bool()) return value.as_bool();
+
+		if (value.is_nil()) return false;
+
+		return true;
+
+	}
+
+	void check_number_operand(Token op, const Value& operand) const {
+		if (operand.is_number()) return;
+		throw RuntimeError(op, "Operand must be a number.");
+	}
+	void check_number_operands(Token op, const Value& left, const Value& right) const {
+		if (left.is_number() && right.is_number()) return;
+		throw RuntimeError(op, "Operands must be numbers.");
+	}
+
+private:
+	// Frames are never moved, upvalues point into them
+	static constexpr size_t STACK_MAX = 64 * 1024;
+	// Native stack kept free below the limit for the frames between two
+	// checks, natives and reporting the error, at most a quarter of the stack
+	static constexpr size_t NATIVE_STACK_RESERVE = 256 * 1024;
+
+	// Lowest address calls may reach, derived from the bounds of the thread's stack
+	static uintptr_t native_stack_limit();
+
+	Toy& m_toy;
+	Heap& m_heap;
+	GlobalEnvironment m_globals{};
+	// Locals of every active call, one contiguous frame per call
+	std::vector<Value> m_stack;
+	// First slot of the current frame and the first slot past it
+	Value* m_frame{nullptr};
+	Value* m_stack_top{nullptr};
+	// Function being executed, nullptr while executing top level code
+	ToyFunction* m_function{nullptr};
+	// Upvalues still pointing into the stack
+	Upvalue* m_open_upvalues{nullptr};
+	// Callee of a TAIL_CALL completion on its way back to call_function,
+	// its arguments are left on top of the stack
+	ToyFunction* m_tail_function{nullptr};
+	std::span<Value> m_tail_arguments{};
+	std::vector<Value> m_temporaries{};
+	// Runs hot functions natively
+	Jit m_jit;
+	// Every call recurses through evaluate and execute, calls below this address overflow
+	uintptr_t m_native_stack_limit{0};
+};
+
+class ToyFunction final : public ToyCallable {
+public:
+	ToyFunction(Function* declaration) : m_declaration(declaration) {
+		m_upvalues.reserve(declaration->upvalues().size());
+	}
+	int arity() override { return m_declaration->params().size(); }
+	Value call(Interpreter* interpreter, std::span<Value> arguments) override {
+		return interpreter->call_function(this, arguments);
+	}
+	Function* declaration() const {
+		return m_declaration;
+	}
+	std::vector<Upvalue*>& upvalues() {
+		return m_upvalues;
+	}
+	JitProfile& jit_profile() {
+		return m_jit_profile;
+	}
+	std::string to_string() const override {
+		return "<fn " + std::string(m_declaration->name().lexeme()) + ">";
+	}
+	void trace(Heap& heap) override {
+		for (auto* upvalue : m_upvalues) {
+			heap.mark(upvalue);
+		}
+	}
+	size_t size() const override {
+		return sizeof(ToyFunction) + m_upvalues.capacity() * sizeof(Upvalue*);
+	}
+private:
+	Function* m_declaration{nullptr};
+	// Only the variables the body actually references from enclosing functions
+	std::vector<Upvalue*> m_upvalues{};
+	JitProfile m_jit_profile{};
+};
+
+// Defined once ToyFunction is complete, otherwise the pointer would convert to a bool Value
+inline Completion Interpreter::visit_stmt(Function* stmt) {
+	auto* function = m_heap.make<ToyFunction>(stmt);
+	// Define it first so it stays reachable while capturing allocates upvalues
+	define(stmt->kind(), stmt->slot(), Value(function));
+	for (const auto& upvalue : stmt->upvalues()) {
+		function->upvalues().push_back(upvalue.is_local
+			? capture_upvalue(m_frame + upvalue.index)
+			: m_function->upvalues()[upvalue.index]);
+	}
+	return {};
+}
+
+inline bool Interpreter::is_declared_by(ToyCallable* callable, Function* declaration) {
+	auto* function = dynamic_cast<ToyFunction*>(callable);
+	return function && function->declaration() == declaration;
+}
+
+inline Value Interpreter::visit_expr(Variable* expr) {
+	switch (expr->kind()) {
+		case VariableKind::LOCAL:
+			return m_frame[expr->slot()];
+		case VariableKind::UPVALUE:
+			return m_function->upvalues()[expr->slot()]->value();
+		default:
+			return m_globals.get(expr->slot(), expr->name());
+	}
+}
+
+inline Value Interpreter::visit_expr(Assign* expr) {
+	auto value = evaluate(expr->value());
+	switch (expr->kind()) {
+		case VariableKind::LOCAL:
+			m_frame[expr->slot()] = value;
+			break;
+		case VariableKind::UPVALUE:
+			m_function->upvalues()[expr->slot()]->value() = value;
+			break;
+		default:
+			m_globals.assign(expr->slot(), expr->name(), value);
+			break;
+	}
+	return value;
+}
+
+// A `return f(...)` in tail position completes with TAIL_CALL instead of
+// calling f itself, call_function then runs f in place of the returning call
+inline Completion Interpreter::visit_stmt(Return* stmt) {
+	if (!stmt->tail_call() || is_inlined(static_cast<Call*>(stmt->value()))) {
+		return evaluate_return(stmt);
+	}
+
+	StackMark mark(*this);
+	auto* call = static_cast<Call*>(stmt->value());
+	auto* callee = evaluate_call(call);
+	const std::span<Value> arguments{ mark.top() + 1, m_stack_top };
+	// Natives have no frame to replace
+	auto* function = dynamic_cast<ToyFunction*>(callee);
+	if (!function) {
+		return Completion::return_value(callee->call(this, arguments));
+	}
+	m_tail_function = function;
+	m_tail_arguments = arguments;
+	mark.keep();
+	return Completion::Type::TAIL_CALL;
+}
+
+inline void Interpreter::enter_frame(ToyFunction* function, size_t argument_count) {
+	auto* declaration = function->declaration();
+	const int frame_size = declaration->frame_size();
+	if (m_stack.data() + m_stack.size() - m_frame < frame_size) {
+		throw StackOverflowError(declaration->name());
+	}
+
+	m_stack_top = m_frame + frame_size;
+	m_function = function;
+	// Parameters occupy the first slots of the frame. The rest may hold
+	// values of an earlier call the collector must no longer see
+	std::fill(m_frame + argument_count, m_stack_top, Value(nullptr));
+}
+
+inline Value Interpreter::call_function(ToyFunction* function, std::span<Value> arguments) {
+	assert(arguments.data() + arguments.size() == m_stack_top);
+	if (m_jit.enabled()) {
+		Value result{};
+		if (m_jit.call(function->jit_profile(), function->declaration(), function, arguments, m_globals, m_native_stack_limit, result)) {
+			return result;
+		}
+	}
+
+	const char marker{};
+	if (reinterpret_cast<uintptr_t>(&marker) < m_native_stack_limit) {
+		throw StackOverflowError(function->declaration()->name());
+	}
+
+	FrameTracker tracker(*this);
+	// The arguments become the parameter slots in place
+	m_frame = arguments.data();
+	enter_frame(function, arguments.size());
+
+	// Trampoline for tail calls, each one replaces the frame of the call
+	// before it, so tail recursion runs in constant stack
+	while (true) {
+		auto completion = execute_block(m_function->declaration()->body());
+		if (completion.type() == Completion::Type::RETURN) {
+			return std::move(completion.value());
+		}
+		if (completion.type() != Completion::Type::TAIL_CALL) {
+			return Value(nullptr);
+		}
+		// Closures still see the replaced frame's variables through their upvalues
+		close_upvalues(m_frame);
+		auto* callee = m_tail_function;
+		m_tail_function = nullptr;
+		// The arguments move down from the top of the stack into the parameter slots
+		std::copy(m_tail_arguments.begin(), m_tail_arguments.end(), m_frame);
+		enter_frame(callee, m_tail_arguments.size());
+		m_tail_arguments = {};
+	}
+}
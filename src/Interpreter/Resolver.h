@@ -0,0 +1,293 @@
+#pragma once
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+#include "../Lexer/Expr.h"
+#include "../Lexer/Stmt.h"
+#include "../Lexer/Environment.h"
+
+/*
+ * Static pass run between parsing and interpreting.
+ *
+ * Gives every local a slot in the frame of the function declaring it (top
+ * level blocks live in the script's frame), reusing slots once their block
+ * ends, and annotates every Variable, Assign, Var and Function node with
+ * where its variable lives:
+ *	kind	global, a local of the current frame, or an upvalue of the current function
+ *	slot	index into the globals, the frame or the function's upvalues
+ *
+ * Locals referenced from an inner function are marked as captured. Only
+ * those get moved off the frame (closed) when their block exits, which is
+ * recorded on the Block node as the first slot to close.
+ */
+class Resolver final : public ExprVisitor, public StmtVisitor {
+public:
+	Resolver(GlobalEnvironment& globals) : m_globals(globals) { }
+
+	void resolve(const std::vector<StmtPtr>& statements) {
+		for (const auto& statement : statements) {
+			resolve(statement);
+		}
+	}
+
+	// Number of slots the script's own frame needs for locals of top level blocks
+	int frame_size() const {
+		return m_script.frame_size;
+	}
+
+private:
+	struct Local {
+		// Names point into the source, which outlives the resolver
+		std::string_view name{};
+		int depth{0};
+		bool captured{false};
+	};
+	struct FunctionScope {
+		FunctionScope* enclosing{nullptr};
+		// Indexed by slot
+		std::vector<Local> locals{};
+		std::vector<UpvalueRef> upvalues{};
+		int scope_depth{0};
+		int frame_size{0};
+	};
+
+	void resolve(const StmtPtr& stmt) {
+		stmt->accept(this);
+	}
+	void resolve(const ExprPtr& expr) {
+		expr->accept(this);
+	}
+
+	void begin_scope() {
+		m_function->scope_depth++;
+	}
+	// Returns the lowest slot of the scope a closure captured, -1 if none was
+	int end_scope() {
+		auto& function = *m_function;
+		int close_from = -1;
+		while (!function.locals.empty() && function.locals.back().depth == function.scope_depth) {
+			if (function.locals.back().captured) {
+				close_from = static_cast<int>(function.locals.size()) - 1;
+			}
+			function.locals.pop_back();
+		}
+		function.scope_depth--;
+		return close_from;
+	}
+
+	int add_local(const Token& name) {
+		auto& function = *m_function;
+		function.locals.push_back({ name.lexeme(), function.scope_depth });
+		function.frame_size = std::max(function.frame_size, static_cast<int>(function.locals.size()));
+		return static_cast<int>(function.locals.size()) - 1;
+	}
+
+	// Redeclaring a name in the same scope reuses its slot
+	int declare_local(const Token& name) {
+		const auto& locals = m_function->locals;
+		for (int i = static_cast<int>(locals.size()) - 1; i >= 0 && locals[i].depth == m_function->scope_depth; i--) {
+			if (locals[i].name == name.lexeme()) {
+				return i;
+			}
+		}
+		return add_local(name);
+	}
+
+	template <typename T>
+	void declare(T* node, const Token& name) {
+		// Outside of any block or function declarations are globals
+		if (m_function->scope_depth == 0) {
+			node->set_kind(VariableKind::GLOBAL);
+			node->set_slot(m_globals.slot(name.lexeme()));
+			return;
+		}
+		node->set_kind(VariableKind::LOCAL);
+		node->set_slot(declare_local(name));
+	}
+
+	static int resolve_local(const FunctionScope& function, const Token& name) {
+		for (int i = static_cast<int>(function.locals.size()) - 1; i >= 0; i--) {
+			if (function.locals[i].name == name.lexeme()) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	static int add_upvalue(FunctionScope& function, int index, bool is_local) {
+		for (int i = 0; i < static_cast<int>(function.upvalues.size()); i++) {
+			const auto& upvalue = function.upvalues[i];
+			if (upvalue.index == index && upvalue.is_local == is_local) {
+				return i;
+			}
+		}
+		function.upvalues.push_back({ index, is_local });
+		return static_cast<int>(function.upvalues.size()) - 1;
+	}
+
+	// Looks for the name in the enclosing functions, threading it through the
+	// upvalues of every function in between
+	static int resolve_upvalue(FunctionScope& function, const Token& name) {
+		if (!function.enclosing) return -1;
+
+		if (const int local = resolve_local(*function.enclosing, name); local >= 0) {
+			function.enclosing->locals[local].captured = true;
+			return add_upvalue(function, local, true);
+		}
+		if (const int upvalue = resolve_upvalue(*function.enclosing, name); upvalue >= 0) {
+			return add_upvalue(function, upvalue, false);
+		}
+		return -1;
+	}
+
+	template <typename T>
+	void resolve_variable(T* node, const Token& name) {
+		if (const int slot = resolve_local(*m_function, name); slot >= 0) {
+			node->set_kind(VariableKind::LOCAL);
+			node->set_slot(slot);
+		}
+		else if (const int upvalue = resolve_upvalue(*m_function, name); upvalue >= 0) {
+			node->set_kind(VariableKind::UPVALUE);
+			node->set_slot(upvalue);
+		}
+		else {
+			// Not found in any local scope, assume it's global
+			node->set_kind(VariableKind::GLOBAL);
+			node->set_slot(m_globals.slot(name.lexeme()));
+		}
+	}
+
+	void resolve_function(Function* function) {
+		FunctionScope scope{};
+		scope.enclosing = m_function;
+		m_function = &scope;
+
+		// Parameters occupy the first slots of the frame, in order
+		begin_scope();
+		for (const auto& param : function->params()) {
+			add_local(param);
+		}
+		resolve(function->body());
+		// Captured parameters are closed when the call returns
+		end_scope();
+
+		m_function = scope.enclosing;
+		function->set_upvalues(std::move(scope.upvalues));
+		function->set_frame_size(scope.frame_size);
+	}
+
+	Completion visit_stmt(Block* stmt) override {
+		begin_scope();
+		resolve(stmt->statements());
+		stmt->set_close_from(end_scope());
+		return {};
+	}
+	Completion visit_stmt(Break*) override {
+		return {};
+	}
+	Completion visit_stmt(Continue*) override {
+		return {};
+	}
+	Completion visit_stmt(Expression* stmt) override {
+		resolve(stmt->expression());
+		return {};
+	}
+	Completion visit_stmt(Function* stmt) override {
+		// Declare before resolving the body so the function can call itself
+		declare(stmt, stmt->name());
+		resolve_function(stmt);
+		return {};
+	}
+	Completion visit_stmt(For* stmt) override {
+		// The initializer is declared in the enclosing scope
+		if (stmt->initializer()) resolve(stmt->initializer());
+		if (stmt->condition()) resolve(stmt->condition());
+		if (stmt->increment()) resolve(stmt->increment());
+		resolve(stmt->body());
+		return {};
+	}
+	Completion visit_stmt(If* stmt) override {
+		resolve(stmt->condition());
+		resolve(stmt->then_branch());
+		if (stmt->else_branch()) resolve(stmt->else_branch());
+		return {};
+	}
+	Completion visit_stmt(Print* stmt) override {
+		resolve(stmt->expression());
+		return {};
+	}
+	Completion visit_stmt(Return* stmt) override {
+		if (stmt->value()) resolve(stmt->value());
+		// Nothing is left to do in the function after a returned call, so
+		// the interpreter can run it in place of the current call
+		if (m_function != &m_script && dynamic_cast<Call*>(stmt->value())) {
+			stmt->set_tail_call(true);
+		}
+		return {};
+	}
+	Completion visit_stmt(Sleep* stmt) override {
+		resolve(stmt->expression());
+		return {};
+	}
+	Completion visit_stmt(Var* stmt) override {
+		// The initializer can't see the variable it initializes,
+		// `var a = a + 1;` reads the enclosing 'a'
+		if (stmt->initializer()) resolve(stmt->initializer());
+		declare(stmt, stmt->name());
+		return {};
+	}
+	Completion visit_stmt(While* stmt) override {
+		resolve(stmt->condition());
+		resolve(stmt->body());
+		return {};
+	}
+
+	Value visit_expr(Assign* expr) override {
+		resolve(expr->value());
+		resolve_variable(expr, expr->name());
+		return nullptr;
+	}
+	Value visit_expr(Binary* expr) override {
+		resolve(expr->left());
+		resolve(expr->right());
+		return nullptr;
+	}
+	Value visit_expr(Call* expr) override {
+		resolve(expr->callee());
+		// Calls to a global can cache the callee at runtime
+		if (auto* variable = dynamic_cast<Variable*>(expr->callee())) {
+			expr->set_global_callee(variable->kind() == VariableKind::GLOBAL);
+		}
+		for (const auto& argument : expr->arguments()) {
+			resolve(argument);
+		}
+		return nullptr;
+	}
+	Value visit_expr(Grouping* expr) override {
+		resolve(expr->expression());
+		return nullptr;
+	}
+	Value visit_expr(Literal*) override {
+		return nullptr;
+	}
+	Value visit_expr(Logical* expr) override {
+		resolve(expr->left());
+		resolve(expr->right());
+		return nullptr;
+	}
+	Value visit_expr(Unary* expr) override {
+		resolve(expr->right());
+		return nullptr;
+	}
+	Value visit_expr(Variable* expr) override {
+		resolve_variable(expr, expr->name());
+		return nullptr;
+	}
+
+private:
+	GlobalEnvironment& m_globals;
+	FunctionScope m_script{};
+	// Function whose body is being resolved, m_script for top level code
+	FunctionScope* m_function{&m_script};
+};
@@ -0,0 +1,416 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "../Lexer/Expr.h"
+#include "../Lexer/Stmt.h"
+
+/*
+ * Static pass run after the Resolver, proving which locals only ever hold
+ * numbers so the interpreter can compute with them without checking types.
+ *
+ * Every frame slot gets the set of types stored into it anywhere in its
+ * function. Slots start out empty and grow as stores are found, the whole
+ * script is walked until nothing changes any more. Captured locals can be
+ * changed by closures behind the function's back and are never proven.
+ *
+ * Parameters are typed from the arguments of the calls reaching them. That
+ * is only known for global functions declared once whose global is never
+ * assigned and never read other than to call it, every other function
+ * takes any type.
+ *
+ * Call results are never proven: a call ends up returning nil when the
+ * callee reports a runtime error. Binary and Unary nodes whose operands
+ * are both proven numbers are marked, the interpreter evaluates them
+ * straight to doubles and checks nothing but division by zero.
+ */
+class TypeInference {
+public:
+	// frame_size is the number of slots the resolver gave the locals of top level blocks
+	void infer(const std::vector<StmtPtr>& statements, int frame_size) {
+		find_direct_calls(statements);
+
+		m_script.slots.assign(frame_size, Type::NONE);
+		find_captured(m_script, statements);
+		do {
+			m_changed = false;
+			m_current = &m_script;
+			infer_all(statements);
+		} while (m_changed);
+
+		m_annotate = true;
+		m_current = &m_script;
+		infer_all(statements);
+	}
+
+private:
+	// Sets of the types a value can have, as bits
+	enum Type : uint8_t {
+		NONE = 0,
+		NUMBER = 1 << 0,
+		BOOL = 1 << 1,
+		STRING = 1 << 2,
+		NIL = 1 << 3,
+		CALLABLE = 1 << 4,
+		ANY = NUMBER | BOOL | STRING | NIL | CALLABLE,
+	};
+
+	struct FunctionTypes {
+		// What each frame slot can hold, parameters first
+		std::vector<uint8_t> slots{};
+		std::vector<bool> captured{};
+	};
+
+	// Global functions every reference to is a call of. -1 in m_direct_calls
+	// marks a global that disqualified itself
+	void find_direct_calls(const std::vector<StmtPtr>& statements) {
+		for (const auto& statement : statements) {
+			find_direct_calls(statement);
+		}
+		for (const auto& [slot, function] : m_direct_functions) {
+			if (m_global_uses[slot] != 1 || !function) {
+				m_direct_functions[slot] = nullptr;
+			}
+		}
+	}
+	void find_direct_calls(StmtPtr stmt) {
+		if (!stmt) return;
+		switch (stmt->node_kind()) {
+			case StmtKind::BLOCK:
+				for (const auto& statement : static_cast<Block*>(stmt)->statements()) find_direct_calls(statement);
+				break;
+			case StmtKind::EXPRESSION:
+				find_direct_calls(static_cast<Expression*>(stmt)->expression());
+				break;
+			case StmtKind::PRINT:
+				find_direct_calls(static_cast<Print*>(stmt)->expression());
+				break;
+			case StmtKind::SLEEP:
+				find_direct_calls(static_cast<Sleep*>(stmt)->expression());
+				break;
+			case StmtKind::RETURN:
+				find_direct_calls(static_cast<Return*>(stmt)->value());
+				break;
+			case StmtKind::VAR: {
+				auto* var = static_cast<Var*>(stmt);
+				find_direct_calls(var->initializer());
+				if (var->kind() == VariableKind::GLOBAL) global_store(var->slot(), nullptr);
+				break;
+			}
+			case StmtKind::FUNCTION: {
+				auto* function = static_cast<Function*>(stmt);
+				if (function->kind() == VariableKind::GLOBAL) global_store(function->slot(), function);
+				for (const auto& statement : function->body()) find_direct_calls(statement);
+				break;
+			}
+			case StmtKind::IF: {
+				auto* if_stmt = static_cast<If*>(stmt);
+				find_direct_calls(if_stmt->condition());
+				find_direct_calls(if_stmt->then_branch());
+				find_direct_calls(if_stmt->else_branch());
+				break;
+			}
+			case StmtKind::WHILE: {
+				auto* while_stmt = static_cast<While*>(stmt);
+				find_direct_calls(while_stmt->condition());
+				find_direct_calls(while_stmt->body());
+				break;
+			}
+			case StmtKind::FOR: {
+				auto* for_stmt = static_cast<For*>(stmt);
+				find_direct_calls(for_stmt->initializer());
+				find_direct_calls(for_stmt->condition());
+				find_direct_calls(for_stmt->increment());
+				find_direct_calls(for_stmt->body());
+				break;
+			}
+			case StmtKind::BREAK:
+			case StmtKind::CONTINUE:
+				break;
+		}
+	}
+	void find_direct_calls(ExprPtr expr) {
+		if (!expr) return;
+		switch (expr->node_kind()) {
+			case ExprKind::VARIABLE: {
+				// Read other than as a callee, the function could be called with anything
+				auto* variable = static_cast<Variable*>(expr);
+				if (variable->kind() == VariableKind::GLOBAL) global_store(variable->slot(), nullptr);
+				break;
+			}
+			case ExprKind::ASSIGN: {
+				auto* assign = static_cast<Assign*>(expr);
+				find_direct_calls(assign->value());
+				if (assign->kind() == VariableKind::GLOBAL) global_store(assign->slot(), nullptr);
+				break;
+			}
+			case ExprKind::CALL: {
+				auto* call = static_cast<Call*>(expr);
+				if (call->callee()->node_kind() != ExprKind::VARIABLE
+					|| static_cast<Variable*>(call->callee())->kind() != VariableKind::GLOBAL) {
+					find_direct_calls(call->callee());
+				}
+				for (const auto& argument : call->arguments()) find_direct_calls(argument);
+				break;
+			}
+			case ExprKind::BINARY:
+				find_direct_calls(static_cast<Binary*>(expr)->left());
+				find_direct_calls(static_cast<Binary*>(expr)->right());
+				break;
+			case ExprKind::LOGICAL:
+				find_direct_calls(static_cast<Logical*>(expr)->left());
+				find_direct_calls(static_cast<Logical*>(expr)->right());
+				break;
+			case ExprKind::UNARY:
+				find_direct_calls(static_cast<Unary*>(expr)->right());
+				break;
+			case ExprKind::GROUPING:
+				find_direct_calls(static_cast<Grouping*>(expr)->expression());
+				break;
+			case ExprKind::LITERAL:
+				break;
+		}
+	}
+	// Counts the stores into a global and remembers the function it was declared as,
+	// nullptr for anything that rules out knowing every call of it
+	void global_store(int slot, Function* function) {
+		m_global_uses[slot]++;
+		if (function && m_global_uses[slot] == 1) {
+			m_direct_functions[slot] = function;
+		} else {
+			m_direct_functions[slot] = nullptr;
+			m_global_uses[slot] = 2;
+		}
+	}
+	Function* direct_callee(Call* call) const {
+		if (call->callee()->node_kind() != ExprKind::VARIABLE) return nullptr;
+		auto* variable = static_cast<Variable*>(call->callee());
+		if (variable->kind() != VariableKind::GLOBAL) return nullptr;
+		const auto it = m_direct_functions.find(variable->slot());
+		return it == m_direct_functions.end() ? nullptr : it->second;
+	}
+
+	// Marks the slots the functions declared in statements capture
+	static void find_captured(FunctionTypes& types, const std::vector<StmtPtr>& statements) {
+		types.captured.assign(types.slots.size(), false);
+		for (const auto& statement : statements) {
+			find_captured(types, statement);
+		}
+	}
+	static void find_captured(FunctionTypes& types, StmtPtr stmt) {
+		if (!stmt) return;
+		switch (stmt->node_kind()) {
+			case StmtKind::BLOCK:
+				for (const auto& statement : static_cast<Block*>(stmt)->statements()) find_captured(types, statement);
+				break;
+			case StmtKind::IF:
+				find_captured(types, static_cast<If*>(stmt)->then_branch());
+				find_captured(types, static_cast<If*>(stmt)->else_branch());
+				break;
+			case StmtKind::WHILE:
+				find_captured(types, static_cast<While*>(stmt)->body());
+				break;
+			case StmtKind::FOR:
+				find_captured(types, static_cast<For*>(stmt)->initializer());
+				find_captured(types, static_cast<For*>(stmt)->body());
+				break;
+			case StmtKind::FUNCTION:
+				for (const auto& upvalue : static_cast<Function*>(stmt)->upvalues()) {
+					if (upvalue.is_local) types.captured[upvalue.index] = true;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	FunctionTypes& function_types(Function* function) {
+		auto [it, inserted] = m_functions.try_emplace(function);
+		auto& types = it->second;
+		if (inserted) {
+			types.slots.assign(function->frame_size(), Type::NONE);
+			find_captured(types, function->body());
+			// Only the calls of a direct function are known, anything could be passed to the others
+			const bool direct = function->kind() == VariableKind::GLOBAL && m_direct_functions.contains(function->slot())
+				&& m_direct_functions.at(function->slot()) == function;
+			for (size_t i = 0; i < function->params().size(); i++) {
+				types.slots[i] = direct ? Type::NONE : Type::ANY;
+			}
+		}
+		return types;
+	}
+
+	void store(FunctionTypes& types, int slot, uint8_t type) {
+		if (types.captured[slot]) type = Type::ANY;
+		const uint8_t joined = types.slots[slot] | type;
+		if (joined != types.slots[slot]) {
+			types.slots[slot] = joined;
+			m_changed = true;
+		}
+	}
+	uint8_t load(int slot) const {
+		return m_current->captured[slot] ? static_cast<uint8_t>(Type::ANY) : m_current->slots[slot];
+	}
+
+	void infer_all(const std::vector<StmtPtr>& statements) {
+		for (const auto& statement : statements) {
+			infer(statement);
+		}
+	}
+
+	void infer(StmtPtr stmt) {
+		if (!stmt) return;
+		switch (stmt->node_kind()) {
+			case StmtKind::BLOCK:
+				infer_all(static_cast<Block*>(stmt)->statements());
+				break;
+			case StmtKind::EXPRESSION:
+				infer(static_cast<Expression*>(stmt)->expression());
+				break;
+			case StmtKind::PRINT:
+				infer(static_cast<Print*>(stmt)->expression());
+				break;
+			case StmtKind::SLEEP:
+				infer(static_cast<Sleep*>(stmt)->expression());
+				break;
+			case StmtKind::RETURN:
+				if (static_cast<Return*>(stmt)->value()) infer(static_cast<Return*>(stmt)->value());
+				break;
+			case StmtKind::VAR: {
+				auto* var = static_cast<Var*>(stmt);
+				const uint8_t type = var->initializer() ? infer(var->initializer()) : static_cast<uint8_t>(Type::NIL);
+				if (var->kind() == VariableKind::LOCAL) store(*m_current, var->slot(), type);
+				break;
+			}
+			case StmtKind::FUNCTION: {
+				auto* function = static_cast<Function*>(stmt);
+				if (function->kind() == VariableKind::LOCAL) store(*m_current, function->slot(), Type::CALLABLE);
+				auto* enclosing = m_current;
+				m_current = &function_types(function);
+				infer_all(function->body());
+				m_current = enclosing;
+				break;
+			}
+			case StmtKind::IF: {
+				auto* if_stmt = static_cast<If*>(stmt);
+				infer(if_stmt->condition());
+				infer(if_stmt->then_branch());
+				infer(if_stmt->else_branch());
+				break;
+			}
+			case StmtKind::WHILE:
+				infer(static_cast<While*>(stmt)->condition());
+				infer(static_cast<While*>(stmt)->body());
+				break;
+			case StmtKind::FOR: {
+				auto* for_stmt = static_cast<For*>(stmt);
+				infer(for_stmt->initializer());
+				if (for_stmt->condition()) infer(for_stmt->condition());
+				if (for_stmt->increment()) infer(for_stmt->increment());
+				infer(for_stmt->body());
+				break;
+			}
+			case StmtKind::BREAK:
+			case StmtKind::CONTINUE:
+				break;
+		}
+	}
+
+	// Returns the types expr can evaluate to, given what is known about the slots so far
+	uint8_t infer(ExprPtr expr) {
+		switch (expr->node_kind()) {
+			case ExprKind::LITERAL:
+				return literal_type(static_cast<Literal*>(expr)->value());
+			case ExprKind::GROUPING:
+				return infer(static_cast<Grouping*>(expr)->expression());
+			case ExprKind::VARIABLE: {
+				auto* variable = static_cast<Variable*>(expr);
+				return variable->kind() == VariableKind::LOCAL ? load(variable->slot()) : static_cast<uint8_t>(Type::ANY);
+			}
+			case ExprKind::ASSIGN: {
+				auto* assign = static_cast<Assign*>(expr);
+				const uint8_t type = infer(assign->value());
+				if (assign->kind() == VariableKind::LOCAL) store(*m_current, assign->slot(), type);
+				return type;
+			}
+			case ExprKind::LOGICAL: {
+				auto* logical = static_cast<Logical*>(expr);
+				const uint8_t left = infer(logical->left());
+				return left | infer(logical->right());
+			}
+			case ExprKind::UNARY: {
+				auto* unary = static_cast<Unary*>(expr);
+				const uint8_t right = infer(unary->right());
+				if (unary->op().type() == TokenType::BANG) return Type::BOOL;
+				if (m_annotate) unary->set_number_operand(right == Type::NUMBER);
+				return Type::NUMBER;
+			}
+			case ExprKind::BINARY: {
+				auto* binary = static_cast<Binary*>(expr);
+				const uint8_t left = infer(binary->left());
+				const uint8_t right = infer(binary->right());
+				if (m_annotate) binary->set_number_operands(left == Type::NUMBER && right == Type::NUMBER);
+				return binary_type(binary->op().type(), left, right);
+			}
+			case ExprKind::CALL: {
+				auto* call = static_cast<Call*>(expr);
+				infer(call->callee());
+				auto* function = direct_callee(call);
+				const auto& arguments = call->arguments();
+				// The arguments become the callee's parameters, a call with
+				// the wrong number of them never gets there
+				FunctionTypes* callee = function && arguments.size() == function->params().size()
+					? &function_types(function) : nullptr;
+				for (size_t i = 0; i < arguments.size(); i++) {
+					const uint8_t type = infer(arguments[i]);
+					if (callee) store(*callee, static_cast<int>(i), type);
+				}
+				// An inlined body reads the caller's locals in place of its parameters
+				if (call->inlined_body()) infer(call->inlined_body());
+				return Type::ANY;
+			}
+		}
+		return Type::ANY;
+	}
+
+	static uint8_t literal_type(const Value& value) {
+		switch (value.type()) {
+			case Value::Type::NUMBER: return Type::NUMBER;
+			case Value::Type::BOOL: return Type::BOOL;
+			case Value::Type::STRING: return Type::STRING;
+			case Value::Type::NIL: return Type::NIL;
+			default: return Type::CALLABLE;
+		}
+	}
+	// Operations that don't throw
+	static uint8_t binary_type(TokenType op, uint8_t left, uint8_t right) {
+		switch (op) {
+			case TokenType::PLUS:
+				if (left == Type::NUMBER && right == Type::NUMBER) return Type::NUMBER;
+				// Either side being a string makes a string
+				if ((left | right) & Type::STRING) {
+					return (left & Type::NUMBER) && (right & Type::NUMBER) ? Type::NUMBER | Type::STRING : Type::STRING;
+				}
+				return Type::NUMBER;
+			case TokenType::MINUS:
+			case TokenType::STAR:
+			case TokenType::SLASH:
+				return Type::NUMBER;
+			default:
+				// Comparisons and equality
+				return Type::BOOL;
+		}
+	}
+
+	FunctionTypes m_script{};
+	std::unordered_map<Function*, FunctionTypes> m_functions{};
+	FunctionTypes* m_current{nullptr};
+	bool m_changed{false};
+	// Set for the last walk, once the types are final
+	bool m_annotate{false};
+
+	// Global slot to the number of stores into it
+	std::unordered_map<int, int> m_global_uses{};
+	std::unordered_map<int, Function*> m_direct_functions{};
+};
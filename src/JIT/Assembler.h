@@ -0,0 +1,178 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+ * Emits the few x86-64 instructions the JIT's templates are built from.
+ * Registers have fixed roles in the generated code, only those are encodable:
+ *	rbp		base of the native frame, its slots are [rbp + disp32]
+ *	r12		the JitContext, never changed
+ *	r13		argument array of a call
+ *	r14		where a call stores its result
+ *	rax		scratch
+ *	xmm0	the value being computed, xmm1 the other operand
+ */
+class Assembler {
+public:
+	enum class Xmm : uint8_t {
+		XMM0 = 0,
+		XMM1 = 1,
+	};
+	// Second byte of the two byte jcc rel32 encodings
+	enum class Condition : uint8_t {
+		BELOW = 0x82,			// CF
+		ABOVE_EQUAL = 0x83,		// !CF
+		EQUAL = 0x84,			// ZF
+		NOT_EQUAL = 0x85,		// !ZF
+		BELOW_EQUAL = 0x86,		// CF || ZF
+		ABOVE = 0x87,			// !CF && !ZF
+		PARITY = 0x8A,			// PF, set by an unordered (NaN) comparison
+		NOT_PARITY = 0x8B,
+	};
+
+	// A jump target. Jumps emitted before it is bound are patched by bind()
+	class Label {
+	public:
+		bool is_bound() const {
+			return m_position >= 0;
+		}
+	private:
+		friend class Assembler;
+		int m_position{-1};
+		std::vector<int> m_uses{};
+	};
+
+	const std::vector<uint8_t>& code() const {
+		return m_code;
+	}
+	int size() const {
+		return static_cast<int>(m_code.size());
+	}
+
+	void bind(Label& label) {
+		assert(!label.is_bound());
+		label.m_position = size();
+		for (const int use : label.m_uses) {
+			patch32(use, label.m_position - (use + 4));
+		}
+		label.m_uses.clear();
+	}
+
+	// Frame setup and teardown
+	void push_rbp() { emit(0x55); }
+	void push_r12() { emit(0x41, 0x54); }
+	void push_r13() { emit(0x41, 0x55); }
+	void push_r14() { emit(0x41, 0x56); }
+	void pop_rbp() { emit(0x5D); }
+	void pop_r12() { emit(0x41, 0x5C); }
+	void pop_r13() { emit(0x41, 0x5D); }
+	void pop_r14() { emit(0x41, 0x5E); }
+	void mov_rbp_rsp() { emit(0x48, 0x89, 0xE5); }
+	// Returns the offset of the immediate, for frames whose size is only known at the end
+	int sub_rsp_imm32(int32_t value) {
+		emit(0x48, 0x81, 0xEC);
+		const int position = size();
+		emit32(value);
+		return position;
+	}
+	void patch32(int position, int32_t value) {
+		std::memcpy(m_code.data() + position, &value, sizeof(value));
+	}
+	void leave() { emit(0xC9); }
+	void ret() { emit(0xC3); }
+
+	// cmp rsp, [r12], followed by an unsigned jcc
+	void cmp_rsp_r12_indirect() { emit(0x49, 0x3B, 0x24, 0x24); }
+
+	void mov_rax_rbp_disp(int32_t disp) { emit(0x48, 0x8B, 0x85); emit32(disp); }
+	void mov_rbp_disp_r14(int32_t disp) { emit(0x4C, 0x89, 0xB5); emit32(disp); }
+	void lea_r13_rbp_disp(int32_t disp) { emit(0x4C, 0x8D, 0xAD); emit32(disp); }
+	void lea_r14_rbp_disp(int32_t disp) { emit(0x4C, 0x8D, 0xB5); emit32(disp); }
+	void mov_rax_imm64(uint64_t value) {
+		emit(0x48, 0xB8);
+		for (int i = 0; i < 8; i++) {
+			emit(static_cast<uint8_t>(value >> (i * 8)));
+		}
+	}
+	void mov_eax_imm32(int32_t value) { emit(0xB8); emit32(value); }
+	void xor_eax_eax() { emit(0x31, 0xC0); }
+	void test_eax_eax() { emit(0x85, 0xC0); }
+
+	// Entry stub, moving the platform's argument registers into the fixed ones
+	void mov_r13_rdi() { emit(0x49, 0x89, 0xFD); }
+	void mov_r14_rsi() { emit(0x49, 0x89, 0xF6); }
+	void mov_r12_rdx() { emit(0x49, 0x89, 0xD4); }
+	void call_rcx() { emit(0xFF, 0xD1); }
+	void mov_r13_rcx() { emit(0x49, 0x89, 0xCD); }
+	void mov_r14_rdx() { emit(0x49, 0x89, 0xD6); }
+	void mov_r12_r8() { emit(0x4D, 0x89, 0xC4); }
+	void call_r9() { emit(0x41, 0xFF, 0xD1); }
+
+	// Doubles
+	void movsd_load(Xmm dst, int32_t rbp_disp) { emit(0xF2, 0x0F, 0x10, modrm_rbp_disp(dst)); emit32(rbp_disp); }
+	void movsd_store(int32_t rbp_disp, Xmm src) { emit(0xF2, 0x0F, 0x11, modrm_rbp_disp(src)); emit32(rbp_disp); }
+	// movsd xmm0, [r13 + disp32]
+	void movsd_load_argument(int32_t disp) { emit(0xF2, 0x41, 0x0F, 0x10, 0x85); emit32(disp); }
+	// movsd [rax], xmm0
+	void movsd_store_rax_xmm0() { emit(0xF2, 0x0F, 0x11, 0x00); }
+	// movq xmm, rax
+	void movq_xmm_rax(Xmm dst) { emit(0x66, 0x48, 0x0F, 0x6E, static_cast<uint8_t>(0xC0 | (reg(dst) << 3))); }
+	void movapd(Xmm dst, Xmm src) { sse_rr(0x66, 0x28, dst, src); }
+	void addsd(Xmm dst, Xmm src) { sse_rr(0xF2, 0x58, dst, src); }
+	void subsd(Xmm dst, Xmm src) { sse_rr(0xF2, 0x5C, dst, src); }
+	void mulsd(Xmm dst, Xmm src) { sse_rr(0xF2, 0x59, dst, src); }
+	void divsd(Xmm dst, Xmm src) { sse_rr(0xF2, 0x5E, dst, src); }
+	void andpd(Xmm dst, Xmm src) { sse_rr(0x66, 0x54, dst, src); }
+	void xorpd(Xmm dst, Xmm src) { sse_rr(0x66, 0x57, dst, src); }
+	void ucomisd(Xmm left, Xmm right) { sse_rr(0x66, 0x2E, left, right); }
+
+	// Control flow
+	void jmp(Label& label) {
+		emit(0xE9);
+		emit_target(label);
+	}
+	void jcc(Condition condition, Label& label) {
+		emit(0x0F, static_cast<uint8_t>(condition));
+		emit_target(label);
+	}
+	void call(Label& label) {
+		emit(0xE8);
+		emit_target(label);
+	}
+
+private:
+	static uint8_t reg(Xmm xmm) {
+		return static_cast<uint8_t>(xmm);
+	}
+	// mod=10 (disp32), rm=101 (rbp)
+	static uint8_t modrm_rbp_disp(Xmm xmm) {
+		return static_cast<uint8_t>(0x85 | (reg(xmm) << 3));
+	}
+	void sse_rr(uint8_t prefix, uint8_t opcode, Xmm dst, Xmm src) {
+		emit(prefix, 0x0F, opcode, static_cast<uint8_t>(0xC0 | (reg(dst) << 3) | reg(src)));
+	}
+
+	void emit_target(Label& label) {
+		const int position = size();
+		emit32(0);
+		if (label.is_bound()) {
+			patch32(position, label.m_position - (position + 4));
+		} else {
+			label.m_uses.push_back(position);
+		}
+	}
+
+	template<typename... Bytes>
+	void emit(Bytes... bytes) {
+		(m_code.push_back(static_cast<uint8_t>(bytes)), ...);
+	}
+	void emit32(int32_t value) {
+		uint8_t bytes[4];
+		std::memcpy(bytes, &value, sizeof(value));
+		m_code.insert(m_code.end(), bytes, bytes + 4);
+	}
+
+	std::vector<uint8_t> m_code{};
+};
@@ -0,0 +1,197 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/*
+ * SSA form of a function the JIT compiles, between the tree and the machine code.
+ *
+ * Every value is a double defined by exactly one instruction. Instructions
+ * live in one array and are referred to by index, blocks list the ones they
+ * contain in order, phis first. A phi has one operand per predecessor of its
+ * block, in the order of the block's predecessor list. Control leaves a block
+ * through its terminator only, comparisons don't produce values, they are
+ * part of the branch deciding on them.
+ *
+ * Removing an instruction only unlinks it from its block, indices stay valid.
+ */
+enum class IrOp : uint8_t {
+	CONSTANT,
+	// Argument number `constant`
+	PARAMETER,
+	PHI,
+	// Left behind by assignments, copy propagation removes them
+	COPY,
+	ADD,
+	SUBTRACT,
+	MULTIPLY,
+	// Bails on a zero divisor
+	DIVIDE,
+	NEGATE,
+	// The function calling itself, bails unless the call returns a number
+	CALL,
+};
+
+enum class IrCondition : uint8_t {
+	GREATER,
+	GREATER_EQUAL,
+	LESS,
+	LESS_EQUAL,
+	EQUAL,
+	NOT_EQUAL,
+};
+
+enum class IrTerminator : uint8_t {
+	// Only while the block is being built
+	NONE,
+	JUMP,
+	// To the first successor when the condition holds, the second otherwise
+	BRANCH,
+	RETURN,
+	RETURN_NIL,
+	// `return f(...)` of the function itself, restarts it with new arguments
+	TAIL_CALL,
+};
+
+using IrValue = int;
+
+struct IrInstruction {
+	IrOp op{IrOp::CONSTANT};
+	// -1 once removed
+	int block{-1};
+	double constant{0.0};
+	std::vector<IrValue> operands{};
+};
+
+struct IrBlock {
+	std::vector<IrValue> instructions{};
+	std::vector<int> predecessors{};
+
+	IrTerminator terminator{IrTerminator::NONE};
+	IrCondition condition{IrCondition::EQUAL};
+	// Compared by a branch, returned, or the arguments of a tail call
+	std::vector<IrValue> operands{};
+	int successors[2]{ -1, -1 };
+	bool reachable{true};
+
+	int successor_count() const {
+		switch (terminator) {
+			case IrTerminator::JUMP: return 1;
+			case IrTerminator::BRANCH: return 2;
+			default: return 0;
+		}
+	}
+};
+
+struct IrFunction {
+	int arity{0};
+	std::vector<IrInstruction> instructions{};
+	// The entry block comes first
+	std::vector<IrBlock> blocks{};
+
+	int add_block() {
+		blocks.emplace_back();
+		return static_cast<int>(blocks.size()) - 1;
+	}
+	IrValue add(int block, IrOp op, std::vector<IrValue> operands = {}, double constant = 0.0) {
+		instructions.push_back({ op, block, constant, std::move(operands) });
+		const IrValue value = static_cast<IrValue>(instructions.size()) - 1;
+		auto& list = blocks[block].instructions;
+		// Phis stay in front of the rest of the block
+		if (op == IrOp::PHI) {
+			auto it = list.begin();
+			while (it != list.end() && instructions[*it].op == IrOp::PHI) ++it;
+			list.insert(it, value);
+		} else {
+			list.push_back(value);
+		}
+		return value;
+	}
+	void link(int from, int to) {
+		blocks[to].predecessors.push_back(from);
+	}
+
+	bool is_constant(IrValue value) const {
+		return instructions[value].op == IrOp::CONSTANT;
+	}
+	// Instructions still in a block
+	int size() const {
+		int count = 0;
+		for (const auto& block : blocks) {
+			if (block.reachable) count += static_cast<int>(block.instructions.size());
+		}
+		return count;
+	}
+
+	// Replaces every operand v by replacement[v], following chains of replacements
+	void rewrite(std::vector<IrValue>& replacement) {
+		auto resolve = [&](IrValue value) {
+			IrValue target = value;
+			while (replacement[target] != target) target = replacement[target];
+			// Shorten the chain for the next lookup
+			while (replacement[value] != target) {
+				const IrValue next = replacement[value];
+				replacement[value] = target;
+				value = next;
+			}
+			return target;
+		};
+		for (auto& block : blocks) {
+			if (!block.reachable) continue;
+			for (const IrValue value : block.instructions) {
+				for (auto& operand : instructions[value].operands) operand = resolve(operand);
+			}
+			for (auto& operand : block.operands) operand = resolve(operand);
+		}
+	}
+	// Identity mapping for rewrite
+	std::vector<IrValue> no_replacements() const {
+		std::vector<IrValue> replacement(instructions.size());
+		for (size_t i = 0; i < replacement.size(); i++) {
+			replacement[i] = static_cast<IrValue>(i);
+		}
+		return replacement;
+	}
+};
+
+inline std::ostream& operator<<(std::ostream& os, const IrFunction& function) {
+	static constexpr const char* OPS[] = { "const", "param", "phi", "copy", "add", "sub", "mul", "div", "neg", "call" };
+	static constexpr const char* CONDITIONS[] = { ">", ">=", "<", "<=", "==", "!=" };
+	for (size_t b = 0; b < function.blocks.size(); b++) {
+		const auto& block = function.blocks[b];
+		if (!block.reachable) continue;
+		os << "b" << b << ":";
+		for (const int predecessor : block.predecessors) os << " <- b" << predecessor;
+		os << "\n";
+		for (const IrValue value : block.instructions) {
+			const auto& instruction = function.instructions[value];
+			os << "\tv" << value << " = " << OPS[static_cast<int>(instruction.op)];
+			if (instruction.op == IrOp::CONSTANT || instruction.op == IrOp::PARAMETER) os << " " << instruction.constant;
+			for (const IrValue operand : instruction.operands) os << " v" << operand;
+			os << "\n";
+		}
+		switch (block.terminator) {
+			case IrTerminator::JUMP:
+				os << "\tjump b" << block.successors[0] << "\n";
+				break;
+			case IrTerminator::BRANCH:
+				os << "\tbranch v" << block.operands[0] << " " << CONDITIONS[static_cast<int>(block.condition)]
+					<< " v" << block.operands[1] << " b" << block.successors[0] << " b" << block.successors[1] << "\n";
+				break;
+			case IrTerminator::RETURN:
+				os << "\treturn v" << block.operands[0] << "\n";
+				break;
+			case IrTerminator::RETURN_NIL:
+				os << "\treturn nil\n";
+				break;
+			case IrTerminator::TAIL_CALL:
+				os << "\ttail call";
+				for (const IrValue operand : block.operands) os << " v" << operand;
+				os << "\n";
+				break;
+			case IrTerminator::NONE:
+				break;
+		}
+	}
+	return os;
+}
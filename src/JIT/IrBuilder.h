@@ -0,0 +1,532 @@
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Ir.h"
+#include "../Lexer/Expr.h"
+#include "../Lexer/Stmt.h"
+
+/*
+ * Translates one function declaration into SSA form.
+ *
+ * Only functions that compute on numbers are accepted: parameters and locals
+ * must be numbers, the body may use arithmetic, comparisons, logical
+ * operators in conditions, if, while, for, break, continue, return and calls
+ * of the function itself through its global name. Anything else (strings,
+ * globals, closures, print, other calls, ...) rejects the whole function.
+ *
+ * Frame slots become SSA values as the tree is walked, following Braun et
+ * al., "Simple and Efficient Construction of Static Single Assignment Form":
+ * a read looks for the slot's definition in the current block and then
+ * through its predecessors, placing phis where paths meet. Loop headers are
+ * sealed only once their back edges are known, reads in them before that
+ * get a phi whose operands are filled in on sealing.
+ */
+class IrBuilder {
+public:
+	struct Unsupported {
+		std::string reason;
+	};
+
+	IrBuilder(Function* function) : m_function(function) { }
+
+	// Throws Unsupported for functions the JIT can't compile
+	IrFunction build() {
+		m_ir.arity = static_cast<int>(m_function->params().size());
+		m_current = new_block();
+		seal(m_current);
+		for (int i = 0; i < m_ir.arity; i++) {
+			write(i, m_current, m_ir.add(m_current, IrOp::PARAMETER, {}, i));
+		}
+		for (const auto& statement : m_function->body()) {
+			statement_ir(statement);
+		}
+		// Falling off the end returns nil
+		terminate(IrTerminator::RETURN_NIL);
+		remove_unreachable();
+		return std::move(m_ir);
+	}
+
+	// Global slot the function calls itself through, -1 if it doesn't
+	int self_slot() const {
+		return m_self_calls ? m_function->slot() : -1;
+	}
+
+private:
+	[[noreturn]] static void reject(std::string reason) {
+		throw Unsupported{ std::move(reason) };
+	}
+
+	// What an expression is known to evaluate to without running it
+	enum class Type {
+		NUMBER,
+		// Comparisons and the like, only usable as conditions
+		BOOL,
+		OTHER,
+	};
+
+	struct Loop {
+		int break_target;
+		int continue_target;
+	};
+
+	/*
+	 * Blocks
+	 */
+	int new_block() {
+		const int block = m_ir.add_block();
+		m_definitions.emplace_back(m_function->frame_size(), -1);
+		m_sealed.push_back(false);
+		m_incomplete_phis.emplace_back();
+		return block;
+	}
+	void terminate(IrTerminator terminator, std::vector<IrValue> operands = {}) {
+		auto& block = m_ir.blocks[m_current];
+		block.terminator = terminator;
+		block.operands = std::move(operands);
+	}
+	void jump(int target) {
+		terminate(IrTerminator::JUMP);
+		m_ir.blocks[m_current].successors[0] = target;
+		m_ir.link(m_current, target);
+	}
+	void branch(IrCondition condition, IrValue left, IrValue right, int when_true, int when_false) {
+		if (when_true == when_false) {
+			jump(when_true);
+			return;
+		}
+		auto& block = m_ir.blocks[m_current];
+		terminate(IrTerminator::BRANCH, { left, right });
+		block.condition = condition;
+		block.successors[0] = when_true;
+		block.successors[1] = when_false;
+		m_ir.link(m_current, when_true);
+		m_ir.link(m_current, when_false);
+	}
+	// Code after a jump or return goes into a block nothing leads to
+	void start_unreachable() {
+		m_current = new_block();
+		seal(m_current);
+	}
+	// No more predecessors will be added
+	void seal(int block) {
+		for (const auto& [slot, phi] : m_incomplete_phis[block]) {
+			add_phi_operands(slot, phi);
+		}
+		m_incomplete_phis[block].clear();
+		m_sealed[block] = true;
+	}
+
+	/*
+	 * Variables
+	 */
+	void write(int slot, int block, IrValue value) {
+		m_definitions[block][slot] = value;
+	}
+	IrValue read(int slot, int block) {
+		if (const IrValue value = m_definitions[block][slot]; value >= 0) {
+			return value;
+		}
+		IrValue value;
+		const auto& predecessors = m_ir.blocks[block].predecessors;
+		if (!m_sealed[block]) {
+			value = m_ir.add(block, IrOp::PHI);
+			m_incomplete_phis[block].emplace_back(slot, value);
+		} else if (predecessors.size() == 1) {
+			value = read(slot, predecessors[0]);
+		} else if (predecessors.empty()) {
+			// Only in code nothing leads to, or a slot read on a path that never wrote it
+			value = m_ir.add(0, IrOp::CONSTANT);
+		} else {
+			// Written first so a loop reading the slot through the phi finds it
+			value = m_ir.add(block, IrOp::PHI);
+			write(slot, block, value);
+			add_phi_operands(slot, value);
+		}
+		write(slot, block, value);
+		return value;
+	}
+	void add_phi_operands(int slot, IrValue phi) {
+		const int block = m_ir.instructions[phi].block;
+		for (const int predecessor : m_ir.blocks[block].predecessors) {
+			const IrValue operand = read(slot, predecessor);
+			m_ir.instructions[phi].operands.push_back(operand);
+		}
+	}
+
+	/*
+	 * Statements
+	 */
+	void statement_ir(StmtPtr stmt) {
+		switch (stmt->node_kind()) {
+			case StmtKind::BLOCK:
+				for (const auto& statement : static_cast<Block*>(stmt)->statements()) {
+					statement_ir(statement);
+				}
+				return;
+			case StmtKind::EXPRESSION: {
+				auto* expression = static_cast<Expression*>(stmt)->expression();
+				if (type_of(expression) == Type::BOOL) {
+					// Evaluated for its guards only
+					const int next = new_block();
+					condition_ir(expression, next, next);
+					seal(next);
+					m_current = next;
+				} else {
+					number_ir(expression);
+				}
+				return;
+			}
+			case StmtKind::VAR: {
+				auto* var = static_cast<Var*>(stmt);
+				if (var->kind() != VariableKind::LOCAL || !var->initializer()) {
+					reject("declares a variable that isn't a number");
+				}
+				const IrValue value = number_ir(var->initializer());
+				write(var->slot(), m_current, m_ir.add(m_current, IrOp::COPY, { value }));
+				return;
+			}
+			case StmtKind::IF: {
+				auto* if_stmt = static_cast<If*>(stmt);
+				const int then_branch = new_block();
+				const int end = new_block();
+				const int else_branch = if_stmt->else_branch() ? new_block() : end;
+				condition_ir(if_stmt->condition(), then_branch, else_branch);
+				seal(then_branch);
+				m_current = then_branch;
+				statement_ir(if_stmt->then_branch());
+				jump(end);
+				if (if_stmt->else_branch()) {
+					seal(else_branch);
+					m_current = else_branch;
+					statement_ir(if_stmt->else_branch());
+					jump(end);
+				}
+				seal(end);
+				m_current = end;
+				return;
+			}
+			case StmtKind::WHILE: {
+				auto* while_stmt = static_cast<While*>(stmt);
+				const int header = new_block();
+				const int body = new_block();
+				const int end = new_block();
+				jump(header);
+				m_current = header;
+				condition_ir(while_stmt->condition(), body, end);
+				seal(body);
+				m_current = body;
+				loop_body_ir(while_stmt->body(), end, header);
+				jump(header);
+				seal(header);
+				seal(end);
+				m_current = end;
+				return;
+			}
+			case StmtKind::FOR: {
+				auto* for_stmt = static_cast<For*>(stmt);
+				if (for_stmt->initializer()) {
+					statement_ir(for_stmt->initializer());
+				}
+				const int header = new_block();
+				const int body = new_block();
+				const int increment = new_block();
+				const int end = new_block();
+				jump(header);
+				m_current = header;
+				if (for_stmt->condition()) {
+					condition_ir(for_stmt->condition(), body, end);
+				} else {
+					jump(body);
+				}
+				seal(body);
+				m_current = body;
+				loop_body_ir(for_stmt->body(), end, increment);
+				jump(increment);
+				seal(increment);
+				m_current = increment;
+				if (for_stmt->increment()) {
+					number_ir(for_stmt->increment());
+				}
+				jump(header);
+				seal(header);
+				seal(end);
+				m_current = end;
+				return;
+			}
+			case StmtKind::BREAK:
+				if (m_loops.empty()) reject("break outside of a loop");
+				jump(m_loops.back().break_target);
+				start_unreachable();
+				return;
+			case StmtKind::CONTINUE:
+				if (m_loops.empty()) reject("continue outside of a loop");
+				jump(m_loops.back().continue_target);
+				start_unreachable();
+				return;
+			case StmtKind::RETURN:
+				return_ir(static_cast<Return*>(stmt));
+				start_unreachable();
+				return;
+			case StmtKind::FUNCTION:
+				reject("declares a function");
+			case StmtKind::PRINT:
+				reject("prints");
+			case StmtKind::SLEEP:
+				reject("sleeps");
+		}
+	}
+
+	void loop_body_ir(StmtPtr body, int break_target, int continue_target) {
+		m_loops.push_back({ break_target, continue_target });
+		statement_ir(body);
+		m_loops.pop_back();
+	}
+
+	void return_ir(Return* stmt) {
+		if (!stmt->value()) {
+			terminate(IrTerminator::RETURN_NIL);
+			return;
+		}
+		if (stmt->tail_call() && is_self_call(stmt->value())) {
+			terminate(IrTerminator::TAIL_CALL, arguments_ir(static_cast<Call*>(stmt->value())));
+			m_self_calls = true;
+			return;
+		}
+		terminate(IrTerminator::RETURN, { number_ir(stmt->value()) });
+	}
+
+	/*
+	 * Expressions
+	 */
+	bool is_self_call(ExprPtr expr) const {
+		if (expr->node_kind() != ExprKind::CALL) return false;
+		auto* call = static_cast<Call*>(expr);
+		if (call->callee()->node_kind() != ExprKind::VARIABLE) return false;
+		auto* callee = static_cast<Variable*>(call->callee());
+		// A wrong argument count is an error the interpreter reports
+		return m_function->kind() == VariableKind::GLOBAL && callee->kind() == VariableKind::GLOBAL
+			&& callee->slot() == m_function->slot() && call->arguments().size() == m_function->params().size();
+	}
+
+	static bool is_comparison(TokenType type) {
+		switch (type) {
+			case TokenType::GREATER:
+			case TokenType::GREATER_EQUAL:
+			case TokenType::LESS:
+			case TokenType::LESS_EQUAL:
+			case TokenType::EQUAL_EQUAL:
+			case TokenType::BANG_EQUAL:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	Type type_of(ExprPtr expr) const {
+		switch (expr->node_kind()) {
+			case ExprKind::LITERAL: {
+				const auto& value = static_cast<Literal*>(expr)->value();
+				if (value.is_number()) return Type::NUMBER;
+				if (value.is_bool()) return Type::BOOL;
+				return Type::OTHER;
+			}
+			case ExprKind::VARIABLE:
+				// Every local is a number, locals that could be anything else reject the function
+				return static_cast<Variable*>(expr)->kind() == VariableKind::LOCAL ? Type::NUMBER : Type::OTHER;
+			case ExprKind::ASSIGN: {
+				auto* assign = static_cast<Assign*>(expr);
+				return assign->kind() == VariableKind::LOCAL && type_of(assign->value()) == Type::NUMBER ? Type::NUMBER : Type::OTHER;
+			}
+			case ExprKind::BINARY: {
+				auto* binary = static_cast<Binary*>(expr);
+				if (type_of(binary->left()) != Type::NUMBER || type_of(binary->right()) != Type::NUMBER) {
+					return Type::OTHER;
+				}
+				return is_comparison(binary->op().type()) ? Type::BOOL : Type::NUMBER;
+			}
+			case ExprKind::UNARY: {
+				auto* unary = static_cast<Unary*>(expr);
+				const auto operand = type_of(unary->right());
+				if (unary->op().type() == TokenType::MINUS) {
+					return operand == Type::NUMBER ? Type::NUMBER : Type::OTHER;
+				}
+				return operand == Type::OTHER ? Type::OTHER : Type::BOOL;
+			}
+			case ExprKind::LOGICAL: {
+				auto* logical = static_cast<Logical*>(expr);
+				// Only as a condition, where the operand that decided doesn't matter
+				return type_of(logical->left()) != Type::OTHER && type_of(logical->right()) != Type::OTHER ? Type::BOOL : Type::OTHER;
+			}
+			case ExprKind::GROUPING:
+				return type_of(static_cast<Grouping*>(expr)->expression());
+			case ExprKind::CALL:
+				// The result is checked to be a number after the call
+				return is_self_call(expr) ? Type::NUMBER : Type::OTHER;
+		}
+		return Type::OTHER;
+	}
+
+	// Value of a number typed expression
+	IrValue number_ir(ExprPtr expr) {
+		if (type_of(expr) != Type::NUMBER) {
+			reject("uses a value that isn't a number");
+		}
+		switch (expr->node_kind()) {
+			case ExprKind::LITERAL:
+				return m_ir.add(m_current, IrOp::CONSTANT, {}, static_cast<Literal*>(expr)->value().as_double());
+			case ExprKind::VARIABLE:
+				return read(static_cast<Variable*>(expr)->slot(), m_current);
+			case ExprKind::ASSIGN: {
+				auto* assign = static_cast<Assign*>(expr);
+				const IrValue value = m_ir.add(m_current, IrOp::COPY, { number_ir(assign->value()) });
+				write(assign->slot(), m_current, value);
+				return value;
+			}
+			case ExprKind::GROUPING:
+				return number_ir(static_cast<Grouping*>(expr)->expression());
+			case ExprKind::UNARY:
+				return m_ir.add(m_current, IrOp::NEGATE, { number_ir(static_cast<Unary*>(expr)->right()) });
+			case ExprKind::BINARY: {
+				auto* binary = static_cast<Binary*>(expr);
+				const IrValue left = number_ir(binary->left());
+				const IrValue right = number_ir(binary->right());
+				return m_ir.add(m_current, arithmetic_op(binary->op().type()), { left, right });
+			}
+			case ExprKind::CALL: {
+				auto arguments = arguments_ir(static_cast<Call*>(expr));
+				m_self_calls = true;
+				return m_ir.add(m_current, IrOp::CALL, std::move(arguments));
+			}
+			case ExprKind::LOGICAL:
+				break;
+		}
+		reject("uses a value that isn't a number");
+	}
+	std::vector<IrValue> arguments_ir(Call* call) {
+		std::vector<IrValue> arguments{};
+		for (const auto& argument : call->arguments()) {
+			arguments.push_back(number_ir(argument));
+		}
+		return arguments;
+	}
+	static IrOp arithmetic_op(TokenType type) {
+		switch (type) {
+			case TokenType::PLUS: return IrOp::ADD;
+			case TokenType::MINUS: return IrOp::SUBTRACT;
+			case TokenType::STAR: return IrOp::MULTIPLY;
+			case TokenType::SLASH: return IrOp::DIVIDE;
+			default:
+				reject("uses an unsupported operator");
+		}
+	}
+
+	// Ends the current block with a branch to when_true if the condition is truthy, when_false otherwise
+	void condition_ir(ExprPtr expr, int when_true, int when_false) {
+		const auto type = type_of(expr);
+		if (type == Type::OTHER) {
+			reject("uses a condition that isn't a number or a comparison");
+		}
+		if (type == Type::NUMBER) {
+			// Numbers are always truthy, but still evaluated for their guards
+			number_ir(expr);
+			jump(when_true);
+			return;
+		}
+		switch (expr->node_kind()) {
+			case ExprKind::LITERAL:
+				jump(static_cast<Literal*>(expr)->value().as_bool() ? when_true : when_false);
+				return;
+			case ExprKind::GROUPING:
+				condition_ir(static_cast<Grouping*>(expr)->expression(), when_true, when_false);
+				return;
+			case ExprKind::UNARY:
+				condition_ir(static_cast<Unary*>(expr)->right(), when_false, when_true);
+				return;
+			case ExprKind::LOGICAL: {
+				auto* logical = static_cast<Logical*>(expr);
+				// `or` is decided by a truthy lhs, `and` by a falsey one
+				const int right = new_block();
+				if (logical->op().type() == TokenType::OR) {
+					condition_ir(logical->left(), when_true, right);
+				} else {
+					condition_ir(logical->left(), right, when_false);
+				}
+				seal(right);
+				m_current = right;
+				condition_ir(logical->right(), when_true, when_false);
+				return;
+			}
+			case ExprKind::BINARY: {
+				auto* binary = static_cast<Binary*>(expr);
+				const IrValue left = number_ir(binary->left());
+				const IrValue right = number_ir(binary->right());
+				branch(comparison(binary->op().type()), left, right, when_true, when_false);
+				return;
+			}
+			default:
+				break;
+		}
+		reject("uses a condition that isn't a number or a comparison");
+	}
+	static IrCondition comparison(TokenType type) {
+		switch (type) {
+			case TokenType::GREATER: return IrCondition::GREATER;
+			case TokenType::GREATER_EQUAL: return IrCondition::GREATER_EQUAL;
+			case TokenType::LESS: return IrCondition::LESS;
+			case TokenType::LESS_EQUAL: return IrCondition::LESS_EQUAL;
+			case TokenType::EQUAL_EQUAL: return IrCondition::EQUAL;
+			case TokenType::BANG_EQUAL: return IrCondition::NOT_EQUAL;
+			default:
+				reject("uses an unsupported operator");
+		}
+	}
+
+	// Drops the blocks after returns and jumps, along with the edges and phi operands they contributed
+	void remove_unreachable() {
+		std::vector<int> worklist{ 0 };
+		std::vector<bool> reachable(m_ir.blocks.size(), false);
+		reachable[0] = true;
+		while (!worklist.empty()) {
+			const auto& block = m_ir.blocks[worklist.back()];
+			worklist.pop_back();
+			for (int i = 0; i < block.successor_count(); i++) {
+				if (!reachable[block.successors[i]]) {
+					reachable[block.successors[i]] = true;
+					worklist.push_back(block.successors[i]);
+				}
+			}
+		}
+		for (size_t b = 0; b < m_ir.blocks.size(); b++) {
+			auto& block = m_ir.blocks[b];
+			block.reachable = reachable[b];
+			if (!block.reachable) {
+				for (const IrValue value : block.instructions) m_ir.instructions[value].block = -1;
+				block.instructions.clear();
+				continue;
+			}
+			auto& predecessors = block.predecessors;
+			for (size_t i = predecessors.size(); i-- > 0;) {
+				if (reachable[predecessors[i]]) continue;
+				predecessors.erase(predecessors.begin() + i);
+				for (const IrValue value : block.instructions) {
+					auto& instruction = m_ir.instructions[value];
+					if (instruction.op != IrOp::PHI) break;
+					instruction.operands.erase(instruction.operands.begin() + i);
+				}
+			}
+		}
+	}
+
+	Function* m_function;
+	IrFunction m_ir{};
+	int m_current{0};
+	// Per block, the value each frame slot holds at its end so far, -1 if not written in it
+	std::vector<std::vector<IrValue>> m_definitions{};
+	std::vector<bool> m_sealed{};
+	// Per block, phis created before it was sealed and the slots they stand for
+	std::vector<std::vector<std::pair<int, IrValue>>> m_incomplete_phis{};
+	std::vector<Loop> m_loops{};
+	bool m_self_calls{false};
+};
@@ -0,0 +1,332 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "Ir.h"
+
+/*
+ * Optimizations on the SSA form, each a function taking the IrFunction.
+ *
+ * The compiled subset has no side effects to preserve beyond its guards:
+ * a division by zero or a failed call bails out of the whole call and the
+ * interpreter runs it again from the start. So pure instructions may be
+ * computed earlier, once, or not at all, while divisions that can bail and
+ * calls are never dropped. A call of the function with the same arguments
+ * always returns the same number, which makes calls fair game for CSE.
+ */
+
+// Blocks in reverse postorder and the immediate dominator of each, after
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+struct IrDominators {
+	std::vector<int> order{};
+	// -1 for unreachable blocks, the entry block is its own
+	std::vector<int> idom{};
+	std::vector<std::vector<int>> children{};
+
+	explicit IrDominators(const IrFunction& function) {
+		const int count = static_cast<int>(function.blocks.size());
+		std::vector<int> postorder_index(count, -1);
+		std::vector<bool> visited(count, false);
+		// Iterative depth first search, a block is finished once all its successors are
+		std::vector<std::pair<int, int>> stack{ { 0, 0 } };
+		visited[0] = true;
+		while (!stack.empty()) {
+			auto& [block, next] = stack.back();
+			const auto& ir_block = function.blocks[block];
+			if (next < ir_block.successor_count()) {
+				const int successor = ir_block.successors[next++];
+				if (!visited[successor]) {
+					visited[successor] = true;
+					stack.push_back({ successor, 0 });
+				}
+				continue;
+			}
+			postorder_index[block] = static_cast<int>(order.size());
+			order.push_back(block);
+			stack.pop_back();
+		}
+		std::reverse(order.begin(), order.end());
+
+		idom.assign(count, -1);
+		idom[0] = 0;
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (const int block : order) {
+				if (block == 0) continue;
+				int new_idom = -1;
+				for (const int predecessor : function.blocks[block].predecessors) {
+					if (idom[predecessor] < 0) continue;
+					new_idom = new_idom < 0 ? predecessor : intersect(predecessor, new_idom, postorder_index);
+				}
+				if (idom[block] != new_idom) {
+					idom[block] = new_idom;
+					changed = true;
+				}
+			}
+		}
+		children.resize(count);
+		for (const int block : order) {
+			if (block != 0) children[idom[block]].push_back(block);
+		}
+	}
+
+	bool dominates(int dominator, int block) const {
+		while (block != dominator) {
+			if (block == 0 || idom[block] < 0) return false;
+			block = idom[block];
+		}
+		return true;
+	}
+
+private:
+	int intersect(int left, int right, const std::vector<int>& postorder_index) const {
+		while (left != right) {
+			while (postorder_index[left] < postorder_index[right]) left = idom[left];
+			while (postorder_index[right] < postorder_index[left]) right = idom[right];
+		}
+		return left;
+	}
+};
+
+inline bool ir_is_pure(const IrFunction& function, const IrInstruction& instruction) {
+	switch (instruction.op) {
+		case IrOp::CONSTANT:
+		case IrOp::PARAMETER:
+		case IrOp::PHI:
+		case IrOp::COPY:
+		case IrOp::ADD:
+		case IrOp::SUBTRACT:
+		case IrOp::MULTIPLY:
+		case IrOp::NEGATE:
+			return true;
+		case IrOp::DIVIDE: {
+			// Only a constant divisor is known not to be zero
+			const IrValue divisor = instruction.operands[1];
+			return function.is_constant(divisor) && function.instructions[divisor].constant != 0.0;
+		}
+		case IrOp::CALL:
+			return false;
+	}
+	return false;
+}
+
+inline void ir_remove(IrFunction& function, IrValue value) {
+	auto& instruction = function.instructions[value];
+	auto& list = function.blocks[instruction.block].instructions;
+	list.erase(std::find(list.begin(), list.end(), value));
+	instruction.block = -1;
+}
+
+// Uses of copies and of phis whose operands are all the same value (besides
+// the phi itself) are replaced by that value, then both are removed
+inline void ir_propagate_copies(IrFunction& function) {
+	auto replacement = function.no_replacements();
+	auto resolve = [&](IrValue value) {
+		while (replacement[value] != value) value = replacement[value];
+		return value;
+	};
+	// A phi becomes trivial once the phis it merges turn out to be
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto& block : function.blocks) {
+			if (!block.reachable) continue;
+			for (const IrValue value : block.instructions) {
+				if (replacement[value] != value) continue;
+				const auto& instruction = function.instructions[value];
+				if (instruction.op == IrOp::COPY) {
+					replacement[value] = resolve(instruction.operands[0]);
+					changed = true;
+				} else if (instruction.op == IrOp::PHI) {
+					IrValue same = -1;
+					bool trivial = true;
+					for (const IrValue operand : instruction.operands) {
+						const IrValue resolved = resolve(operand);
+						if (resolved == value || resolved == same) continue;
+						if (same >= 0) {
+							trivial = false;
+							break;
+						}
+						same = resolved;
+					}
+					// A phi only merging itself is read before anything was written
+					if (trivial && same >= 0) {
+						replacement[value] = same;
+						changed = true;
+					}
+				}
+			}
+		}
+	}
+	function.rewrite(replacement);
+	for (size_t value = 0; value < replacement.size(); value++) {
+		if (replacement[value] != static_cast<IrValue>(value)) {
+			ir_remove(function, static_cast<IrValue>(value));
+		}
+	}
+}
+
+// Common subexpression elimination: an instruction computing the same as one
+// in a dominating block (or earlier in its own) is replaced by it
+inline void ir_eliminate_common_subexpressions(IrFunction& function, const IrDominators& dominators) {
+	using Key = std::tuple<IrOp, uint64_t, std::vector<IrValue>>;
+	std::map<Key, IrValue> available{};
+	auto replacement = function.no_replacements();
+	std::vector<IrValue> removed{};
+
+	auto key_of = [&](const IrInstruction& instruction) {
+		uint64_t bits = 0;
+		std::memcpy(&bits, &instruction.constant, sizeof(bits));
+		auto operands = instruction.operands;
+		for (auto& operand : operands) operand = replacement[operand];
+		// Adding and multiplying doubles is commutative
+		if (instruction.op == IrOp::ADD || instruction.op == IrOp::MULTIPLY) {
+			std::sort(operands.begin(), operands.end());
+		}
+		return Key{ instruction.op, bits, std::move(operands) };
+	};
+
+	// Walks the dominator tree, what a block makes available goes away once its subtree is done
+	struct Frame {
+		int block;
+		size_t next_child;
+		std::vector<Key> added;
+	};
+	std::vector<Frame> stack{};
+	auto enter = [&](int block) {
+		Frame frame{ block, 0, {} };
+		for (const IrValue value : function.blocks[block].instructions) {
+			const auto& instruction = function.instructions[value];
+			if (instruction.op == IrOp::PHI || instruction.op == IrOp::PARAMETER || instruction.op == IrOp::COPY) continue;
+			auto key = key_of(instruction);
+			if (const auto it = available.find(key); it != available.end()) {
+				replacement[value] = it->second;
+				removed.push_back(value);
+			} else {
+				available.emplace(key, value);
+				frame.added.push_back(std::move(key));
+			}
+		}
+		stack.push_back(std::move(frame));
+	};
+	enter(0);
+	while (!stack.empty()) {
+		auto& frame = stack.back();
+		const auto& children = dominators.children[frame.block];
+		if (frame.next_child < children.size()) {
+			enter(children[frame.next_child++]);
+			continue;
+		}
+		for (const auto& key : frame.added) available.erase(key);
+		stack.pop_back();
+	}
+
+	function.rewrite(replacement);
+	for (const IrValue value : removed) {
+		ir_remove(function, value);
+	}
+}
+
+// Loop invariant code motion: pure instructions of a loop whose operands are
+// all defined outside of it move to the block entering the loop, innermost
+// loops first so an instruction can climb out of several
+inline void ir_hoist_loop_invariants(IrFunction& function, const IrDominators& dominators) {
+	struct Loop {
+		int header;
+		std::vector<bool> blocks;
+		int size;
+	};
+	std::vector<Loop> loops{};
+	const int count = static_cast<int>(function.blocks.size());
+	for (const int block : dominators.order) {
+		for (const int predecessor : function.blocks[block].predecessors) {
+			// A back edge: the target dominates where it comes from
+			if (!dominators.dominates(block, predecessor)) continue;
+			auto it = std::find_if(loops.begin(), loops.end(), [&](const Loop& loop) { return loop.header == block; });
+			if (it == loops.end()) {
+				loops.push_back({ block, std::vector<bool>(count, false), 1 });
+				it = loops.end() - 1;
+				it->blocks[block] = true;
+			}
+			// Everything reaching the back edge without passing the header
+			std::vector<int> worklist{ predecessor };
+			while (!worklist.empty()) {
+				const int member = worklist.back();
+				worklist.pop_back();
+				if (it->blocks[member]) continue;
+				it->blocks[member] = true;
+				it->size++;
+				for (const int next : function.blocks[member].predecessors) worklist.push_back(next);
+			}
+		}
+	}
+	std::sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) { return a.size < b.size; });
+
+	for (const auto& loop : loops) {
+		// The loops built from while and for are entered by a single jump
+		int preheader = -1;
+		for (const int predecessor : function.blocks[loop.header].predecessors) {
+			if (loop.blocks[predecessor]) continue;
+			if (preheader >= 0) {
+				preheader = -1;
+				break;
+			}
+			preheader = predecessor;
+		}
+		if (preheader < 0 || function.blocks[preheader].terminator != IrTerminator::JUMP) continue;
+
+		auto invariant = [&](IrValue operand) {
+			return !loop.blocks[function.instructions[operand].block];
+		};
+		for (const int block : dominators.order) {
+			if (!loop.blocks[block]) continue;
+			// Copied, hoisting changes the list
+			const auto instructions = function.blocks[block].instructions;
+			for (const IrValue value : instructions) {
+				auto& instruction = function.instructions[value];
+				if (instruction.op == IrOp::PHI || instruction.op == IrOp::PARAMETER || !ir_is_pure(function, instruction)) continue;
+				if (!std::all_of(instruction.operands.begin(), instruction.operands.end(), invariant)) continue;
+				ir_remove(function, value);
+				instruction.block = preheader;
+				function.blocks[preheader].instructions.push_back(value);
+			}
+		}
+	}
+}
+
+// Dead code elimination: instructions nothing uses are removed, unless they can bail
+inline void ir_eliminate_dead_code(IrFunction& function) {
+	std::vector<bool> live(function.instructions.size(), false);
+	std::vector<IrValue> worklist{};
+	auto mark = [&](IrValue value) {
+		if (!live[value]) {
+			live[value] = true;
+			worklist.push_back(value);
+		}
+	};
+	for (const auto& block : function.blocks) {
+		if (!block.reachable) continue;
+		for (const IrValue operand : block.operands) mark(operand);
+		for (const IrValue value : block.instructions) {
+			if (!ir_is_pure(function, function.instructions[value])) mark(value);
+		}
+	}
+	while (!worklist.empty()) {
+		const IrValue value = worklist.back();
+		worklist.pop_back();
+		for (const IrValue operand : function.instructions[value].operands) mark(operand);
+	}
+	for (auto& block : function.blocks) {
+		if (!block.reachable) continue;
+		std::erase_if(block.instructions, [&](IrValue value) {
+			if (live[value]) return false;
+			function.instructions[value].block = -1;
+			return true;
+		});
+	}
+}
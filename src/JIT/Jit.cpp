@@ -0,0 +1,199 @@
+#include "Jit.h"
+
+#if TOY_JIT_SUPPORTED
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "JitCompiler.h"
+
+ExecutableMemory::ExecutableMemory(const std::vector<uint8_t>& code) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const size_t page_size = info.dwPageSize;
+#else
+	const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	m_size = (code.size() + page_size - 1) / page_size * page_size;
+
+	// Never writable and executable at the same time
+#ifdef _WIN32
+	m_data = VirtualAlloc(nullptr, m_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (!m_data) return;
+	std::memcpy(m_data, code.data(), code.size());
+	DWORD old_protection;
+	if (!VirtualProtect(m_data, m_size, PAGE_EXECUTE_READ, &old_protection)) {
+		VirtualFree(m_data, 0, MEM_RELEASE);
+		m_data = nullptr;
+		return;
+	}
+	FlushInstructionCache(GetCurrentProcess(), m_data, m_size);
+#else
+	void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED) return;
+	std::memcpy(data, code.data(), code.size());
+	if (mprotect(data, m_size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(data, m_size);
+		return;
+	}
+	m_data = data;
+#endif
+}
+
+ExecutableMemory::~ExecutableMemory() {
+	if (!m_data) return;
+#ifdef _WIN32
+	VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+	munmap(m_data, m_size);
+#endif
+}
+
+Jit::Jit(Config config) : m_config(config) {
+	// int entry(const double* arguments, double* result, const JitContext* context, const void* code)
+	// saves the registers the generated code uses that the platform's ABI
+	// wants preserved and calls code with the arguments where it expects them
+	Assembler a;
+	a.push_rbp();
+	a.push_r12();
+	a.push_r13();
+	a.push_r14();
+#ifdef _WIN32
+	a.mov_r13_rcx();
+	a.mov_r14_rdx();
+	a.mov_r12_r8();
+	a.call_r9();
+#else
+	a.mov_r13_rdi();
+	a.mov_r14_rsi();
+	a.mov_r12_rdx();
+	a.call_rcx();
+#endif
+	a.pop_r14();
+	a.pop_r13();
+	a.pop_r12();
+	a.pop_rbp();
+	a.ret();
+
+	m_entry_stub = std::make_unique<ExecutableMemory>(a.code());
+	if (!m_entry_stub->is_valid()) {
+		// No executable memory to be had, everything stays interpreted
+		m_config.enabled = false;
+		return;
+	}
+	m_entry = reinterpret_cast<Entry>(const_cast<void*>(m_entry_stub->data()));
+}
+
+Jit::~Jit() = default;
+
+const JitFunction* Jit::compile(Function* declaration) {
+	if (const auto it = m_functions.find(declaration); it != m_functions.end()) {
+		return it->second.get();
+	}
+	auto& function = m_functions[declaration];
+	const std::string name(declaration->name().lexeme());
+
+	const auto start = std::chrono::steady_clock::now();
+	JitCompiler compiler;
+	const bool compiled = compiler.compile(declaration, m_config.optimize);
+	m_stats.compile_time += std::chrono::steady_clock::now() - start;
+	if (!compiled) {
+		m_stats.rejected++;
+		m_stats.log.push_back("rejected " + name + ": " + compiler.rejection());
+		return nullptr;
+	}
+	auto code = std::make_unique<ExecutableMemory>(compiler.code());
+	if (!code->is_valid()) {
+		m_stats.rejected++;
+		m_stats.log.push_back("rejected " + name + ": no executable memory");
+		return nullptr;
+	}
+	function = std::make_unique<JitFunction>();
+	function->code = std::move(code);
+	function->self_slot = compiler.self_slot();
+	m_stats.compiled++;
+	m_stats.log.push_back("compiled " + name + " (" + std::to_string(compiler.code().size()) + " bytes; "
+		+ compiler.timings() + ")");
+	if (m_config.dump_ir) {
+		std::cerr << "-- ir of " << name << " --\n" << compiler.ir();
+	}
+	return function.get();
+}
+
+bool Jit::call(JitProfile& profile, Function* declaration, const Object* function, std::span<Value> arguments,
+	GlobalEnvironment& globals, uintptr_t stack_limit, Value& result) {
+	if (!m_config.enabled) return false;
+	if (!profile.code) {
+		if (profile.given_up || ++profile.calls < m_config.threshold) {
+			return false;
+		}
+		profile.code = compile(declaration);
+		if (!profile.code) {
+			profile.given_up = true;
+			return false;
+		}
+	}
+
+	// Guards the code relies on without checking them itself
+	m_arguments.resize(arguments.size());
+	for (size_t i = 0; i < arguments.size(); i++) {
+		if (!arguments[i].is_number()) return false;
+		m_arguments[i] = arguments[i].as_double();
+	}
+	if (const int slot = profile.code->self_slot; slot >= 0) {
+		const auto& global = globals.at(slot);
+		if (!globals.is_defined(slot) || !global.is_callable() || global.as_object() != function) {
+			return false;
+		}
+	}
+
+	const char marker{};
+	const JitContext context{ std::max(reinterpret_cast<uintptr_t>(&marker) - NATIVE_STACK_BYTES, stack_limit) };
+	double value = 0.0;
+	const auto status = static_cast<JitStatus>(m_entry(m_arguments.data(), &value, &context, profile.code->code->data()));
+	m_stats.native_calls++;
+	switch (status) {
+		case JitStatus::NUMBER:
+			result = Value(value);
+			return true;
+		case JitStatus::NIL:
+			result = Value(nullptr);
+			return true;
+		case JitStatus::BAIL:
+			break;
+	}
+	m_stats.bails++;
+	if (++profile.bails >= BAILS_MAX) {
+		profile.code = nullptr;
+		profile.given_up = true;
+		m_stats.log.push_back("gave up on " + std::string(declaration->name().lexeme()) + " after " + std::to_string(BAILS_MAX) + " bails");
+	}
+	return false;
+}
+
+#else
+
+ExecutableMemory::ExecutableMemory(const std::vector<uint8_t>&) { }
+
+ExecutableMemory::~ExecutableMemory() = default;
+
+Jit::Jit(Config config) : m_config(config) {
+	m_config.enabled = false;
+}
+
+Jit::~Jit() = default;
+
+bool Jit::call(JitProfile&, Function*, const Object*, std::span<Value>, GlobalEnvironment&, uintptr_t, Value&) {
+	return false;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../Value.h"
+#include "../Lexer/Environment.h"
+
+// The JIT emits x86-64 and needs a way to map executable memory
+#if defined(TOY_JIT) && (defined(__x86_64__) || defined(_M_X64)) && (defined(__unix__) || defined(__APPLE__) || defined(_WIN32))
+#define TOY_JIT_SUPPORTED 1
+#else
+#define TOY_JIT_SUPPORTED 0
+#endif
+
+class Function;
+
+// Read by the generated code through r12
+struct JitContext {
+	// Compiled functions bail out instead of growing the native stack below
+	// this address, compared against rsp as an unsigned integer
+	uintptr_t stack_limit{0};
+};
+
+// Pages holding generated code, mapped writable to copy the code in and then
+// flipped to executable
+class ExecutableMemory {
+public:
+	ExecutableMemory(const std::vector<uint8_t>& code);
+	ExecutableMemory(const ExecutableMemory&) = delete;
+	ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+	~ExecutableMemory();
+
+	const void* data() const {
+		return m_data;
+	}
+	bool is_valid() const {
+		return m_data != nullptr;
+	}
+private:
+	void* m_data{nullptr};
+	size_t m_size{0};
+};
+
+struct JitFunction {
+	std::unique_ptr<ExecutableMemory> code{};
+	// Global slot the code calls itself through, -1 if it doesn't
+	int self_slot{-1};
+};
+
+// Per ToyFunction state, kept by the function itself so a call doesn't need a lookup
+struct JitProfile {
+	uint32_t calls{0};
+	uint32_t bails{0};
+	// Native code once the function got hot
+	const JitFunction* code{nullptr};
+	// Couldn't be compiled or bailed too often
+	bool given_up{false};
+};
+
+/*
+ * Baseline JIT for the tree-walker.
+ * Every call of a ToyFunction is counted, once a function has been called
+ * `threshold` times its declaration is handed to the JitCompiler. Later calls
+ * with number arguments run the native code, anything the code can't handle
+ * bails back to the interpreter, which then runs the call as usual.
+ * Functions that keep bailing are given up on.
+ */
+class Jit {
+public:
+	struct Config {
+		bool enabled{true};
+		uint32_t threshold{100};
+		// Run the IR passes before lowering
+		bool optimize{true};
+		// Print the IR of every compiled function to stderr
+		bool dump_ir{false};
+	};
+
+	struct Stats {
+		std::chrono::duration<double, std::milli> compile_time{};
+		size_t compiled{0};
+		size_t rejected{0};
+		size_t native_calls{0};
+		size_t bails{0};
+		std::vector<std::string> log{};
+	};
+
+	Jit(Config config);
+	~Jit();
+
+	// Off when disabled, unsupported on this platform or without executable memory
+	bool enabled() const {
+		return m_config.enabled;
+	}
+
+	// Runs a call of function natively if it is hot and the guards hold,
+	// returns false when the interpreter has to run it. The code never goes
+	// below stack_limit, the interpreter's own limit
+	bool call(JitProfile& profile, Function* declaration, const Object* function, std::span<Value> arguments,
+		GlobalEnvironment& globals, uintptr_t stack_limit, Value& result);
+
+	const Stats& stats() const {
+		return m_stats;
+	}
+
+private:
+	using Entry = int (*)(const double* arguments, double* result, const JitContext* context, const void* code);
+
+	const JitFunction* compile(Function* declaration);
+
+	// A function that bailed this many times runs in the interpreter for good
+	static constexpr uint32_t BAILS_MAX = 16;
+	// How much native stack compiled code may use below the interpreter's
+	static constexpr size_t NATIVE_STACK_BYTES = 256 * 1024;
+
+	Config m_config{};
+	Stats m_stats{};
+	// Moves the platform's argument registers into the ones the generated code expects
+	std::unique_ptr<ExecutableMemory> m_entry_stub{};
+	Entry m_entry{nullptr};
+	// Declarations are compiled once, however many functions are made of them.
+	// Rejected ones map to nullptr
+	std::unordered_map<Function*, std::unique_ptr<JitFunction>> m_functions{};
+	std::vector<double> m_arguments{};
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Jit::Stats& stats) {
+	os << "[jit] compiled: " << stats.compiled << ", rejected: " << stats.rejected
+		<< ", native calls: " << stats.native_calls << ", bails: " << stats.bails
+		<< ", compile time: " << stats.compile_time.count() << "ms";
+	for (const auto& line : stats.log) {
+		os << "\n[jit] " << line;
+	}
+	return os;
+}
@@ -0,0 +1,449 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Assembler.h"
+#include "Ir.h"
+#include "IrBuilder.h"
+#include "IrPasses.h"
+#include "../Lexer/Expr.h"
+#include "../Lexer/Stmt.h"
+
+// Status the generated code returns, the result is only written for NUMBER
+enum class JitStatus : int {
+	NUMBER = 0,
+	// A guard failed, the interpreter has to run the call instead
+	BAIL = 1,
+	NIL = 2,
+};
+
+/*
+ * Translates one function declaration to x86-64 through the SSA form:
+ * IrBuilder accepts or rejects the function and builds the IR, the passes
+ * in IrPasses.h optimize it and the IR is then lowered instruction by
+ * instruction, no register allocation involved.
+ *
+ * The compiled code is free of side effects, so a guard that fails anywhere
+ * simply abandons the call (JitStatus::BAIL) and the interpreter runs it
+ * again from the start:
+ *	- the arguments must be numbers (checked before entering)
+ *	- the global the function calls itself through must still hold it (ditto)
+ *	- division by zero, the interpreter reports the error
+ *	- a recursive call returning nil, or running out of native stack
+ *
+ * Every SSA value lives in its own slot of a native frame of doubles
+ * addressed off rbp, the parameters in the first ones. Constants are
+ * materialized where they are used and take no slot. Phis are slots their
+ * predecessors store into before jumping.
+ *	[rbp - 8]			where to store the result
+ *	[rbp - 16 - 8 * n]	slot n
+ * Calls take the argument array in r13 and the result pointer in r14, r12
+ * holds the JitContext with the stack limit. A return in tail position
+ * calling the function itself stores the new arguments into the parameter
+ * slots and jumps back to the top.
+ */
+class JitCompiler {
+public:
+	using Xmm = Assembler::Xmm;
+	using Condition = Assembler::Condition;
+	using Label = Assembler::Label;
+
+	// Set when compile returns false
+	const std::string& rejection() const {
+		return m_rejection;
+	}
+	// Global slot the function calls itself through, -1 if it doesn't
+	int self_slot() const {
+		return m_self_slot;
+	}
+	// How long each step took and how many instructions were left after it
+	std::string timings() const {
+		return m_timings.str();
+	}
+	const IrFunction& ir() const {
+		return m_ir;
+	}
+
+	bool compile(Function* function, bool optimize) {
+		try {
+			if (!function->upvalues().empty()) {
+				throw IrBuilder::Unsupported{ "captures variables" };
+			}
+			IrBuilder builder(function);
+			timed("build", [&] { m_ir = builder.build(); });
+			m_self_slot = builder.self_slot();
+		}
+		catch (const IrBuilder::Unsupported& unsupported) {
+			m_rejection = unsupported.reason;
+			return false;
+		}
+
+		if (optimize) {
+			timed("copies", [&] { ir_propagate_copies(m_ir); });
+			const IrDominators dominators(m_ir);
+			timed("cse", [&] { ir_eliminate_common_subexpressions(m_ir, dominators); });
+			timed("licm", [&] { ir_hoist_loop_invariants(m_ir, dominators); });
+			timed("dce", [&] { ir_eliminate_dead_code(m_ir); });
+		}
+		timed("lower", [&] { lower(); });
+		return true;
+	}
+
+	const std::vector<uint8_t>& code() const {
+		return m_assembler.code();
+	}
+
+private:
+	template<typename Step>
+	void timed(const char* name, Step step) {
+		const auto start = std::chrono::steady_clock::now();
+		step();
+		const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		if (m_timings.tellp() > 0) m_timings << ", ";
+		m_timings.precision(1);
+		m_timings << std::fixed << name << " " << elapsed.count() << "us";
+		if (std::strcmp(name, "lower") != 0) m_timings << " (" << m_ir.size() << ")";
+	}
+
+	static int32_t slot_offset(int slot) {
+		return -16 - 8 * slot;
+	}
+	static constexpr int32_t RESULT_POINTER_OFFSET = -8;
+
+	void lower() {
+		split_critical_edges();
+		const IrDominators dominators(m_ir);
+		assign_slots(dominators.order);
+
+		auto& a = m_assembler;
+		a.bind(m_start);
+		a.push_rbp();
+		a.mov_rbp_rsp();
+		a.sub_rsp_imm32(((8 + 8 * m_slot_count + 15) & ~15));
+		a.cmp_rsp_r12_indirect();
+		a.jcc(Condition::BELOW, m_bail);
+		a.mov_rbp_disp_r14(RESULT_POINTER_OFFSET);
+		for (int i = 0; i < m_ir.arity; i++) {
+			a.movsd_load_argument(8 * i);
+			a.movsd_store(slot_offset(i), Xmm::XMM0);
+		}
+		a.bind(m_body);
+
+		m_labels = std::vector<Label>(m_ir.blocks.size());
+		const auto& order = dominators.order;
+		for (size_t i = 0; i < order.size(); i++) {
+			const int next = i + 1 < order.size() ? order[i + 1] : -1;
+			lower_block(order[i], next);
+		}
+
+		a.bind(m_bail);
+		a.mov_eax_imm32(static_cast<int32_t>(JitStatus::BAIL));
+		a.leave();
+		a.ret();
+	}
+
+	// A branch can't store into the phis of one of its targets without also
+	// doing it on the way to the other, so such edges get a block of their own
+	void split_critical_edges() {
+		const int count = static_cast<int>(m_ir.blocks.size());
+		for (int b = 0; b < count; b++) {
+			if (!m_ir.blocks[b].reachable || m_ir.blocks[b].terminator != IrTerminator::BRANCH) continue;
+			for (int i = 0; i < 2; i++) {
+				const int target = m_ir.blocks[b].successors[i];
+				const auto& instructions = m_ir.blocks[target].instructions;
+				if (instructions.empty() || m_ir.instructions[instructions[0]].op != IrOp::PHI) continue;
+				const int edge = m_ir.add_block();
+				m_ir.blocks[edge].terminator = IrTerminator::JUMP;
+				m_ir.blocks[edge].successors[0] = target;
+				m_ir.blocks[edge].predecessors.push_back(b);
+				m_ir.blocks[b].successors[i] = edge;
+				// Same position in the list, the phi operands stay in step
+				auto& predecessors = m_ir.blocks[target].predecessors;
+				*std::find(predecessors.begin(), predecessors.end(), b) = edge;
+			}
+		}
+	}
+
+	void assign_slots(const std::vector<int>& order) {
+		m_slots.assign(m_ir.instructions.size(), -1);
+		m_slot_count = m_ir.arity;
+		int max_phis = 0;
+		int max_arguments = m_ir.arity;
+		for (const int block : order) {
+			int phis = 0;
+			for (const IrValue value : m_ir.blocks[block].instructions) {
+				const auto& instruction = m_ir.instructions[value];
+				switch (instruction.op) {
+					case IrOp::CONSTANT:
+						break;
+					case IrOp::PARAMETER:
+						m_slots[value] = static_cast<int>(instruction.constant);
+						break;
+					case IrOp::PHI:
+						phis++;
+						[[fallthrough]];
+					default:
+						m_slots[value] = m_slot_count++;
+						break;
+				}
+				if (instruction.op == IrOp::CALL) {
+					max_arguments = std::max(max_arguments, static_cast<int>(instruction.operands.size()));
+				}
+			}
+			max_phis = std::max(max_phis, phis);
+		}
+		// Values being moved into phis or parameters are staged here first, they may read each other
+		m_scratch = m_slot_count;
+		m_slot_count += std::max(max_phis, m_ir.arity);
+		// The result of a call followed by its arguments in descending slots
+		m_call_area = m_slot_count;
+		m_slot_count += max_arguments + 1;
+	}
+
+	// Loads a value into xmm. The value stored last is usually the next one
+	// needed and still in xmm0, which saves going through its slot
+	void load(Xmm xmm, IrValue value) {
+		auto& a = m_assembler;
+		const auto& instruction = m_ir.instructions[value];
+		if (value == m_xmm0) {
+			if (xmm != Xmm::XMM0) a.movapd(xmm, Xmm::XMM0);
+			return;
+		}
+		if (xmm == Xmm::XMM0) m_xmm0 = value;
+		if (instruction.op == IrOp::CONSTANT) {
+			uint64_t bits;
+			std::memcpy(&bits, &instruction.constant, sizeof(bits));
+			a.mov_rax_imm64(bits);
+			a.movq_xmm_rax(xmm);
+			return;
+		}
+		a.movsd_load(xmm, slot_offset(m_slots[value]));
+	}
+	void store(IrValue value, Xmm xmm) {
+		m_assembler.movsd_store(slot_offset(m_slots[value]), xmm);
+		if (xmm == Xmm::XMM0) m_xmm0 = value;
+	}
+
+	void lower_block(int b, int next) {
+		auto& a = m_assembler;
+		const auto& block = m_ir.blocks[b];
+		a.bind(m_labels[b]);
+		// Jumps arrive with anything in xmm0
+		m_xmm0 = -1;
+		for (const IrValue value : block.instructions) {
+			lower_instruction(value);
+		}
+		switch (block.terminator) {
+			case IrTerminator::JUMP:
+				store_phis(b, block.successors[0]);
+				if (block.successors[0] != next) a.jmp(m_labels[block.successors[0]]);
+				return;
+			case IrTerminator::BRANCH:
+				load(Xmm::XMM1, block.operands[0]);
+				load(Xmm::XMM0, block.operands[1]);
+				lower_comparison(block.condition, m_labels[block.successors[0]]);
+				if (block.successors[1] != next) a.jmp(m_labels[block.successors[1]]);
+				return;
+			case IrTerminator::RETURN:
+				load(Xmm::XMM0, block.operands[0]);
+				a.mov_rax_rbp_disp(RESULT_POINTER_OFFSET);
+				a.movsd_store_rax_xmm0();
+				a.xor_eax_eax();
+				a.leave();
+				a.ret();
+				return;
+			case IrTerminator::RETURN_NIL:
+				a.mov_eax_imm32(static_cast<int32_t>(JitStatus::NIL));
+				a.leave();
+				a.ret();
+				return;
+			case IrTerminator::TAIL_CALL: {
+				// The arguments may read the parameters they replace
+				const int count = static_cast<int>(block.operands.size());
+				for (int i = 0; i < count; i++) {
+					load(Xmm::XMM0, block.operands[i]);
+					a.movsd_store(slot_offset(m_scratch + i), Xmm::XMM0);
+				}
+				for (int i = 0; i < count; i++) {
+					a.movsd_load(Xmm::XMM0, slot_offset(m_scratch + i));
+					a.movsd_store(slot_offset(i), Xmm::XMM0);
+				}
+				a.jmp(m_body);
+				return;
+			}
+			case IrTerminator::NONE:
+				return;
+		}
+	}
+
+	// Moves the operands for the edge from block into the phis of target
+	void store_phis(int block, int target) {
+		auto& a = m_assembler;
+		const auto& predecessors = m_ir.blocks[target].predecessors;
+		const size_t edge = std::find(predecessors.begin(), predecessors.end(), block) - predecessors.begin();
+		std::vector<std::pair<IrValue, IrValue>> moves{};
+		bool reads_phi = false;
+		for (const IrValue value : m_ir.blocks[target].instructions) {
+			const auto& instruction = m_ir.instructions[value];
+			if (instruction.op != IrOp::PHI) break;
+			const IrValue operand = instruction.operands[edge];
+			if (operand == value) continue;
+			reads_phi |= m_ir.instructions[operand].op == IrOp::PHI && m_ir.instructions[operand].block == target;
+			moves.push_back({ operand, value });
+		}
+		if (!reads_phi) {
+			for (const auto& [operand, phi] : moves) {
+				load(Xmm::XMM0, operand);
+				store(phi, Xmm::XMM0);
+			}
+			return;
+		}
+		for (size_t i = 0; i < moves.size(); i++) {
+			load(Xmm::XMM0, moves[i].first);
+			a.movsd_store(slot_offset(m_scratch + static_cast<int>(i)), Xmm::XMM0);
+		}
+		for (size_t i = 0; i < moves.size(); i++) {
+			a.movsd_load(Xmm::XMM0, slot_offset(m_scratch + static_cast<int>(i)));
+			store(moves[i].second, Xmm::XMM0);
+		}
+	}
+
+	void lower_instruction(IrValue value) {
+		auto& a = m_assembler;
+		const auto& instruction = m_ir.instructions[value];
+		const auto& operands = instruction.operands;
+		switch (instruction.op) {
+			case IrOp::CONSTANT:
+			case IrOp::PARAMETER:
+			case IrOp::PHI:
+				return;
+			case IrOp::COPY:
+				load(Xmm::XMM0, operands[0]);
+				break;
+			case IrOp::NEGATE:
+				load(Xmm::XMM0, operands[0]);
+				a.mov_rax_imm64(0x8000000000000000ull);
+				a.movq_xmm_rax(Xmm::XMM1);
+				a.xorpd(Xmm::XMM0, Xmm::XMM1);
+				break;
+			case IrOp::ADD:
+			case IrOp::SUBTRACT:
+			case IrOp::MULTIPLY:
+			case IrOp::DIVIDE:
+				load(Xmm::XMM0, operands[1]);
+				if (instruction.op == IrOp::DIVIDE && !ir_is_pure(m_ir, instruction)) {
+					// Dividing by zero is an error the interpreter reports, a NaN divisor is fine
+					Label divide{};
+					a.mov_rax_imm64(0);
+					a.movq_xmm_rax(Xmm::XMM1);
+					a.ucomisd(Xmm::XMM0, Xmm::XMM1);
+					a.jcc(Condition::PARITY, divide);
+					a.jcc(Condition::EQUAL, m_bail);
+					a.bind(divide);
+				}
+				load(Xmm::XMM1, operands[0]);
+				switch (instruction.op) {
+					case IrOp::ADD: a.addsd(Xmm::XMM1, Xmm::XMM0); break;
+					case IrOp::SUBTRACT: a.subsd(Xmm::XMM1, Xmm::XMM0); break;
+					case IrOp::MULTIPLY: a.mulsd(Xmm::XMM1, Xmm::XMM0); break;
+					default: a.divsd(Xmm::XMM1, Xmm::XMM0); break;
+				}
+				a.movapd(Xmm::XMM0, Xmm::XMM1);
+				break;
+			case IrOp::CALL: {
+				// The callee is the function being compiled, so the call goes straight to its start.
+				// The arguments are laid out in ascending addresses below the result slot
+				const int count = static_cast<int>(operands.size());
+				for (int i = 0; i < count; i++) {
+					load(Xmm::XMM0, operands[i]);
+					a.movsd_store(slot_offset(m_call_area + count - i), Xmm::XMM0);
+				}
+				a.lea_r13_rbp_disp(slot_offset(m_call_area + count));
+				a.lea_r14_rbp_disp(slot_offset(m_call_area));
+				a.call(m_start);
+				m_xmm0 = -1;
+				// Bail out as well, a nil result would make the caller fail in the interpreter
+				a.test_eax_eax();
+				a.jcc(Condition::NOT_EQUAL, m_bail);
+				a.movsd_load(Xmm::XMM0, slot_offset(m_call_area));
+				break;
+			}
+		}
+		store(value, Xmm::XMM0);
+	}
+
+	// Jumps to target when the comparison of xmm1 (left) with xmm0 (right) holds, falls through otherwise.
+	// ucomisd sets CF and ZF like an unsigned comparison, an unordered (NaN)
+	// operand sets both and PF, which makes every ordering comparison false
+	void lower_comparison(IrCondition condition, Label& target) {
+		auto& a = m_assembler;
+		switch (condition) {
+			case IrCondition::GREATER:
+				a.ucomisd(Xmm::XMM1, Xmm::XMM0);
+				a.jcc(Condition::ABOVE, target);
+				return;
+			case IrCondition::GREATER_EQUAL:
+				a.ucomisd(Xmm::XMM1, Xmm::XMM0);
+				a.jcc(Condition::ABOVE_EQUAL, target);
+				return;
+			case IrCondition::LESS:
+				a.ucomisd(Xmm::XMM0, Xmm::XMM1);
+				a.jcc(Condition::ABOVE, target);
+				return;
+			case IrCondition::LESS_EQUAL:
+				a.ucomisd(Xmm::XMM0, Xmm::XMM1);
+				a.jcc(Condition::ABOVE_EQUAL, target);
+				return;
+			case IrCondition::EQUAL:
+			case IrCondition::NOT_EQUAL: {
+				// Same as Value::operator==, numbers are equal when |a - b| < DBL_MIN
+				a.subsd(Xmm::XMM1, Xmm::XMM0);
+				a.mov_rax_imm64(0x7FFFFFFFFFFFFFFFull);
+				a.movq_xmm_rax(Xmm::XMM0);
+				a.andpd(Xmm::XMM1, Xmm::XMM0);
+				const double min = std::numeric_limits<double>::min();
+				uint64_t bits;
+				std::memcpy(&bits, &min, sizeof(bits));
+				a.mov_rax_imm64(bits);
+				a.movq_xmm_rax(Xmm::XMM0);
+				a.ucomisd(Xmm::XMM1, Xmm::XMM0);
+				// Equal: below and ordered
+				if (condition == IrCondition::EQUAL) {
+					Label skip{};
+					a.jcc(Condition::PARITY, skip);
+					a.jcc(Condition::BELOW, target);
+					a.bind(skip);
+				} else {
+					a.jcc(Condition::PARITY, target);
+					a.jcc(Condition::ABOVE_EQUAL, target);
+				}
+				return;
+			}
+		}
+	}
+
+	Assembler m_assembler{};
+	IrFunction m_ir{};
+	// The start of the code, where recursive calls go
+	Label m_start{};
+	// Past the prologue, where tail calls go
+	Label m_body{};
+	Label m_bail{};
+	std::vector<Label> m_labels{};
+	// Frame slot of every value, -1 for constants
+	std::vector<int> m_slots{};
+	int m_slot_count{0};
+	int m_scratch{0};
+	int m_call_area{0};
+	// Value xmm0 holds, -1 if unknown
+	IrValue m_xmm0{-1};
+	int m_self_slot{-1};
+	std::string m_rejection{};
+	std::ostringstream m_timings{};
+};
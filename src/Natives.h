@@ -0,0 +1,27 @@
+#pragma once
+#include <chrono>
+#include <span>
+#include <string>
+
+#include "Object.h"
+#include "Value.h"
+
+// Functions every engine defines as globals before running a script.
+// Natives never look at the interpreter they are called from, the VM and
+// compiled scripts pass nullptr
+
+class ToyClock final : public ToyCallable {
+public:
+	int arity() override { return 0; }
+	Value call(Interpreter*, std::span<Value>) override {
+		auto now = std::chrono::system_clock::now();
+		auto seconds = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
+		return Value((double)seconds.count() / 1000.0);
+	}
+	std::string to_string() const override {
+		return "<native fn>";
+	}
+	size_t size() const override {
+		return sizeof(ToyClock);
+	}
+};
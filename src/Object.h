@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+class Heap;
+class Interpreter;
+class Value;
+
+// Anything a Value can't hold inline lives on the Heap as an Object.
+// Objects are owned by the heap and freed by its collector once they are no
+// longer reachable from the roots.
+class Object {
+public:
+	virtual ~Object() = default;
+
+	virtual std::string to_string() const = 0;
+
+	// Marks every object this one references
+	virtual void trace(Heap&) { }
+
+	// Approximate number of bytes this object keeps alive, used to decide when to collect
+	virtual size_t size() const = 0;
+
+private:
+	friend class Heap;
+	// Intrusive list of every object allocated by the heap
+	Object* m_next{nullptr};
+	bool m_marked{false};
+	// Pinned objects are referenced from places the collector doesn't trace
+	// (tokens and the AST), so they live as long as the heap
+	bool m_pinned{false};
+};
+
+class ToyString final : public Object {
+public:
+	ToyString(std::string value) : m_value(std::move(value)) { }
+
+	const std::string& value() const {
+		return m_value;
+	}
+	std::string to_string() const override {
+		return m_value;
+	}
+	size_t size() const override {
+		return sizeof(ToyString) + m_value.capacity();
+	}
+private:
+	std::string m_value{};
+};
+
+class ToyCallable : public Object {
+public:
+	virtual int arity() = 0;
+	// The arguments are a view of the calling engine's stack, only valid during the call
+	virtual Value call(Interpreter*, std::span<Value> arguments) = 0;
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+
+#include "Heap.h"
+#include "Value.h"
+
+// A variable captured by a closure. While the variable's scope is still
+// active the upvalue points at its stack slot ("open"), once the scope
+// exits the value is moved into the upvalue itself ("closed").
+// Shared by the tree-walker and the VM, both keep their locals in a stack of
+// contiguous frames.
+class Upvalue final : public Object {
+public:
+	Upvalue(Value* slot) : m_location(slot) { }
+
+	Value& value() {
+		return *m_location;
+	}
+	Value* location() const {
+		return m_location;
+	}
+	void close() {
+		m_closed = std::move(*m_location);
+		m_location = &m_closed;
+	}
+	std::string to_string() const override {
+		return "upvalue";
+	}
+	void trace(Heap& heap) override {
+		heap.mark(*m_location);
+	}
+	size_t size() const override {
+		return sizeof(Upvalue);
+	}
+
+	// Next open upvalue further down the stack
+	Upvalue* next{nullptr};
+private:
+	Value* m_location{nullptr};
+	Value m_closed{nullptr};
+};
@@ -0,0 +1,150 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../Value.h"
+
+/*
+ * Instruction set of the bytecode VM.
+ *
+ * Operands follow the opcode inline. u8 operands are a single byte, u16
+ * operands are two bytes, high byte first.
+ */
+enum class OpCode : uint8_t {
+	CONSTANT,		// u16 constant index
+	NIL,
+	TRUE,
+	FALSE,
+	POP,
+
+	GET_LOCAL,		// u8 stack slot relative to the frame
+	SET_LOCAL,		// u8 stack slot relative to the frame
+	GET_GLOBAL,		// u16 global slot
+	DEFINE_GLOBAL,	// u16 global slot
+	SET_GLOBAL,		// u16 global slot
+	GET_UPVALUE,	// u8 upvalue index
+	SET_UPVALUE,	// u8 upvalue index
+
+	EQUAL,
+	NOT_EQUAL,
+	GREATER,
+	GREATER_EQUAL,
+	LESS,
+	LESS_EQUAL,
+	ADD,
+	SUBTRACT,
+	MULTIPLY,
+	DIVIDE,
+	NOT,
+	NEGATE,
+
+	PRINT,
+	SLEEP,
+
+	JUMP,			// u16 forward offset
+	JUMP_IF_FALSE,	// u16 forward offset, leaves the condition on the stack
+	LOOP,			// u16 backward offset
+
+	CALL,			// u8 argument count
+	CLOSURE,		// u16 function index, then (u8 is_local, u8 index) per upvalue
+	CLOSE_UPVALUE,
+	RETURN,
+};
+
+class FunctionProto;
+
+class Chunk {
+public:
+	void write(uint8_t byte, int line) {
+		m_code.push_back(byte);
+		m_lines.push_back(line);
+	}
+	void write(OpCode op, int line) {
+		write(static_cast<uint8_t>(op), line);
+	}
+	// A run of bytes compiled from the same line
+	void write(const uint8_t* bytes, size_t size, int line) {
+		m_code.insert(m_code.end(), bytes, bytes + size);
+		m_lines.insert(m_lines.end(), size, line);
+	}
+
+	int add_constant(Value value) {
+		// Reuse identical number and string constants, scripts tend to repeat the same literals
+		if (value.is_number()) {
+			const auto [it, inserted] = m_number_constants.try_emplace(std::bit_cast<uint64_t>(value.as_double()), static_cast<int>(m_constants.size()));
+			if (!inserted) return it->second;
+		} else if (value.is_string()) {
+			const auto [it, inserted] = m_string_constants.try_emplace(value.as_string(), static_cast<int>(m_constants.size()));
+			if (!inserted) return it->second;
+		}
+		m_constants.push_back(std::move(value));
+		return static_cast<int>(m_constants.size() - 1);
+	}
+
+	int add_function(std::unique_ptr<FunctionProto> function) {
+		m_functions.push_back(std::move(function));
+		return static_cast<int>(m_functions.size() - 1);
+	}
+
+	std::vector<uint8_t>& code() {
+		return m_code;
+	}
+	const std::vector<uint8_t>& code() const {
+		return m_code;
+	}
+	const std::vector<Value>& constants() const {
+		return m_constants;
+	}
+	const std::vector<std::unique_ptr<FunctionProto>>& functions() const {
+		return m_functions;
+	}
+	int line(size_t offset) const {
+		return m_lines.at(offset);
+	}
+	// Source line of every byte in code()
+	const std::vector<int>& lines() const {
+		return m_lines;
+	}
+private:
+	std::vector<uint8_t> m_code{};
+	std::vector<int> m_lines{};
+	std::vector<Value> m_constants{};
+	std::unordered_map<uint64_t, int> m_number_constants{};
+	std::unordered_map<std::string, int> m_string_constants{};
+	// Functions declared inside this one, referenced by OpCode::CLOSURE
+	std::vector<std::unique_ptr<FunctionProto>> m_functions{};
+};
+
+// A compiled function. Closures created at runtime point back at it
+class FunctionProto {
+public:
+	FunctionProto(std::string name, int arity) : m_name(std::move(name)), m_arity(arity) { }
+
+	const std::string& name() const {
+		return m_name;
+	}
+	int arity() const {
+		return m_arity;
+	}
+	int upvalue_count() const {
+		return m_upvalue_count;
+	}
+	void set_upvalue_count(int upvalue_count) {
+		m_upvalue_count = upvalue_count;
+	}
+	Chunk& chunk() {
+		return m_chunk;
+	}
+	const Chunk& chunk() const {
+		return m_chunk;
+	}
+private:
+	std::string m_name{};
+	int m_arity{0};
+	int m_upvalue_count{0};
+	Chunk m_chunk{};
+};
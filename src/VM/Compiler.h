@@ -0,0 +1,534 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Chunk.h"
+#include "../Lexer/Expr.h"
+#include "../Lexer/Stmt.h"
+#include "../Lexer/Environment.h"
+#include "../Toy.h"
+
+/*
+ * Lowers the Stmt/Expr tree into bytecode for the VM.
+ *
+ * Locals live on the VM stack and are addressed by their slot in the
+ * current call frame, variables captured by inner functions become upvalues
+ * and globals are addressed by their slot in the GlobalEnvironment.
+ * Scoping follows the tree-walking interpreter so both engines run the same
+ * scripts the same way.
+ */
+class Compiler final : public ExprVisitor, public StmtVisitor {
+public:
+	Compiler(Toy& toy, GlobalEnvironment& globals) : m_toy(toy), m_globals(globals) { }
+
+	// Returns the top level script as a function taking no arguments
+	std::unique_ptr<FunctionProto> compile(const std::vector<StmtPtr>& statements) {
+		auto script = std::make_unique<FunctionProto>("", 0);
+		FunctionState state(nullptr, script.get());
+		m_current = &state;
+
+		compile_all(statements);
+		emit_return();
+
+		m_current = nullptr;
+		return script;
+	}
+
+private:
+	struct Local {
+		// Points into the source, like the token it came from
+		std::string_view name{};
+		int depth{0};
+		bool is_captured{false};
+	};
+
+	struct UpvalueRef {
+		uint8_t index{0};
+		bool is_local{false};
+	};
+
+	struct Loop {
+		// Scope depth outside the loop, everything deeper is popped on break/continue
+		int scope_depth{0};
+		std::vector<size_t> break_jumps{};
+		std::vector<size_t> continue_jumps{};
+	};
+
+	struct FunctionState {
+		FunctionState(FunctionState* enclosing, FunctionProto* function) : enclosing(enclosing), function(function) {
+			// Slot 0 holds the function being called
+			locals.push_back(Local{"", 0, false});
+		}
+
+		FunctionState* enclosing{nullptr};
+		FunctionProto* function{nullptr};
+		std::vector<Local> locals{};
+		std::vector<UpvalueRef> upvalues{};
+		std::vector<Loop> loops{};
+		int scope_depth{0};
+	};
+
+	static constexpr int LOCALS_MAX = 256;
+	static constexpr int UPVALUES_MAX = 256;
+
+	Chunk& chunk() {
+		return m_current->function->chunk();
+	}
+
+	void compile(const StmtPtr& stmt) {
+		stmt->accept(this);
+	}
+	void compile_all(const std::vector<StmtPtr>& statements) {
+		for (const auto& statement : statements) {
+			compile(statement);
+		}
+	}
+	void compile(const ExprPtr& expr) {
+		expr->accept(this);
+	}
+
+	/*
+	 * Emitting
+	 */
+	void emit(uint8_t byte) {
+		chunk().write(byte, m_line);
+	}
+	void emit(OpCode op) {
+		chunk().write(op, m_line);
+	}
+	void emit(OpCode op, uint8_t operand) {
+		emit(op);
+		emit(operand);
+	}
+	void emit_short(OpCode op, int operand) {
+		emit(op);
+		emit(static_cast<uint8_t>((operand >> 8) & 0xff));
+		emit(static_cast<uint8_t>(operand & 0xff));
+	}
+	void emit_constant(Value value) {
+		const int index = chunk().add_constant(std::move(value));
+		if (index > UINT16_MAX) {
+			error("Too many constants in one chunk.");
+		}
+		emit_short(OpCode::CONSTANT, index);
+	}
+	void emit_global(OpCode op, int slot) {
+		if (slot > UINT16_MAX) {
+			error("Too many global variables.");
+		}
+		emit_short(op, slot);
+	}
+	void emit_return() {
+		emit(OpCode::NIL);
+		emit(OpCode::RETURN);
+	}
+
+	// Emits a forward jump and returns the offset of its operand for patching
+	size_t emit_jump(OpCode op) {
+		emit_short(op, 0xffff);
+		return chunk().code().size() - 2;
+	}
+	void patch_jump(size_t operand) {
+		const size_t jump = chunk().code().size() - operand - 2;
+		if (jump > UINT16_MAX) {
+			error("Too much code to jump over.");
+		}
+		chunk().code()[operand] = static_cast<uint8_t>((jump >> 8) & 0xff);
+		chunk().code()[operand + 1] = static_cast<uint8_t>(jump & 0xff);
+	}
+	void emit_loop(size_t loop_start) {
+		const size_t offset = chunk().code().size() - loop_start + 3;
+		if (offset > UINT16_MAX) {
+			error("Loop body too large.");
+		}
+		emit_short(OpCode::LOOP, static_cast<int>(offset));
+	}
+
+	void error(const std::string& message) {
+		m_toy.error(m_line, message);
+	}
+
+	/*
+	 * Scopes
+	 */
+	void begin_scope() {
+		m_current->scope_depth++;
+	}
+	void end_scope() {
+		m_current->scope_depth--;
+		auto& locals = m_current->locals;
+		while (!locals.empty() && locals.back().depth > m_current->scope_depth) {
+			emit(locals.back().is_captured ? OpCode::CLOSE_UPVALUE : OpCode::POP);
+			locals.pop_back();
+		}
+	}
+	// Pops the locals a break/continue jumps out of, without forgetting them
+	void discard_locals(int depth) {
+		const auto& locals = m_current->locals;
+		for (auto it = locals.rbegin(); it != locals.rend() && it->depth > depth; ++it) {
+			emit(it->is_captured ? OpCode::CLOSE_UPVALUE : OpCode::POP);
+		}
+	}
+
+	// Slot of the local declared in the innermost scope, -1 if there is none
+	int find_in_scope(std::string_view name) const {
+		const auto& locals = m_current->locals;
+		for (int i = static_cast<int>(locals.size()) - 1; i > 0 && locals[i].depth == m_current->scope_depth; i--) {
+			if (locals[i].name == name) return i;
+		}
+		return -1;
+	}
+	bool is_declared_in_scope(std::string_view name) const {
+		return find_in_scope(name) != -1;
+	}
+
+	void add_local(std::string_view name) {
+		auto& locals = m_current->locals;
+		if (locals.size() == LOCALS_MAX) {
+			error("Too many local variables in function.");
+			return;
+		}
+		locals.push_back(Local{name, m_current->scope_depth, false});
+	}
+
+	// Declares a local for the value on top of the stack. Redeclaring a name
+	// in the same scope assigns to the existing local instead
+	void declare_local(std::string_view name) {
+		if (const int slot = find_in_scope(name); slot != -1) {
+			emit(OpCode::SET_LOCAL, static_cast<uint8_t>(slot));
+			emit(OpCode::POP);
+			return;
+		}
+		add_local(name);
+	}
+
+	static int resolve_local(FunctionState* state, std::string_view name) {
+		for (int i = static_cast<int>(state->locals.size()) - 1; i > 0; i--) {
+			if (state->locals[i].name == name) return i;
+		}
+		return -1;
+	}
+
+	int add_upvalue(FunctionState* state, uint8_t index, bool is_local) {
+		auto& upvalues = state->upvalues;
+		for (size_t i = 0; i < upvalues.size(); i++) {
+			if (upvalues[i].index == index && upvalues[i].is_local == is_local) {
+				return static_cast<int>(i);
+			}
+		}
+		if (upvalues.size() == UPVALUES_MAX) {
+			error("Too many closure variables in function.");
+			return 0;
+		}
+		upvalues.push_back(UpvalueRef{index, is_local});
+		return static_cast<int>(upvalues.size() - 1);
+	}
+
+	int resolve_upvalue(FunctionState* state, std::string_view name) {
+		if (!state->enclosing) return -1;
+
+		if (const int local = resolve_local(state->enclosing, name); local != -1) {
+			state->enclosing->locals[local].is_captured = true;
+			return add_upvalue(state, static_cast<uint8_t>(local), true);
+		}
+		if (const int upvalue = resolve_upvalue(state->enclosing, name); upvalue != -1) {
+			return add_upvalue(state, static_cast<uint8_t>(upvalue), false);
+		}
+		return -1;
+	}
+
+	void get_variable(const Token& name) {
+		m_line = name.line();
+		if (const int local = resolve_local(m_current, name.lexeme()); local != -1) {
+			emit(OpCode::GET_LOCAL, static_cast<uint8_t>(local));
+		} else if (const int upvalue = resolve_upvalue(m_current, name.lexeme()); upvalue != -1) {
+			emit(OpCode::GET_UPVALUE, static_cast<uint8_t>(upvalue));
+		} else {
+			emit_global(OpCode::GET_GLOBAL, m_globals.slot(name.lexeme()));
+		}
+	}
+	void set_variable(const Token& name) {
+		m_line = name.line();
+		if (const int local = resolve_local(m_current, name.lexeme()); local != -1) {
+			emit(OpCode::SET_LOCAL, static_cast<uint8_t>(local));
+		} else if (const int upvalue = resolve_upvalue(m_current, name.lexeme()); upvalue != -1) {
+			emit(OpCode::SET_UPVALUE, static_cast<uint8_t>(upvalue));
+		} else {
+			emit_global(OpCode::SET_GLOBAL, m_globals.slot(name.lexeme()));
+		}
+	}
+	// Binds the value on top of the stack to a new variable
+	void define_variable(const Token& name) {
+		m_line = name.line();
+		if (m_current->scope_depth == 0) {
+			emit_global(OpCode::DEFINE_GLOBAL, m_globals.slot(name.lexeme()));
+		} else {
+			declare_local(name.lexeme());
+		}
+	}
+
+	void compile_function(Function* stmt) {
+		auto function = std::make_unique<FunctionProto>(std::string(stmt->name().lexeme()), static_cast<int>(stmt->params().size()));
+		FunctionState state(m_current, function.get());
+		m_current = &state;
+
+		begin_scope();
+		// Arguments are already in place on the stack
+		for (const auto& param : stmt->params()) {
+			add_local(param.lexeme());
+		}
+		compile_all(stmt->body());
+		emit_return();
+
+		m_current = state.enclosing;
+		function->set_upvalue_count(static_cast<int>(state.upvalues.size()));
+
+		const int index = chunk().add_function(std::move(function));
+		emit_short(OpCode::CLOSURE, index);
+		for (const auto& upvalue : state.upvalues) {
+			emit(upvalue.is_local ? 1 : 0);
+			emit(upvalue.index);
+		}
+	}
+
+	void compile_loop_body(const StmtPtr& body) {
+		m_current->loops.push_back(Loop{m_current->scope_depth});
+		compile(body);
+	}
+	// Must be called once the code continue should jump to is next
+	void patch_continues() {
+		for (const auto jump : m_current->loops.back().continue_jumps) {
+			patch_jump(jump);
+		}
+	}
+	void patch_breaks() {
+		for (const auto jump : m_current->loops.back().break_jumps) {
+			patch_jump(jump);
+		}
+		m_current->loops.pop_back();
+	}
+
+	/*
+	 * Statements
+	 */
+	Completion visit_stmt(Block* stmt) override {
+		begin_scope();
+		compile_all(stmt->statements());
+		end_scope();
+		return {};
+	}
+	Completion visit_stmt(Break*) override {
+		auto& loop = m_current->loops.back();
+		discard_locals(loop.scope_depth);
+		loop.break_jumps.push_back(emit_jump(OpCode::JUMP));
+		return {};
+	}
+	Completion visit_stmt(Continue*) override {
+		auto& loop = m_current->loops.back();
+		discard_locals(loop.scope_depth);
+		loop.continue_jumps.push_back(emit_jump(OpCode::JUMP));
+		return {};
+	}
+	Completion visit_stmt(Expression* stmt) override {
+		compile(stmt->expression());
+		emit(OpCode::POP);
+		return {};
+	}
+	Completion visit_stmt(Function* stmt) override {
+		m_line = stmt->name().line();
+		// A new local is declared first so the function can refer to itself,
+		// the closure then lands in the local's slot
+		if (m_current->scope_depth > 0 && !is_declared_in_scope(stmt->name().lexeme())) {
+			add_local(stmt->name().lexeme());
+			compile_function(stmt);
+			return {};
+		}
+		compile_function(stmt);
+		define_variable(stmt->name());
+		return {};
+	}
+	Completion visit_stmt(For* stmt) override {
+		// The initializer is declared in the enclosing scope, like the tree-walker does
+		if (stmt->initializer()) {
+			compile(stmt->initializer());
+		}
+
+		const size_t loop_start = chunk().code().size();
+		size_t exit_jump = 0;
+		if (stmt->condition()) {
+			compile(stmt->condition());
+			exit_jump = emit_jump(OpCode::JUMP_IF_FALSE);
+			emit(OpCode::POP);
+		}
+
+		compile_loop_body(stmt->body());
+		patch_continues();
+		if (stmt->increment()) {
+			compile(stmt->increment());
+			emit(OpCode::POP);
+		}
+		emit_loop(loop_start);
+
+		if (stmt->condition()) {
+			patch_jump(exit_jump);
+			emit(OpCode::POP);
+		}
+		patch_breaks();
+		return {};
+	}
+	Completion visit_stmt(If* stmt) override {
+		compile(stmt->condition());
+		const size_t then_jump = emit_jump(OpCode::JUMP_IF_FALSE);
+		emit(OpCode::POP);
+		compile(stmt->then_branch());
+
+		const size_t else_jump = emit_jump(OpCode::JUMP);
+		patch_jump(then_jump);
+		emit(OpCode::POP);
+		if (stmt->else_branch()) {
+			compile(stmt->else_branch());
+		}
+		patch_jump(else_jump);
+		return {};
+	}
+	Completion visit_stmt(Print* stmt) override {
+		compile(stmt->expression());
+		emit(OpCode::PRINT);
+		return {};
+	}
+	Completion visit_stmt(Return* stmt) override {
+		m_line = stmt->keyword().line();
+		if (stmt->value()) {
+			compile(stmt->value());
+		} else {
+			emit(OpCode::NIL);
+		}
+		emit(OpCode::RETURN);
+		return {};
+	}
+	Completion visit_stmt(Sleep* stmt) override {
+		compile(stmt->expression());
+		m_line = stmt->token().line();
+		emit(OpCode::SLEEP);
+		return {};
+	}
+	Completion visit_stmt(Var* stmt) override {
+		// Compiled before declaring, so `var a = a + 1;` reads the enclosing 'a'
+		if (stmt->initializer()) {
+			compile(stmt->initializer());
+		} else {
+			emit(OpCode::NIL);
+		}
+		define_variable(stmt->name());
+		return {};
+	}
+	Completion visit_stmt(While* stmt) override {
+		const size_t loop_start = chunk().code().size();
+		compile(stmt->condition());
+		const size_t exit_jump = emit_jump(OpCode::JUMP_IF_FALSE);
+		emit(OpCode::POP);
+
+		compile_loop_body(stmt->body());
+		patch_continues();
+		emit_loop(loop_start);
+
+		patch_jump(exit_jump);
+		emit(OpCode::POP);
+		patch_breaks();
+		return {};
+	}
+
+	/*
+	 * Expressions
+	 */
+	Value visit_expr(Assign* expr) override {
+		compile(expr->value());
+		set_variable(expr->name());
+		return nullptr;
+	}
+	Value visit_expr(Binary* expr) override {
+		compile(expr->left());
+		compile(expr->right());
+		m_line = expr->op().line();
+		switch (expr->op().type()) {
+			case TokenType::GREATER: emit(OpCode::GREATER); break;
+			case TokenType::GREATER_EQUAL: emit(OpCode::GREATER_EQUAL); break;
+			case TokenType::LESS: emit(OpCode::LESS); break;
+			case TokenType::LESS_EQUAL: emit(OpCode::LESS_EQUAL); break;
+			case TokenType::BANG_EQUAL: emit(OpCode::NOT_EQUAL); break;
+			case TokenType::EQUAL_EQUAL: emit(OpCode::EQUAL); break;
+			case TokenType::MINUS: emit(OpCode::SUBTRACT); break;
+			case TokenType::PLUS: emit(OpCode::ADD); break;
+			case TokenType::SLASH: emit(OpCode::DIVIDE); break;
+			case TokenType::STAR: emit(OpCode::MULTIPLY); break;
+			default: break;
+		}
+		return nullptr;
+	}
+	Value visit_expr(Call* expr) override {
+		compile(expr->callee());
+		for (const auto& argument : expr->arguments()) {
+			compile(argument);
+		}
+		m_line = expr->paren().line();
+		emit(OpCode::CALL, static_cast<uint8_t>(expr->arguments().size()));
+		return nullptr;
+	}
+	Value visit_expr(Grouping* expr) override {
+		compile(expr->expression());
+		return nullptr;
+	}
+	Value visit_expr(Literal* expr) override {
+		const auto value = expr->value();
+		if (value.is_nil()) {
+			emit(OpCode::NIL);
+		} else if (value.is_bool()) {
+			emit(value.as_bool() ? OpCode::TRUE : OpCode::FALSE);
+		} else {
+			emit_constant(value);
+		}
+		return nullptr;
+	}
+	Value visit_expr(Logical* expr) override {
+		compile(expr->left());
+		if (expr->op().type() == TokenType::OR) {
+			// Short circuit OR if lhs is true
+			const size_t else_jump = emit_jump(OpCode::JUMP_IF_FALSE);
+			const size_t end_jump = emit_jump(OpCode::JUMP);
+			patch_jump(else_jump);
+			emit(OpCode::POP);
+			compile(expr->right());
+			patch_jump(end_jump);
+		} else {
+			// Short circuit AND if lhs false
+			const size_t end_jump = emit_jump(OpCode::JUMP_IF_FALSE);
+			emit(OpCode::POP);
+			compile(expr->right());
+			patch_jump(end_jump);
+		}
+		return nullptr;
+	}
+	Value visit_expr(Unary* expr) override {
+		compile(expr->right());
+		m_line = expr->op().line();
+		switch (expr->op().type()) {
+			case TokenType::BANG: emit(OpCode::NOT); break;
+			case TokenType::MINUS: emit(OpCode::NEGATE); break;
+			default: break;
+		}
+		return nullptr;
+	}
+	Value visit_expr(Variable* expr) override {
+		get_variable(expr->name());
+		return nullptr;
+	}
+
+private:
+	Toy& m_toy;
+	GlobalEnvironment& m_globals;
+	FunctionState* m_current{nullptr};
+	// Line of the last token seen, attached to emitted code for error reporting
+	int m_line{0};
+};
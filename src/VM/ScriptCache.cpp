@@ -0,0 +1,335 @@
+#include "ScriptCache.h"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char MAGIC[4] = { 'T', 'O', 'Y', 'C' };
+
+// FNV-1a, cheap and good enough to name cache files and to notice damaged
+// ones. Hits compare the source itself
+uint64_t fnv1a(std::string_view bytes) {
+	uint64_t hash = 14695981039346656037ull;
+	for (const char c : bytes) {
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Read only view of a whole file, mapped where the platform lets us
+class MappedFile {
+public:
+	MappedFile(const std::string& path) {
+#ifdef _WIN32
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return;
+		m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		m_data = reinterpret_cast<const uint8_t*>(m_buffer.data());
+		m_size = m_buffer.size();
+#else
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		struct stat info{};
+		if (fstat(fd, &info) == 0 && info.st_size > 0) {
+			void* mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED) {
+				m_data = static_cast<const uint8_t*>(mapping);
+				m_size = static_cast<size_t>(info.st_size);
+			}
+		}
+		close(fd);
+#endif
+	}
+	~MappedFile() {
+#ifndef _WIN32
+		if (m_data) munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data() const {
+		return m_data;
+	}
+	size_t size() const {
+		return m_size;
+	}
+private:
+	const uint8_t* m_data{nullptr};
+	size_t m_size{0};
+#ifdef _WIN32
+	std::vector<char> m_buffer{};
+#endif
+};
+
+class Writer {
+public:
+	template<typename T>
+	void write(T value) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+		m_buffer.insert(m_buffer.end(), bytes, bytes + sizeof(T));
+	}
+	void write(std::string_view string) {
+		write(static_cast<uint32_t>(string.size()));
+		m_buffer.insert(m_buffer.end(), string.begin(), string.end());
+	}
+
+	void write(const std::vector<uint8_t>& bytes) {
+		m_buffer.insert(m_buffer.end(), bytes.begin(), bytes.end());
+	}
+
+	void write(const FunctionProto& function) {
+		write(std::string_view(function.name()));
+		write(static_cast<int32_t>(function.arity()));
+		write(static_cast<int32_t>(function.upvalue_count()));
+
+		const auto& chunk = function.chunk();
+		write(static_cast<uint32_t>(chunk.code().size()));
+		m_buffer.insert(m_buffer.end(), chunk.code().begin(), chunk.code().end());
+		// Lines as (line, byte count) runs, most instructions share their line with the previous one
+		const auto& lines = chunk.lines();
+		std::vector<std::pair<int32_t, uint32_t>> runs{};
+		for (const int line : lines) {
+			if (runs.empty() || runs.back().first != line) {
+				runs.emplace_back(line, 0);
+			}
+			runs.back().second++;
+		}
+		write(static_cast<uint32_t>(runs.size()));
+		for (const auto& [line, count] : runs) {
+			write(line);
+			write(count);
+		}
+
+		write(static_cast<uint32_t>(chunk.constants().size()));
+		for (const auto& constant : chunk.constants()) {
+			write(static_cast<uint8_t>(constant.type()));
+			switch (constant.type()) {
+				case Value::Type::NUMBER: write(constant.as_double()); break;
+				case Value::Type::BOOL: write(static_cast<uint8_t>(constant.as_bool())); break;
+				case Value::Type::STRING: write(std::string_view(constant.as_string())); break;
+				default: break;
+			}
+		}
+
+		write(static_cast<uint32_t>(chunk.functions().size()));
+		for (const auto& inner : chunk.functions()) {
+			write(*inner);
+		}
+	}
+
+	const std::vector<uint8_t>& buffer() const {
+		return m_buffer;
+	}
+private:
+	std::vector<uint8_t> m_buffer{};
+};
+
+// Bounds checked decoding, any read past the end marks the reader as failed
+class Reader {
+public:
+	Reader(const uint8_t* data, size_t size) : m_current(data), m_end(data + size) { }
+
+	bool failed() const {
+		return m_failed;
+	}
+	bool at_end() const {
+		return m_current == m_end;
+	}
+	// Everything not read yet
+	std::string_view rest() const {
+		return std::string_view(reinterpret_cast<const char*>(m_current), static_cast<size_t>(m_end - m_current));
+	}
+
+	template<typename T>
+	T read() {
+		T value{};
+		if (!has(sizeof(T))) return value;
+		std::memcpy(&value, m_current, sizeof(T));
+		m_current += sizeof(T);
+		return value;
+	}
+	std::string_view read_string() {
+		const auto size = read<uint32_t>();
+		if (!has(size)) return {};
+		std::string_view string(reinterpret_cast<const char*>(m_current), size);
+		m_current += size;
+		return string;
+	}
+
+	std::unique_ptr<FunctionProto> read_function(Heap& heap) {
+		const auto name = read_string();
+		const auto arity = read<int32_t>();
+		auto function = std::make_unique<FunctionProto>(std::string(name), arity);
+		function->set_upvalue_count(read<int32_t>());
+
+		auto& chunk = function->chunk();
+		const auto code_size = read<uint32_t>();
+		if (!has(code_size)) return nullptr;
+		const uint8_t* code = m_current;
+		m_current += code_size;
+		const auto run_count = read<uint32_t>();
+		uint32_t offset = 0;
+		for (uint32_t i = 0; i < run_count && !m_failed; i++) {
+			const auto line = read<int32_t>();
+			const auto count = read<uint32_t>();
+			if (count > code_size - offset) {
+				m_failed = true;
+				break;
+			}
+			chunk.write(code + offset, count, line);
+			offset += count;
+		}
+		if (m_failed || offset != code_size) return nullptr;
+
+		const auto constant_count = read<uint32_t>();
+		for (uint32_t i = 0; i < constant_count && !m_failed; i++) {
+			Value constant = nullptr;
+			switch (static_cast<Value::Type>(read<uint8_t>())) {
+				case Value::Type::NUMBER: constant = Value(read<double>()); break;
+				case Value::Type::BOOL: constant = Value(read<uint8_t>() != 0); break;
+				// Constants are referenced from the bytecode which isn't traced
+				case Value::Type::STRING: constant = heap.make_literal(std::string(read_string())); break;
+				case Value::Type::NIL: break;
+				default: m_failed = true; break;
+			}
+			// Constants were unique when they were written, so they get their original indices back
+			if (chunk.add_constant(constant) != static_cast<int>(i)) {
+				m_failed = true;
+			}
+		}
+
+		const auto function_count = read<uint32_t>();
+		for (uint32_t i = 0; i < function_count && !m_failed; i++) {
+			auto inner = read_function(heap);
+			if (!inner) return nullptr;
+			chunk.add_function(std::move(inner));
+		}
+		if (m_failed) return nullptr;
+		return function;
+	}
+private:
+	bool has(size_t size) {
+		if (m_failed || static_cast<size_t>(m_end - m_current) < size) {
+			m_failed = true;
+			return false;
+		}
+		return true;
+	}
+
+	const uint8_t* m_current;
+	const uint8_t* m_end;
+	bool m_failed{false};
+};
+
+}
+
+ScriptCache::ScriptCache(std::string directory, std::string_view source, bool optimized)
+	: m_directory(std::move(directory)), m_source(source), m_hash(fnv1a(source)), m_optimized(optimized) { }
+
+std::string ScriptCache::path() const {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.toyc", static_cast<unsigned long long>(m_hash));
+	return (std::filesystem::path(m_directory) / name).string();
+}
+
+std::unique_ptr<FunctionProto> ScriptCache::load(GlobalEnvironment& globals, Heap& heap) const {
+	if (!enabled()) return nullptr;
+
+	const MappedFile file(path());
+	if (!file.data()) return nullptr;
+
+	Reader reader(file.data(), file.size());
+	const auto magic = reader.read<std::array<char, 4>>();
+	if (std::memcmp(magic.data(), MAGIC, sizeof(MAGIC)) != 0
+		|| reader.read<uint32_t>() != FORMAT_VERSION
+		|| reader.read<uint8_t>() != static_cast<uint8_t>(m_optimized)
+		|| reader.read<uint64_t>() != m_hash) {
+		return nullptr;
+	}
+	// Covers everything after it, decoding trusts the code, constant indices and jumps it finds
+	const auto checksum = reader.read<uint64_t>();
+	if (reader.failed() || fnv1a(reader.rest()) != checksum) {
+		return nullptr;
+	}
+	if (reader.read_string() != m_source) {
+		return nullptr;
+	}
+
+	// The bytecode addresses globals by slot, so they have to land in the same slots again
+	const auto global_count = reader.read<uint32_t>();
+	for (uint32_t i = 0; i < global_count && !reader.failed(); i++) {
+		if (globals.slot(reader.read_string()) != static_cast<int>(i)) {
+			return nullptr;
+		}
+	}
+
+	auto script = reader.read_function(heap);
+	if (reader.failed() || !reader.at_end()) {
+		return nullptr;
+	}
+	return script;
+}
+
+void ScriptCache::store(const FunctionProto& script, const GlobalEnvironment& globals) const {
+	if (!enabled()) return;
+
+	Writer payload;
+	payload.write(m_source);
+	payload.write(static_cast<uint32_t>(globals.size()));
+	for (int slot = 0; slot < globals.size(); slot++) {
+		payload.write(std::string_view(globals.name(slot)));
+	}
+	payload.write(script);
+
+	Writer writer;
+	writer.write(std::array<char, 4>{ MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3] });
+	writer.write(FORMAT_VERSION);
+	writer.write(static_cast<uint8_t>(m_optimized));
+	writer.write(m_hash);
+	const auto& bytes = payload.buffer();
+	writer.write(fnv1a(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size())));
+	writer.write(bytes);
+
+	std::error_code error;
+	std::filesystem::create_directories(m_directory, error);
+
+	// Write to a temporary file and rename it over the real one, so runners
+	// starting concurrently never map a half written file
+	const auto target = path();
+	const auto temporary = target + "." + std::to_string(std::random_device{}()) + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		if (!file) return;
+		const auto& buffer = writer.buffer();
+		file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+		if (!file) {
+			file.close();
+			std::filesystem::remove(temporary, error);
+			return;
+		}
+	}
+	std::filesystem::rename(temporary, target, error);
+	if (error) {
+		std::filesystem::remove(temporary, error);
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "Chunk.h"
+#include "../Heap.h"
+#include "../Lexer/Environment.h"
+
+/*
+ * Compiled scripts stored on disk, keyed by a hash of their source.
+ *
+ * A cache file holds the source it was compiled from, the global names in
+ * slot order and the FunctionProto tree of the script, so a hit skips
+ * lexing, parsing and compiling altogether. Files are mapped into memory
+ * and decoded straight from the mapping, the code is copied into fresh
+ * chunks in runs of bytes sharing a line.
+ * Anything that doesn't look exactly right (another format version, a
+ * different source with the same hash, bytecode compiled with the optimizer
+ * on when it is now off or the other way around, a checksum mismatch, a
+ * truncated file) is treated as a miss and gets overwritten. The checksum
+ * catches files damaged on disk, the bytecode itself isn't verified, so the
+ * cache directory has to be as trusted as the scripts.
+ */
+class ScriptCache {
+public:
+	// An empty directory disables the cache. optimized is whether the script
+	// is compiled after running the AST optimizer
+	ScriptCache(std::string directory, std::string_view source, bool optimized);
+
+	bool enabled() const {
+		return !m_directory.empty();
+	}
+
+	// Defines the cached globals in globals and returns the script, nullptr on a miss
+	std::unique_ptr<FunctionProto> load(GlobalEnvironment& globals, Heap& heap) const;
+	// Best effort, failing to write the cache isn't an error for the script
+	void store(const FunctionProto& script, const GlobalEnvironment& globals) const;
+
+private:
+	std::string path() const;
+
+	// Bump whenever the bytecode or the file layout changes
+	static constexpr uint32_t FORMAT_VERSION = 3;
+
+	std::string m_directory{};
+	// Outlived by the source, which the caller keeps for as long as the script runs
+	std::string_view m_source{};
+	uint64_t m_hash{0};
+	bool m_optimized{true};
+};
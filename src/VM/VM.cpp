@@ -0,0 +1,392 @@
+#include "VM.h"
+
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <thread>
+
+#include "../Natives.h"
+
+VM::VM(Toy& toy, Heap& heap) : m_toy(toy), m_heap(heap), m_stack(STACK_MAX) {
+	m_stack_top = m_stack.data();
+	m_heap.add_roots(this);
+	m_globals.define("clock", Value(m_heap.make<ToyClock>()));
+}
+
+VM::~VM() {
+	reset_stack();
+	m_heap.remove_roots(this);
+}
+
+void VM::mark_roots(Heap& heap) {
+	for (const Value* slot = m_stack.data(); slot != m_stack_top; slot++) {
+		heap.mark(*slot);
+	}
+	// An open upvalue stays linked here even once no closure references it
+	for (auto* upvalue = m_open_upvalues; upvalue; upvalue = upvalue->next) {
+		heap.mark(upvalue);
+	}
+	m_globals.mark(heap);
+}
+
+void VM::interpret(FunctionProto* script) {
+	try {
+		push(Value(Value::Type::CLOSURE, m_heap.make<Closure>(script)));
+		call(static_cast<Closure*>(peek(0).as_object()), 0);
+		run();
+	}
+	catch (const RuntimeError& e) {
+		m_toy.runtime_error(e);
+		reset_stack();
+	}
+}
+
+void VM::reset_stack() {
+	close_upvalues(m_stack.data());
+	while (m_stack_top != m_stack.data()) {
+		pop();
+	}
+	m_frame_count = 0;
+}
+
+void VM::runtime_error(const std::string& message) {
+	const auto& frame = m_frames[m_frame_count - 1];
+	const auto& chunk = frame.closure->function()->chunk();
+	const int line = chunk.line(frame.ip - chunk.code().data() - 1);
+	throw RuntimeError(Token(TokenType::TOKEN_EOF, "", line), message);
+}
+
+void VM::call(Closure* closure, int argument_count) {
+	if (argument_count != closure->function()->arity()) {
+		runtime_error("Expected " + std::to_string(closure->function()->arity()) + " arguments but got "
+			+ std::to_string(argument_count) + ".");
+	}
+	if (m_frame_count == FRAMES_MAX || m_stack.data() + STACK_MAX - m_stack_top < FRAME_SLOTS_MIN) {
+		runtime_error("Stack overflow.");
+	}
+
+	auto& frame = m_frames[m_frame_count++];
+	frame.closure = closure;
+	frame.ip = closure->function()->chunk().code().data();
+	frame.slots = m_stack_top - argument_count - 1;
+}
+
+void VM::call_value(const Value& callee, int argument_count) {
+	if (callee.is_closure()) {
+		call(static_cast<Closure*>(callee.as_object()), argument_count);
+		return;
+	}
+	if (callee.is_callable()) {
+		auto* native = callee.as_callable();
+		if (argument_count != native->arity()) {
+			runtime_error("Expected " + std::to_string(native->arity()) + " arguments but got "
+				+ std::to_string(argument_count) + ".");
+		}
+		auto result = native->call(nullptr, { m_stack_top - argument_count, m_stack_top });
+		// Pop the arguments and the callee
+		for (int i = 0; i <= argument_count; i++) {
+			pop();
+		}
+		push(std::move(result));
+		return;
+	}
+	runtime_error("Can only call functions and classes.");
+}
+
+Upvalue* VM::capture_upvalue(Value* local) {
+	Upvalue* previous = nullptr;
+	Upvalue* upvalue = m_open_upvalues;
+	while (upvalue && upvalue->location() > local) {
+		previous = upvalue;
+		upvalue = upvalue->next;
+	}
+	if (upvalue && upvalue->location() == local) {
+		return upvalue;
+	}
+
+	auto* created = m_heap.make<Upvalue>(local);
+	created->next = upvalue;
+	if (previous) {
+		previous->next = created;
+	} else {
+		m_open_upvalues = created;
+	}
+	return created;
+}
+
+void VM::close_upvalues(const Value* last) {
+	while (m_open_upvalues && m_open_upvalues->location() >= last) {
+		auto* upvalue = m_open_upvalues;
+		upvalue->close();
+		m_open_upvalues = upvalue->next;
+	}
+}
+
+// Threaded dispatch needs the labels-as-values extension, anything else gets the switch
+#if defined(TOY_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define TOY_COMPUTED_GOTO 1
+#else
+#define TOY_COMPUTED_GOTO 0
+#endif
+
+#if TOY_COMPUTED_GOTO
+// Handlers in OpCode order, for the dispatch table
+#define TOY_OPCODES(X) \
+	X(CONSTANT) X(NIL) X(TRUE) X(FALSE) X(POP) \
+	X(GET_LOCAL) X(SET_LOCAL) X(GET_GLOBAL) X(DEFINE_GLOBAL) X(SET_GLOBAL) X(GET_UPVALUE) X(SET_UPVALUE) \
+	X(EQUAL) X(NOT_EQUAL) X(GREATER) X(GREATER_EQUAL) X(LESS) X(LESS_EQUAL) \
+	X(ADD) X(SUBTRACT) X(MULTIPLY) X(DIVIDE) X(NOT) X(NEGATE) \
+	X(PRINT) X(SLEEP) \
+	X(JUMP) X(JUMP_IF_FALSE) X(LOOP) \
+	X(CALL) X(CLOSURE) X(CLOSE_UPVALUE) X(RETURN)
+
+namespace {
+constexpr OpCode OPCODE_ORDER[] = {
+#define OPCODE_VALUE(name) OpCode::name,
+	TOY_OPCODES(OPCODE_VALUE)
+#undef OPCODE_VALUE
+};
+constexpr bool opcodes_in_order() {
+	for (size_t i = 0; i < std::size(OPCODE_ORDER); i++) {
+		if (static_cast<size_t>(OPCODE_ORDER[i]) != i) return false;
+	}
+	return std::size(OPCODE_ORDER) == static_cast<size_t>(OpCode::RETURN) + 1;
+}
+static_assert(opcodes_in_order(), "TOY_OPCODES has to list every OpCode in declaration order");
+}
+#endif
+
+void VM::run() {
+	CallFrame* frame = &m_frames[m_frame_count - 1];
+	// The active frame's ip and constants live in locals so they can stay in registers,
+	// ip is written back before anything that looks at frame->ip
+	const uint8_t* ip = frame->ip;
+	const Value* constants = frame->closure->function()->chunk().constants().data();
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (constants[READ_SHORT()])
+// Keeps the cached constant pool in sync with the active frame
+#define LOAD_FRAME() \
+	frame = &m_frames[m_frame_count - 1]; \
+	ip = frame->ip; \
+	constants = frame->closure->function()->chunk().constants().data()
+#define RUNTIME_ERROR(message) \
+	do { \
+		frame->ip = ip; \
+		runtime_error(message); \
+	} while (false)
+#define NUMBER_OPERANDS(op) \
+	do { \
+		if (!peek(0).is_number() || !peek(1).is_number()) { \
+			RUNTIME_ERROR("Operands must be numbers."); \
+		} \
+		const double b = pop().as_double(); \
+		const double a = peek(0).as_double(); \
+		peek(0) = Value(a op b); \
+	} while (false)
+
+#if TOY_COMPUTED_GOTO
+	// Every handler jumps straight to the next one through the table, so each
+	// gets its own indirect branch the predictor can learn
+	static void* const dispatch_table[] = {
+#define LABEL_ADDRESS(name) &&op_##name,
+		TOY_OPCODES(LABEL_ADDRESS)
+#undef LABEL_ADDRESS
+	};
+#define DISPATCH_LOOP goto *dispatch_table[READ_BYTE()];
+#define CASE(name) op_##name
+#define NEXT goto *dispatch_table[READ_BYTE()]
+#else
+#define DISPATCH_LOOP for (;;) switch (static_cast<OpCode>(READ_BYTE()))
+#define CASE(name) case OpCode::name
+#define NEXT break
+#endif
+
+	DISPATCH_LOOP {
+		CASE(CONSTANT):
+			push(READ_CONSTANT());
+			NEXT;
+		CASE(NIL):
+			push(nullptr);
+			NEXT;
+		CASE(TRUE):
+			push(true);
+			NEXT;
+		CASE(FALSE):
+			push(false);
+			NEXT;
+		CASE(POP):
+			pop();
+			NEXT;
+
+		CASE(GET_LOCAL):
+			push(frame->slots[READ_BYTE()]);
+			NEXT;
+		CASE(SET_LOCAL):
+			frame->slots[READ_BYTE()] = peek(0);
+			NEXT;
+		CASE(GET_GLOBAL): {
+			const uint16_t slot = READ_SHORT();
+			if (!m_globals.is_defined(slot)) {
+				RUNTIME_ERROR("Undefined variable '" + m_globals.name(slot) + "'.");
+			}
+			push(m_globals.at(slot));
+			NEXT;
+		}
+		CASE(DEFINE_GLOBAL):
+			m_globals.define(READ_SHORT(), pop());
+			NEXT;
+		CASE(SET_GLOBAL): {
+			const uint16_t slot = READ_SHORT();
+			if (!m_globals.is_defined(slot)) {
+				RUNTIME_ERROR("Undefined Variable '" + m_globals.name(slot) + "'.");
+			}
+			m_globals.at(slot) = peek(0);
+			NEXT;
+		}
+		CASE(GET_UPVALUE):
+			push(frame->closure->upvalues()[READ_BYTE()]->value());
+			NEXT;
+		CASE(SET_UPVALUE):
+			frame->closure->upvalues()[READ_BYTE()]->value() = peek(0);
+			NEXT;
+
+		CASE(EQUAL): {
+			const bool equal = peek(1) == peek(0);
+			pop();
+			peek(0) = Value(equal);
+			NEXT;
+		}
+		CASE(NOT_EQUAL): {
+			const bool equal = peek(1) == peek(0);
+			pop();
+			peek(0) = Value(!equal);
+			NEXT;
+		}
+		CASE(GREATER): NUMBER_OPERANDS(>); NEXT;
+		CASE(GREATER_EQUAL): NUMBER_OPERANDS(>=); NEXT;
+		CASE(LESS): NUMBER_OPERANDS(<); NEXT;
+		CASE(LESS_EQUAL): NUMBER_OPERANDS(<=); NEXT;
+		CASE(SUBTRACT): NUMBER_OPERANDS(-); NEXT;
+		CASE(MULTIPLY): NUMBER_OPERANDS(*); NEXT;
+		CASE(ADD): {
+			if (peek(0).is_number() && peek(1).is_number()) {
+				const double b = pop().as_double();
+				peek(0) = Value(peek(0).as_double() + b);
+			}
+			// Allow either to be strings
+			else if (peek(0).is_string() || peek(1).is_string()) {
+				auto concatenated = peek(1).as_string() + peek(0).as_string();
+				pop();
+				peek(0) = m_heap.make_string(std::move(concatenated));
+			}
+			else {
+				RUNTIME_ERROR("Invalid operands.");
+			}
+			NEXT;
+		}
+		CASE(DIVIDE): {
+			if (!peek(0).is_number() || !peek(1).is_number()) {
+				RUNTIME_ERROR("Operands must be numbers.");
+			}
+			if (peek(0).as_double() == 0.0) {
+				RUNTIME_ERROR("Division by zero.");
+			}
+			const double b = pop().as_double();
+			peek(0) = Value(peek(0).as_double() / b);
+			NEXT;
+		}
+		CASE(NOT): {
+			const auto& value = peek(0);
+			const bool falsey = value.is_nil() || (value.is_bool() && !value.as_bool());
+			peek(0) = Value(falsey);
+			NEXT;
+		}
+		CASE(NEGATE):
+			if (!peek(0).is_number()) {
+				RUNTIME_ERROR("Operand must be a number.");
+			}
+			peek(0) = Value(-peek(0).as_double());
+			NEXT;
+
+		CASE(PRINT):
+			std::cout << pop().to_string() << "\n";
+			NEXT;
+		CASE(SLEEP): {
+			const auto value = pop();
+			if (!value.is_number()) {
+				RUNTIME_ERROR("sleep only accepts numbers");
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds((int)value.as_double()));
+			NEXT;
+		}
+
+		CASE(JUMP): {
+			const uint16_t offset = READ_SHORT();
+			ip += offset;
+			NEXT;
+		}
+		CASE(JUMP_IF_FALSE): {
+			const uint16_t offset = READ_SHORT();
+			const auto& condition = peek(0);
+			if (condition.is_nil() || (condition.is_bool() && !condition.as_bool())) {
+				ip += offset;
+			}
+			NEXT;
+		}
+		CASE(LOOP): {
+			const uint16_t offset = READ_SHORT();
+			ip -= offset;
+			NEXT;
+		}
+
+		CASE(CALL): {
+			const int argument_count = READ_BYTE();
+			frame->ip = ip;
+			call_value(peek(argument_count), argument_count);
+			LOAD_FRAME();
+			NEXT;
+		}
+		CASE(CLOSURE): {
+			auto* function = frame->closure->function()->chunk().functions()[READ_SHORT()].get();
+			auto* closure = m_heap.make<Closure>(function);
+			push(Value(Value::Type::CLOSURE, closure));
+			for (auto& upvalue : closure->upvalues()) {
+				const bool is_local = READ_BYTE();
+				const uint8_t index = READ_BYTE();
+				upvalue = is_local ? capture_upvalue(frame->slots + index) : frame->closure->upvalues()[index];
+			}
+			NEXT;
+		}
+		CASE(CLOSE_UPVALUE):
+			close_upvalues(m_stack_top - 1);
+			pop();
+			NEXT;
+		CASE(RETURN): {
+			auto result = pop();
+			close_upvalues(frame->slots);
+			// Discard the callee, its arguments and locals
+			while (m_stack_top != frame->slots) {
+				pop();
+			}
+			m_frame_count--;
+			if (m_frame_count == 0) {
+				return;
+			}
+			push(std::move(result));
+			LOAD_FRAME();
+			NEXT;
+		}
+	}
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
+#undef NUMBER_OPERANDS
+#undef DISPATCH_LOOP
+#undef CASE
+#undef NEXT
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <array>
+#include <string>
+#include <vector>
+
+#include "Chunk.h"
+#include "../Lexer/Environment.h"
+#include "../Lexer/Errors.h"
+#include "../Upvalue.h"
+#include "../Toy.h"
+
+class Closure final : public Object {
+public:
+	Closure(FunctionProto* function) : m_function(function), m_upvalues(function->upvalue_count(), nullptr) { }
+
+	FunctionProto* function() const {
+		return m_function;
+	}
+	std::vector<Upvalue*>& upvalues() {
+		return m_upvalues;
+	}
+	std::string to_string() const override {
+		if (m_function->name().empty()) return "<script>";
+		return "<fn " + m_function->name() + ">";
+	}
+	void trace(Heap& heap) override {
+		// Upvalues are filled in after the closure is allocated, some may still be missing
+		for (auto* upvalue : m_upvalues) {
+			heap.mark(upvalue);
+		}
+	}
+	size_t size() const override {
+		return sizeof(Closure) + m_upvalues.capacity() * sizeof(Upvalue*);
+	}
+private:
+	FunctionProto* m_function{nullptr};
+	std::vector<Upvalue*> m_upvalues{};
+};
+
+/*
+ * Stack based virtual machine executing the bytecode produced by the Compiler.
+ */
+class VM final : public HeapRoots {
+public:
+	VM(Toy& toy, Heap& heap);
+	~VM() override;
+
+	void interpret(FunctionProto* script);
+
+	GlobalEnvironment& globals() {
+		return m_globals;
+	}
+
+	void mark_roots(Heap& heap) override;
+
+private:
+	struct CallFrame {
+		Closure* closure{nullptr};
+		const uint8_t* ip{nullptr};
+		// First stack slot the function can use, slot 0 holds the callee
+		Value* slots{nullptr};
+	};
+
+	void run();
+
+	void push(Value value) {
+		*m_stack_top++ = std::move(value);
+	}
+	Value pop() {
+		return std::move(*--m_stack_top);
+	}
+	Value& peek(int distance) {
+		return m_stack_top[-1 - distance];
+	}
+
+	void call_value(const Value& callee, int argument_count);
+	void call(Closure* closure, int argument_count);
+	Upvalue* capture_upvalue(Value* local);
+	void close_upvalues(const Value* last);
+	void reset_stack();
+
+	[[noreturn]] void runtime_error(const std::string& message);
+
+	static constexpr int FRAMES_MAX = 1024;
+	static constexpr int STACK_MAX = FRAMES_MAX * 64;
+	// Every call must leave room for the callee's locals and temporaries
+	static constexpr int FRAME_SLOTS_MIN = 512;
+
+private:
+	Toy& m_toy;
+	Heap& m_heap;
+	GlobalEnvironment m_globals{};
+
+	std::vector<Value> m_stack;
+	Value* m_stack_top{nullptr};
+	std::array<CallFrame, FRAMES_MAX> m_frames{};
+	int m_frame_count{0};
+	// Sorted by stack slot, highest first
+	Upvalue* m_open_upvalues{nullptr};
+};
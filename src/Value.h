@@ -1,122 +1,165 @@
-#pragma once
-#include <cassert>
-#include <ostream>
-
-class Value {
-public:
-	Value() { }
-
-	Value(bool value) : m_type(Type::BOOL) {
-		m_value.as_bool = value;
-	}
-	Value(double value) : m_type(Type::NUMBER) {
-		m_value.as_double = value;
-	}
-	Value(float value) : m_type(Type::NUMBER) {
-		m_value.as_double = static_cast<double>(value);
-	}
-	Value(std::string value) : m_str_value(std::move(value)), m_type(Type::STRING) { }
-	Value(void*) : m_type { Type::NIL }{ }
-
-	enum class Type {
-		STRING,
-		BOOL,
-		NUMBER,
-		NIL,
-	};
-
-	bool is_nil() const {
-		return m_type == Type::NIL;
-	}
-	bool is_number() const {
-		return m_type == Type::NUMBER;
-	}
-	bool is_string() const {
-		return m_type == Type::STRING;
-	}
-	bool is_bool() const {
-		return m_type == Type::BOOL;
-	}
-
-	virtual std::string to_string() const {
-		switch (m_type) {
-			case Type::STRING: return "\"" + m_str_value + "\"";
-			case Type::BOOL: return m_value.as_bool ? "true" : "false";
-			case Type::NUMBER: return std::to_string(m_value.as_double);
-			case Type::NIL: return "nil";
-			default: return "unsupported type" ;
-		}
-	}
-
-	double as_double() const {
-		assert(is_number());
-		return m_value.as_double;
-	}
-	bool as_bool() const {
-		assert(is_bool());
-		return m_value.as_bool;
-	}
-	std::string as_string() const {
-		// TODO: Change this behavior? This could lead to hard to spot bugs
-		if (!is_string()) {
-			return stringify();
-		}
-		return m_str_value;
-	}
-
-	bool operator==(const Value& rhs) const {
-		if (is_nil() && rhs.is_nil()) return true;
-		if (is_nil()) return false;
-
-		switch (m_type) {
-			case Type::STRING: return as_string() == rhs.as_string();
-			case Type::BOOL: return as_bool() == rhs.as_bool();
-			case Type::NUMBER: return compare_double(as_double(), rhs.as_double());
-			// throw?
-			default: return false;
-		}
-	}
-private:
-
-	std::string stringify() const {
-		switch (m_type) {
-			case Type::STRING: return m_str_value;
-			case Type::BOOL: return m_value.as_bool ? "true" : "false";
-			case Type::NUMBER: return std::to_string(m_value.as_double);
-			case Type::NIL: return "nil";
-			default: return "unsupported type" ;
-		}
-	}
-	bool compare_double(double a, double b) const {
-		// TODO: fix this
-		return abs(a - b) < std::numeric_limits<double>::min();
-	}
-
-private:
-	union {
-		bool as_bool;
-		double as_double;
-
-		uint64_t encoded;
-	} m_value {.encoded = 0};
-	// TODO: don't use this
-	std::string m_str_value{};
-	Type m_type{Type::NIL};
-};
-
-inline std::ostream& operator<<(std::ostream& os, const Value& value) {
-	return os << value.to_string();
-}
-
-using ValuePtr = std::shared_ptr<Value>;
-
-
-template<typename T, typename... Args>
-inline ValuePtr create_value(Args&&... args) {
-	return std::make_shared<T>(std::forward<Args>(args)...);
-}
-
-template<typename... Args>
-inline ValuePtr create_value(Args&&... args) {
-	return std::make_shared<Value>(std::forward<Args>(args)...);
-}
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cmath>
+#include <limits>
+#include <ostream>
+#include <type_traits>
+#include "Object.h"
+
+// Values are small tagged unions: nil, bools and numbers are stored inline,
+// strings and callables point at an Object owned by the Heap. Values are
+// trivially copyable, the collector decides when the Object goes away.
+class Value {
+public:
+	enum class Type : uint8_t {
+		STRING,
+		BOOL,
+		NUMBER,
+		NIL,
+		CALLABLE,
+		CLOSURE,
+	};
+
+	Value() { }
+
+	Value(bool value) : m_type(Type::BOOL) {
+		m_value.as_bool = value;
+	}
+	Value(double value) : m_type(Type::NUMBER) {
+		m_value.as_double = value;
+	}
+	Value(float value) : m_type(Type::NUMBER) {
+		m_value.as_double = static_cast<double>(value);
+	}
+	Value(ToyString* string) : m_type(Type::STRING) {
+		m_value.as_object = string;
+	}
+	Value(ToyCallable* callable) : m_type(Type::CALLABLE) {
+		m_value.as_object = callable;
+	}
+	// Objects that only one execution engine knows about (e.g. bytecode closures)
+	Value(Type type, Object* object) : m_type(type) {
+		assert(type == Type::CLOSURE);
+		m_value.as_object = object;
+	}
+	Value(std::nullptr_t) : m_type { Type::NIL }{ }
+
+	Type type() const {
+		return m_type;
+	}
+
+	bool is_nil() const {
+		return m_type == Type::NIL;
+	}
+	bool is_number() const {
+		return m_type == Type::NUMBER;
+	}
+	bool is_string() const {
+		return m_type == Type::STRING;
+	}
+	bool is_bool() const {
+		return m_type == Type::BOOL;
+	}
+	bool is_callable() const {
+		return m_type == Type::CALLABLE;
+	}
+	bool is_closure() const {
+		return m_type == Type::CLOSURE;
+	}
+	bool is_object() const {
+		return m_type == Type::STRING || m_type == Type::CALLABLE || m_type == Type::CLOSURE;
+	}
+
+	std::string to_string() const {
+		switch (m_type) {
+			case Type::STRING: return "\"" + string_value() + "\"";
+			case Type::BOOL: return m_value.as_bool ? "true" : "false";
+			case Type::NUMBER: return std::to_string(m_value.as_double);
+			case Type::NIL: return "nil";
+			case Type::CALLABLE:
+			case Type::CLOSURE: return m_value.as_object->to_string();
+			default: return "unsupported type" ;
+		}
+	}
+
+	double as_double() const {
+		assert(is_number());
+		return m_value.as_double;
+	}
+	bool as_bool() const {
+		assert(is_bool());
+		return m_value.as_bool;
+	}
+	std::string as_string() const {
+		// TODO: Change this behavior? This could lead to hard to spot bugs
+		if (!is_string()) {
+			return stringify();
+		}
+		return string_value();
+	}
+	ToyCallable* as_callable() const {
+		assert(is_callable());
+		return static_cast<ToyCallable*>(m_value.as_object);
+	}
+	Object* as_object() const {
+		assert(is_object());
+		return m_value.as_object;
+	}
+
+	bool operator==(const Value& rhs) const {
+		if (m_type != rhs.m_type) return false;
+
+		switch (m_type) {
+			case Type::STRING: return string_value() == rhs.string_value();
+			case Type::BOOL: return as_bool() == rhs.as_bool();
+			case Type::NUMBER: return compare_double(as_double(), rhs.as_double());
+			case Type::NIL: return true;
+			case Type::CALLABLE:
+			case Type::CLOSURE: return m_value.as_object == rhs.m_value.as_object;
+			// throw?
+			default: return false;
+		}
+	}
+	bool operator!=(const Value& rhs) const {
+		return !(*this == rhs);
+	}
+private:
+
+	const std::string& string_value() const {
+		return static_cast<const ToyString*>(m_value.as_object)->value();
+	}
+
+	std::string stringify() const {
+		switch (m_type) {
+			case Type::STRING: return string_value();
+			case Type::BOOL: return m_value.as_bool ? "true" : "false";
+			case Type::NUMBER: return std::to_string(m_value.as_double);
+			case Type::NIL: return "nil";
+			case Type::CALLABLE:
+			case Type::CLOSURE: return m_value.as_object->to_string();
+			default: return "unsupported type" ;
+		}
+	}
+	bool compare_double(double a, double b) const {
+		// TODO: fix this
+		return std::abs(a - b) < std::numeric_limits<double>::min();
+	}
+
+private:
+	union {
+		bool as_bool;
+		double as_double;
+		Object* as_object;
+
+		uint64_t encoded;
+	} m_value {.encoded = 0};
+	Type m_type{Type::NIL};
+};
+
+static_assert(sizeof(Value) == 16, "Value should stay a 16 byte tagged union");
+static_assert(std::is_trivially_copyable_v<Value>, "Values are copied around freely, the Heap owns the objects");
+
+inline std::ostream& operator<<(std::ostream& os, const Value& value) {
+	return os << value.to_string();
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Owns every Expr and Stmt node of a parse.
+ * Nodes are bump allocated into large blocks, so a tree sits mostly
+ * contiguous in memory in the order the parser produced it, and the whole
+ * thing goes away at once when the arena does.
+ */
+class AstArena {
+public:
+	AstArena() = default;
+	AstArena(const AstArena&) = delete;
+	AstArena& operator=(const AstArena&) = delete;
+	~AstArena() {
+		// Tokens and child lists own memory of their own, release it before dropping the blocks
+		for (auto it = m_destructors.rbegin(); it != m_destructors.rend(); ++it) {
+			it->destroy(it->node);
+		}
+	}
+
+	template<typename T, typename... Args>
+	T* make(Args&&... args) {
+		auto* node = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		if constexpr (!std::is_trivially_destructible_v<T>) {
+			m_destructors.push_back({ node, [](void* node) { static_cast<T*>(node)->~T(); } });
+		}
+		return node;
+	}
+
+	size_t bytes_used() const {
+		return m_bytes_used;
+	}
+
+private:
+	void* allocate(size_t size, size_t alignment) {
+		size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+		if (m_blocks.empty() || offset + size > m_block_size) {
+			m_block_size = std::max(BLOCK_SIZE, size);
+			// operator new[] aligns to max_align_t which covers every node
+			m_blocks.push_back(std::make_unique<std::byte[]>(m_block_size));
+			offset = 0;
+		}
+		m_offset = offset + size;
+		m_bytes_used += size;
+		return m_blocks.back().get() + offset;
+	}
+
+	struct Destructor {
+		void* node;
+		void (*destroy)(void*);
+	};
+
+	static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+	std::vector<std::unique_ptr<std::byte[]>> m_blocks{};
+	size_t m_block_size{0};
+	size_t m_offset{0};
+	size_t m_bytes_used{0};
+	std::vector<Destructor> m_destructors{};
+};
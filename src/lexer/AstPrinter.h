@@ -1,38 +1,158 @@
 #pragma once
 #include "Expr.h"
+#include "Stmt.h"
 #include <sstream>
+#include <string>
+#include <vector>
 #include "Parser.h"
+#include "../Heap.h"
 
 
-class AstPrinter final : public ExprVisitor {
+// Expressions print as s-expressions, statements one per line with the
+// statements they contain indented below them
+class AstPrinter final : public ExprVisitor, public StmtVisitor {
 public:
 	template <typename ... Exprs>
-	ValuePtr parenthesize(std::string name, Exprs&& ... exprs) {
+	Value parenthesize(std::string_view name, Exprs&& ... exprs) {
 		std::stringstream ss;
 		ss << "(" << name;
 
 		([&](auto& expr) {
-			ss << " " << expr->accept(this);
+			ss << " " << expr->accept(this).as_string();
 			}(exprs), ...);
 
 		ss << ")";
-		return create_value(ss.str());
+		return m_heap.make_literal(ss.str());
 	}
 
-	ValuePtr print(ExprPtr expr) {
+	Value print(ExprPtr expr) {
 		return expr->accept(this);
 	}
 
-	ValuePtr visit_expr(Binary* expr) override {
+	std::string print(const std::vector<StmtPtr>& statements) {
+		m_out.str({});
+		m_indent = 0;
+		print_statements(statements);
+		return m_out.str();
+	}
+
+	Value visit_expr(Assign* expr) override {
+		return parenthesize("= " + std::string(expr->name().lexeme()), expr->value());
+	}
+	Value visit_expr(Binary* expr) override {
 		return parenthesize(expr->op().lexeme(), expr->left(), expr->right());
 	}
-	ValuePtr visit_expr(Grouping* expr) override {
+	Value visit_expr(Call* expr) override {
+		std::string text = "(call " + print(expr->callee()).as_string();
+		for (const auto& argument : expr->arguments()) {
+			text += " " + print(argument).as_string();
+		}
+		return m_heap.make_literal(text + ")");
+	}
+	Value visit_expr(Grouping* expr) override {
 		return parenthesize("group", expr->expression());
 	}
-	ValuePtr visit_expr(Literal* expr) override {
-		return expr->value();
+	Value visit_expr(Literal* expr) override {
+		// Quoted, so strings can be told apart from the other literals
+		return m_heap.make_literal(expr->value().to_string());
 	}
-	ValuePtr visit_expr(Unary* expr) override {
+	Value visit_expr(Logical* expr) override {
+		return parenthesize(expr->op().lexeme(), expr->left(), expr->right());
+	}
+	Value visit_expr(Unary* expr) override {
 		return parenthesize(expr->op().lexeme(), expr->right());
 	}
+	Value visit_expr(Variable* expr) override {
+		return m_heap.make_literal(std::string(expr->name().lexeme()));
+	}
+
+	Completion visit_stmt(Block* stmt) override {
+		line("block");
+		print_nested(stmt->statements());
+		return {};
+	}
+	Completion visit_stmt(Break*) override {
+		line("break");
+		return {};
+	}
+	Completion visit_stmt(Continue*) override {
+		line("continue");
+		return {};
+	}
+	Completion visit_stmt(Expression* stmt) override {
+		line(text(stmt->expression()));
+		return {};
+	}
+	Completion visit_stmt(Function* stmt) override {
+		std::string params{};
+		for (const auto& param : stmt->params()) {
+			params += (params.empty() ? "" : ", ") + std::string(param.lexeme());
+		}
+		line("fun " + std::string(stmt->name().lexeme()) + "(" + params + ")");
+		print_nested(stmt->body());
+		return {};
+	}
+	Completion visit_stmt(For* stmt) override {
+		line("for " + (stmt->condition() ? text(stmt->condition()) : "") + "; "
+			+ (stmt->increment() ? text(stmt->increment()) : ""));
+		// The initializer runs first, so it's listed before the body
+		std::vector<StmtPtr> nested{};
+		if (stmt->initializer()) nested.push_back(stmt->initializer());
+		nested.push_back(stmt->body());
+		print_nested(nested);
+		return {};
+	}
+	Completion visit_stmt(If* stmt) override {
+		line("if " + text(stmt->condition()));
+		print_nested({ stmt->then_branch() });
+		if (stmt->else_branch()) {
+			line("else");
+			print_nested({ stmt->else_branch() });
+		}
+		return {};
+	}
+	Completion visit_stmt(Print* stmt) override {
+		line("print " + text(stmt->expression()));
+		return {};
+	}
+	Completion visit_stmt(Return* stmt) override {
+		line(stmt->value() ? "return " + text(stmt->value()) : "return");
+		return {};
+	}
+	Completion visit_stmt(Sleep* stmt) override {
+		line("sleep " + text(stmt->expression()));
+		return {};
+	}
+	Completion visit_stmt(Var* stmt) override {
+		const std::string name(stmt->name().lexeme());
+		line(stmt->initializer() ? "var " + name + " = " + text(stmt->initializer()) : "var " + name);
+		return {};
+	}
+	Completion visit_stmt(While* stmt) override {
+		line("while " + text(stmt->condition()));
+		print_nested({ stmt->body() });
+		return {};
+	}
+private:
+	std::string text(ExprPtr expr) {
+		return print(expr).as_string();
+	}
+	void line(const std::string& text) {
+		m_out << std::string(m_indent * 2, ' ') << text << "\n";
+	}
+	void print_statements(const std::vector<StmtPtr>& statements) {
+		for (const auto& statement : statements) {
+			statement->accept(this);
+		}
+	}
+	void print_nested(const std::vector<StmtPtr>& statements) {
+		m_indent++;
+		print_statements(statements);
+		m_indent--;
+	}
+
+	// Nothing here is rooted, so the strings are kept until the printer goes away
+	Heap m_heap{};
+	std::stringstream m_out{};
+	int m_indent{0};
 };
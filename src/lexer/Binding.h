@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+
+// Where the resolver found a variable, the slot annotation next to it indexes
+// into the matching storage
+enum class VariableKind : uint8_t {
+	GLOBAL,		// GlobalEnvironment slot
+	LOCAL,		// slot in the frame of the function being executed
+	UPVALUE,	// index into the upvalues of the function being executed
+};
+
+// How a closure captures one variable when it's created: either a local of
+// the enclosing function's frame or one of the enclosing function's upvalues
+struct UpvalueRef {
+	int index{0};
+	bool is_local{false};
+};
+
+// Declaration an inlined call was expanded from, expressions only point at it
+class Function;
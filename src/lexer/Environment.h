@@ -1,43 +1,101 @@
-#pragma once
-#include <unordered_map>
-#include <string>
-#include "../Value.h"
-
-class Environment {
-public:
-	Environment() = default;
-	Environment(std::shared_ptr<Environment> enclosing) : m_enclosing(enclosing) {}
-	//Environment(Environment&) = delete;
-	//Environment(const Environment&) = delete;
-
-
-	void define(const std::string& name, const ValuePtr& value) {
-		m_values[name] = value;
-	}
-
-	ValuePtr get(Token name) {
-		if (const auto it = m_values.find(name.lexeme()); it != m_values.end()) {
-			return it->second;
-		}
-		if (m_enclosing != nullptr) {
-			return m_enclosing->get(name);
-		}
-		throw RuntimeError(name, "Undefined variable '" + name.lexeme() + "'.");
-	}
-
-	void assign(Token name, ValuePtr value) {
-		if (auto it = m_values.find(name.lexeme()); it != m_values.end()) {
-			it->second = value;
-			return;
-		}
-
-		if (m_enclosing != nullptr) {
-			m_enclosing->assign(name, value);
-			return;
-		}
-		throw RuntimeError(name, "Undefined Variable '" + name.lexeme() + "'.");
-	}
-private:
-	std::unordered_map<std::string, ValuePtr> m_values{};
-	std::shared_ptr<Environment> m_enclosing{nullptr};
-};
\ No newline at end of file
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../Heap.h"
+#include "../Value.h"
+#include "Errors.h"
+
+// Globals are resolved to slots as well, but unlike locals they can be
+// referenced before they are defined (e.g. a function calling one declared
+// further down), so they keep their names around for error reporting.
+class GlobalEnvironment {
+public:
+	// Resolve time: finds or allocates the slot for a global name
+	int slot(std::string_view name) {
+		if (const auto it = m_slots.find(name); it != m_slots.end()) {
+			return it->second;
+		}
+		const int slot = static_cast<int>(m_values.size());
+		m_slots.emplace(name, slot);
+		m_names.emplace_back(name);
+		m_values.emplace_back(nullptr);
+		m_defined.push_back(false);
+		return slot;
+	}
+
+	void define(int slot, Value value) {
+		replacing(slot);
+		m_values[slot] = std::move(value);
+		m_defined[slot] = true;
+	}
+
+	void define(std::string_view name, Value value) {
+		define(slot(name), std::move(value));
+	}
+
+	const Value& get(int slot, const Token& name) {
+		if (!m_defined[slot]) {
+			throw RuntimeError(name, "Undefined variable '" + std::string(name.lexeme()) + "'.");
+		}
+		return m_values[slot];
+	}
+
+	void assign(int slot, const Token& name, Value value) {
+		if (!m_defined[slot]) {
+			throw RuntimeError(name, "Undefined Variable '" + std::string(name.lexeme()) + "'.");
+		}
+		replacing(slot);
+		m_values[slot] = std::move(value);
+	}
+
+	// Changes whenever a global holding a function is overwritten. Call sites
+	// caching a global callee are valid as long as this hasn't changed
+	uint32_t version() const {
+		return m_version;
+	}
+
+	// Unchecked access for callers that report their own errors (the bytecode VM)
+	bool is_defined(int slot) const {
+		return m_defined[slot];
+	}
+	Value& at(int slot) {
+		return m_values[slot];
+	}
+	const std::string& name(int slot) const {
+		return m_names.at(slot);
+	}
+	int size() const {
+		return static_cast<int>(m_values.size());
+	}
+
+	// Globals are roots for the collector
+	void mark(Heap& heap) const {
+		for (const auto& value : m_values) {
+			heap.mark(value);
+		}
+	}
+private:
+	void replacing(int slot) {
+		if (m_values[slot].is_callable()) {
+			m_version++;
+		}
+	}
+
+	// Lets m_slots be searched with a string_view without building a std::string
+	struct NameHash {
+		using is_transparent = void;
+		size_t operator()(std::string_view name) const {
+			return std::hash<std::string_view>{}(name);
+		}
+	};
+
+	std::unordered_map<std::string, int, NameHash, std::equal_to<>> m_slots{};
+	std::vector<std::string> m_names{};
+	std::vector<Value> m_values{};
+	std::vector<bool> m_defined{};
+	// Starts past the version of call sites that never cached anything
+	uint32_t m_version{1};
+};
@@ -11,4 +11,10 @@ private:
 	Token m_token{};
 };
 
+// Ends the script, unlike other runtime errors which the block raising them reports
+class StackOverflowError : public RuntimeError {
+public:
+	StackOverflowError(Token token) : RuntimeError(token, "Stack overflow.") { }
+};
+
 class ParseError : public std::exception { };
@@ -1,200 +1,308 @@
-#pragma once
-#include <cassert>
-#include <memory>
-#include <string>
-
-#include "../Value.h"
-
-#include "Token.h"
-
-class ExprVisitor;
-class Expr {
-public:
-	virtual ValuePtr accept(ExprVisitor * visitor) {
-		assert(false && "Not implemented");
-		return {};
-	}
-};
-
-using ExprPtr = std::shared_ptr<Expr>;
-
-class Assign final : public Expr {
-public:
-	Assign(Token name, ExprPtr value)
-		 : m_name(name), m_value(value) { }
-	ValuePtr accept(ExprVisitor* visitor) override;
-
-	Token name() const {
-		return m_name;
-	}
-	ExprPtr value() const {
-		return m_value;
-	}
-private:
-	Token m_name{};
-	ExprPtr m_value{};
-};
-
-class Binary final : public Expr {
-public:
-	Binary(ExprPtr left, Token op, ExprPtr right)
-		 : m_left(left), m_op(op), m_right(right) { }
-	ValuePtr accept(ExprVisitor* visitor) override;
-
-	ExprPtr left() const {
-		return m_left;
-	}
-	Token op() const {
-		return m_op;
-	}
-	ExprPtr right() const {
-		return m_right;
-	}
-private:
-	ExprPtr m_left{};
-	Token m_op{};
-	ExprPtr m_right{};
-};
-
-class Call final : public Expr {
-public:
-	Call(ExprPtr callee, Token paren, std::vector<ExprPtr> arguments)
-		 : m_callee(callee), m_paren(paren), m_arguments(arguments) { }
-	ValuePtr accept(ExprVisitor* visitor) override;
-
-	ExprPtr callee() const {
-		return m_callee;
-	}
-	Token paren() const {
-		return m_paren;
-	}
-	std::vector<ExprPtr> arguments() const {
-		return m_arguments;
-	}
-private:
-	ExprPtr m_callee{};
-	Token m_paren{};
-	std::vector<ExprPtr> m_arguments{};
-};
-
-class Grouping final : public Expr {
-public:
-	Grouping(ExprPtr expression)
-		 : m_expression(expression) { }
-	ValuePtr accept(ExprVisitor* visitor) override;
-
-	ExprPtr expression() const {
-		return m_expression;
-	}
-private:
-	ExprPtr m_expression{};
-};
-
-class Literal final : public Expr {
-public:
-	Literal(ValuePtr value)
-		 : m_value(value) { }
-	ValuePtr accept(ExprVisitor* visitor) override;
-
-	ValuePtr value() const {
-		return m_value;
-	}
-private:
-	ValuePtr m_value{};
-};
-
-class Logical final : public Expr {
-public:
-	Logical(ExprPtr left, Token op, ExprPtr right)
-		 : m_left(left), m_op(op), m_right(right) { }
-	ValuePtr accept(ExprVisitor* visitor) override;
-
-	ExprPtr left() const {
-		return m_left;
-	}
-	Token op() const {
-		return m_op;
-	}
-	ExprPtr right() const {
-		return m_right;
-	}
-private:
-	ExprPtr m_left{};
-	Token m_op{};
-	ExprPtr m_right{};
-};
-
-class Unary final : public Expr {
-public:
-	Unary(Token op, ExprPtr right)
-		 : m_op(op), m_right(right) { }
-	ValuePtr accept(ExprVisitor* visitor) override;
-
-	Token op() const {
-		return m_op;
-	}
-	ExprPtr right() const {
-		return m_right;
-	}
-private:
-	Token m_op{};
-	ExprPtr m_right{};
-};
-
-class Variable final : public Expr {
-public:
-	Variable(Token name)
-		 : m_name(name) { }
-	ValuePtr accept(ExprVisitor* visitor) override;
-
-	Token name() const {
-		return m_name;
-	}
-private:
-	Token m_name{};
-};
-
-class ExprVisitor {
-public:
-	virtual ValuePtr visit_expr(Assign*) = 0;
-	virtual ValuePtr visit_expr(Binary*) = 0;
-	virtual ValuePtr visit_expr(Call*) = 0;
-	virtual ValuePtr visit_expr(Grouping*) = 0;
-	virtual ValuePtr visit_expr(Literal*) = 0;
-	virtual ValuePtr visit_expr(Logical*) = 0;
-	virtual ValuePtr visit_expr(Unary*) = 0;
-	virtual ValuePtr visit_expr(Variable*) = 0;
-};
-
-inline ValuePtr Assign::accept(ExprVisitor* visitor) {
-	return visitor->visit_expr(this);
-}
-
-inline ValuePtr Binary::accept(ExprVisitor* visitor) {
-	return visitor->visit_expr(this);
-}
-
-inline ValuePtr Call::accept(ExprVisitor* visitor) {
-	return visitor->visit_expr(this);
-}
-
-inline ValuePtr Grouping::accept(ExprVisitor* visitor) {
-	return visitor->visit_expr(this);
-}
-
-inline ValuePtr Literal::accept(ExprVisitor* visitor) {
-	return visitor->visit_expr(this);
-}
-
-inline ValuePtr Logical::accept(ExprVisitor* visitor) {
-	return visitor->visit_expr(this);
-}
-
-inline ValuePtr Unary::accept(ExprVisitor* visitor) {
-	return visitor->visit_expr(this);
-}
-
-inline ValuePtr Variable::accept(ExprVisitor* visitor) {
-	return visitor->visit_expr(this);
-}
-
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../Value.h"
+#include "Binding.h"
+#include "Specialization.h"
+
+#include "Token.h"
+
+class ExprVisitor;
+// Concrete class of a node, lets passes switch over nodes instead of visiting them
+enum class ExprKind : uint8_t {
+	ASSIGN,
+	BINARY,
+	CALL,
+	GROUPING,
+	LITERAL,
+	LOGICAL,
+	UNARY,
+	VARIABLE,
+};
+
+class Expr {
+public:
+	Expr(ExprKind node_kind) : m_node_kind(node_kind) { }
+
+	virtual Value accept(ExprVisitor * visitor) {
+		assert(false && "Not implemented");
+		return {};
+	}
+
+	ExprKind node_kind() const {
+		return m_node_kind;
+	}
+private:
+	ExprKind m_node_kind;
+};
+
+using ExprPtr = Expr*;
+
+class Assign final : public Expr {
+public:
+	Assign(Token name, ExprPtr value)
+		 : Expr(ExprKind::ASSIGN), m_name(std::move(name)), m_value(value) { }
+	Value accept(ExprVisitor* visitor) override;
+
+	const Token& name() const {
+		return m_name;
+	}
+	ExprPtr value() const {
+		return m_value;
+	}
+	VariableKind kind() const {
+		return m_kind;
+	}
+	void set_kind(VariableKind kind) {
+		m_kind = kind;
+	}
+	int slot() const {
+		return m_slot;
+	}
+	void set_slot(int slot) {
+		m_slot = slot;
+	}
+private:
+	Token m_name{};
+	ExprPtr m_value{};
+	VariableKind m_kind{VariableKind::GLOBAL};
+	int m_slot{-1};
+};
+
+class Binary final : public Expr {
+public:
+	Binary(ExprPtr left, Token op, ExprPtr right)
+		 : Expr(ExprKind::BINARY), m_left(left), m_op(std::move(op)), m_right(right) { }
+	Value accept(ExprVisitor* visitor) override;
+
+	ExprPtr left() const {
+		return m_left;
+	}
+	const Token& op() const {
+		return m_op;
+	}
+	ExprPtr right() const {
+		return m_right;
+	}
+	BinarySpecialization specialization() const {
+		return m_specialization;
+	}
+	void set_specialization(BinarySpecialization specialization) {
+		m_specialization = specialization;
+	}
+	bool number_operands() const {
+		return m_number_operands;
+	}
+	void set_number_operands(bool number_operands) {
+		m_number_operands = number_operands;
+	}
+private:
+	ExprPtr m_left{};
+	Token m_op{};
+	ExprPtr m_right{};
+	BinarySpecialization m_specialization{BinarySpecialization::UNINITIALIZED};
+	bool m_number_operands{false};
+};
+
+class Call final : public Expr {
+public:
+	Call(ExprPtr callee, Token paren, std::vector<ExprPtr> arguments)
+		 : Expr(ExprKind::CALL), m_callee(callee), m_paren(std::move(paren)), m_arguments(std::move(arguments)) { }
+	Value accept(ExprVisitor* visitor) override;
+
+	ExprPtr callee() const {
+		return m_callee;
+	}
+	const Token& paren() const {
+		return m_paren;
+	}
+	const std::vector<ExprPtr>& arguments() const {
+		return m_arguments;
+	}
+	bool global_callee() const {
+		return m_global_callee;
+	}
+	void set_global_callee(bool global_callee) {
+		m_global_callee = global_callee;
+	}
+	ToyCallable* cached_callee() const {
+		return m_cached_callee;
+	}
+	void set_cached_callee(ToyCallable* cached_callee) {
+		m_cached_callee = cached_callee;
+	}
+	uint32_t cached_version() const {
+		return m_cached_version;
+	}
+	void set_cached_version(uint32_t cached_version) {
+		m_cached_version = cached_version;
+	}
+	Function* inlined_function() const {
+		return m_inlined_function;
+	}
+	void set_inlined_function(Function* inlined_function) {
+		m_inlined_function = inlined_function;
+	}
+	ExprPtr inlined_body() const {
+		return m_inlined_body;
+	}
+	void set_inlined_body(ExprPtr inlined_body) {
+		m_inlined_body = inlined_body;
+	}
+private:
+	ExprPtr m_callee{};
+	Token m_paren{};
+	std::vector<ExprPtr> m_arguments{};
+	bool m_global_callee{false};
+	ToyCallable* m_cached_callee{nullptr};
+	uint32_t m_cached_version{0};
+	Function* m_inlined_function{nullptr};
+	ExprPtr m_inlined_body{nullptr};
+};
+
+class Grouping final : public Expr {
+public:
+	Grouping(ExprPtr expression)
+		 : Expr(ExprKind::GROUPING), m_expression(expression) { }
+	Value accept(ExprVisitor* visitor) override;
+
+	ExprPtr expression() const {
+		return m_expression;
+	}
+private:
+	ExprPtr m_expression{};
+};
+
+class Literal final : public Expr {
+public:
+	Literal(Value value)
+		 : Expr(ExprKind::LITERAL), m_value(std::move(value)) { }
+	Value accept(ExprVisitor* visitor) override;
+
+	const Value& value() const {
+		return m_value;
+	}
+private:
+	Value m_value{};
+};
+
+class Logical final : public Expr {
+public:
+	Logical(ExprPtr left, Token op, ExprPtr right)
+		 : Expr(ExprKind::LOGICAL), m_left(left), m_op(std::move(op)), m_right(right) { }
+	Value accept(ExprVisitor* visitor) override;
+
+	ExprPtr left() const {
+		return m_left;
+	}
+	const Token& op() const {
+		return m_op;
+	}
+	ExprPtr right() const {
+		return m_right;
+	}
+private:
+	ExprPtr m_left{};
+	Token m_op{};
+	ExprPtr m_right{};
+};
+
+class Unary final : public Expr {
+public:
+	Unary(Token op, ExprPtr right)
+		 : Expr(ExprKind::UNARY), m_op(std::move(op)), m_right(right) { }
+	Value accept(ExprVisitor* visitor) override;
+
+	const Token& op() const {
+		return m_op;
+	}
+	ExprPtr right() const {
+		return m_right;
+	}
+	bool number_operand() const {
+		return m_number_operand;
+	}
+	void set_number_operand(bool number_operand) {
+		m_number_operand = number_operand;
+	}
+private:
+	Token m_op{};
+	ExprPtr m_right{};
+	bool m_number_operand{false};
+};
+
+class Variable final : public Expr {
+public:
+	Variable(Token name)
+		 : Expr(ExprKind::VARIABLE), m_name(std::move(name)) { }
+	Value accept(ExprVisitor* visitor) override;
+
+	const Token& name() const {
+		return m_name;
+	}
+	VariableKind kind() const {
+		return m_kind;
+	}
+	void set_kind(VariableKind kind) {
+		m_kind = kind;
+	}
+	int slot() const {
+		return m_slot;
+	}
+	void set_slot(int slot) {
+		m_slot = slot;
+	}
+private:
+	Token m_name{};
+	VariableKind m_kind{VariableKind::GLOBAL};
+	int m_slot{-1};
+};
+
+class ExprVisitor {
+public:
+	virtual Value visit_expr(Assign*) = 0;
+	virtual Value visit_expr(Binary*) = 0;
+	virtual Value visit_expr(Call*) = 0;
+	virtual Value visit_expr(Grouping*) = 0;
+	virtual Value visit_expr(Literal*) = 0;
+	virtual Value visit_expr(Logical*) = 0;
+	virtual Value visit_expr(Unary*) = 0;
+	virtual Value visit_expr(Variable*) = 0;
+};
+
+inline Value Assign::accept(ExprVisitor* visitor) {
+	return visitor->visit_expr(this);
+}
+
+inline Value Binary::accept(ExprVisitor* visitor) {
+	return visitor->visit_expr(this);
+}
+
+inline Value Call::accept(ExprVisitor* visitor) {
+	return visitor->visit_expr(this);
+}
+
+inline Value Grouping::accept(ExprVisitor* visitor) {
+	return visitor->visit_expr(this);
+}
+
+inline Value Literal::accept(ExprVisitor* visitor) {
+	return visitor->visit_expr(this);
+}
+
+inline Value Logical::accept(ExprVisitor* visitor) {
+	return visitor->visit_expr(this);
+}
+
+inline Value Unary::accept(ExprVisitor* visitor) {
+	return visitor->visit_expr(this);
+}
+
+inline Value Variable::accept(ExprVisitor* visitor) {
+	return visitor->visit_expr(this);
+}
+
@@ -0,0 +1,259 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "AstArena.h"
+#include "Expr.h"
+#include "Stmt.h"
+#include "../Heap.h"
+
+/*
+ * Simplifies the tree between parsing and resolving, for both engines:
+ *	- arithmetic, comparisons and string concatenation on literals are folded into one literal
+ *	- `and`/`or` with a literal lhs is reduced to the side it evaluates to
+ *	- Grouping wrappers are dropped, the shape of the tree already encodes precedence
+ *	- if statements with a literal condition are replaced by the branch that runs
+ *
+ * Operations that fail at runtime (division by zero, "a" - 1, ...) are left
+ * alone so they still report their error if and when they execute.
+ * Nodes are immutable, so changed ones are rebuilt in the arena while
+ * untouched subtrees are shared with the original tree.
+ */
+class Optimizer final : public ExprVisitor, public StmtVisitor {
+public:
+	Optimizer(AstArena& arena, Heap& heap) : m_arena(arena), m_heap(heap) { }
+
+	std::vector<StmtPtr> optimize(const std::vector<StmtPtr>& statements) {
+		std::vector<StmtPtr> optimized{};
+		optimized.reserve(statements.size());
+		for (const auto& statement : statements) {
+			// Statements that can never run are dropped
+			if (auto* result = optimize(statement)) {
+				optimized.push_back(result);
+			}
+		}
+		return optimized;
+	}
+
+private:
+	// Each visit leaves its replacement in m_expr or m_stmt
+	ExprPtr optimize(ExprPtr expr) {
+		expr->accept(this);
+		return m_expr;
+	}
+	StmtPtr optimize(StmtPtr stmt) {
+		stmt->accept(this);
+		return m_stmt;
+	}
+	// Loop bodies and if branches can't be dropped, an empty block stands in for them
+	StmtPtr optimize_body(StmtPtr stmt) {
+		if (auto* result = optimize(stmt)) {
+			return result;
+		}
+		return m_arena.make<Block>(std::vector<StmtPtr>{});
+	}
+
+	static Literal* as_literal(ExprPtr expr) {
+		return expr->node_kind() == ExprKind::LITERAL ? static_cast<Literal*>(expr) : nullptr;
+	}
+	// Same rules as the engines
+	static bool is_truthy(const Value& value) {
+		if (value.is_bool()) return value.as_bool();
+		return !value.is_nil();
+	}
+
+	std::optional<Value> fold(const Token& op, const Value& left, const Value& right) {
+		const bool numbers = left.is_number() && right.is_number();
+		switch (op.type()) {
+			case TokenType::GREATER:
+				if (numbers) return Value(left.as_double() > right.as_double());
+				break;
+			case TokenType::GREATER_EQUAL:
+				if (numbers) return Value(left.as_double() >= right.as_double());
+				break;
+			case TokenType::LESS:
+				if (numbers) return Value(left.as_double() < right.as_double());
+				break;
+			case TokenType::LESS_EQUAL:
+				if (numbers) return Value(left.as_double() <= right.as_double());
+				break;
+			case TokenType::BANG_EQUAL:
+				return Value(left != right);
+			case TokenType::EQUAL_EQUAL:
+				return Value(left == right);
+			case TokenType::MINUS:
+				if (numbers) return Value(left.as_double() - right.as_double());
+				break;
+			case TokenType::PLUS:
+				if (numbers) return Value(left.as_double() + right.as_double());
+				// The AST isn't traced, so folded strings are pinned like the parser's
+				if (left.is_string() || right.is_string()) return m_heap.make_literal(left.as_string() + right.as_string());
+				break;
+			case TokenType::SLASH:
+				if (numbers && right.as_double() != 0.0) return Value(left.as_double() / right.as_double());
+				break;
+			case TokenType::STAR:
+				if (numbers) return Value(left.as_double() * right.as_double());
+				break;
+			default:
+				break;
+		}
+		return std::nullopt;
+	}
+
+	Value visit_expr(Assign* expr) override {
+		auto* value = optimize(expr->value());
+		m_expr = value == expr->value() ? expr : m_arena.make<Assign>(expr->name(), value);
+		return nullptr;
+	}
+	Value visit_expr(Binary* expr) override {
+		auto* left = optimize(expr->left());
+		auto* right = optimize(expr->right());
+		if (auto* lhs = as_literal(left), *rhs = as_literal(right); lhs && rhs) {
+			if (const auto folded = fold(expr->op(), lhs->value(), rhs->value())) {
+				m_expr = m_arena.make<Literal>(*folded);
+				return nullptr;
+			}
+		}
+		m_expr = left == expr->left() && right == expr->right() ? expr : m_arena.make<Binary>(left, expr->op(), right);
+		return nullptr;
+	}
+	Value visit_expr(Call* expr) override {
+		auto* callee = optimize(expr->callee());
+		bool changed = callee != expr->callee();
+		auto arguments = expr->arguments();
+		for (auto& argument : arguments) {
+			auto* optimized = optimize(argument);
+			changed |= optimized != argument;
+			argument = optimized;
+		}
+		m_expr = changed ? m_arena.make<Call>(callee, expr->paren(), std::move(arguments)) : expr;
+		return nullptr;
+	}
+	Value visit_expr(Grouping* expr) override {
+		m_expr = optimize(expr->expression());
+		return nullptr;
+	}
+	Value visit_expr(Literal* expr) override {
+		m_expr = expr;
+		return nullptr;
+	}
+	Value visit_expr(Logical* expr) override {
+		auto* left = optimize(expr->left());
+		auto* right = optimize(expr->right());
+		if (auto* lhs = as_literal(left)) {
+			// `or` stops at a truthy lhs, `and` at a falsey one, either way that's the result
+			const bool short_circuits = (expr->op().type() == TokenType::OR) == is_truthy(lhs->value());
+			m_expr = short_circuits ? left : right;
+			return nullptr;
+		}
+		m_expr = left == expr->left() && right == expr->right() ? expr : m_arena.make<Logical>(left, expr->op(), right);
+		return nullptr;
+	}
+	Value visit_expr(Unary* expr) override {
+		auto* right = optimize(expr->right());
+		if (auto* operand = as_literal(right)) {
+			if (expr->op().type() == TokenType::BANG) {
+				m_expr = m_arena.make<Literal>(Value(!is_truthy(operand->value())));
+				return nullptr;
+			}
+			if (expr->op().type() == TokenType::MINUS && operand->value().is_number()) {
+				m_expr = m_arena.make<Literal>(Value(-operand->value().as_double()));
+				return nullptr;
+			}
+		}
+		m_expr = right == expr->right() ? expr : m_arena.make<Unary>(expr->op(), right);
+		return nullptr;
+	}
+	Value visit_expr(Variable* expr) override {
+		m_expr = expr;
+		return nullptr;
+	}
+
+	Completion visit_stmt(Block* stmt) override {
+		const auto& statements = stmt->statements();
+		auto optimized = optimize(statements);
+		m_stmt = optimized == statements ? stmt : m_arena.make<Block>(std::move(optimized));
+		return {};
+	}
+	Completion visit_stmt(Break* stmt) override {
+		m_stmt = stmt;
+		return {};
+	}
+	Completion visit_stmt(Continue* stmt) override {
+		m_stmt = stmt;
+		return {};
+	}
+	Completion visit_stmt(Expression* stmt) override {
+		auto* expression = optimize(stmt->expression());
+		m_stmt = expression == stmt->expression() ? stmt : m_arena.make<Expression>(expression);
+		return {};
+	}
+	Completion visit_stmt(Function* stmt) override {
+		const auto& body = stmt->body();
+		auto optimized = optimize(body);
+		m_stmt = optimized == body ? stmt : m_arena.make<Function>(stmt->name(), stmt->params(), std::move(optimized));
+		return {};
+	}
+	Completion visit_stmt(For* stmt) override {
+		auto* initializer = stmt->initializer() ? optimize(stmt->initializer()) : nullptr;
+		auto* condition = stmt->condition() ? optimize(stmt->condition()) : nullptr;
+		auto* increment = stmt->increment() ? optimize(stmt->increment()) : nullptr;
+		auto* body = optimize_body(stmt->body());
+		const bool changed = initializer != stmt->initializer() || condition != stmt->condition()
+			|| increment != stmt->increment() || body != stmt->body();
+		m_stmt = changed ? m_arena.make<For>(initializer, condition, increment, body) : stmt;
+		return {};
+	}
+	Completion visit_stmt(If* stmt) override {
+		auto* condition = optimize(stmt->condition());
+		if (auto* literal = as_literal(condition)) {
+			// Only the branch that runs is left, nullptr if there's none
+			if (is_truthy(literal->value())) {
+				m_stmt = optimize(stmt->then_branch());
+			} else {
+				m_stmt = stmt->else_branch() ? optimize(stmt->else_branch()) : nullptr;
+			}
+			return {};
+		}
+		auto* then_branch = optimize_body(stmt->then_branch());
+		auto* else_branch = stmt->else_branch() ? optimize(stmt->else_branch()) : nullptr;
+		const bool changed = condition != stmt->condition() || then_branch != stmt->then_branch()
+			|| else_branch != stmt->else_branch();
+		m_stmt = changed ? m_arena.make<If>(condition, then_branch, else_branch) : stmt;
+		return {};
+	}
+	Completion visit_stmt(Print* stmt) override {
+		auto* expression = optimize(stmt->expression());
+		m_stmt = expression == stmt->expression() ? stmt : m_arena.make<Print>(expression);
+		return {};
+	}
+	Completion visit_stmt(Return* stmt) override {
+		auto* value = stmt->value() ? optimize(stmt->value()) : nullptr;
+		m_stmt = value == stmt->value() ? stmt : m_arena.make<Return>(stmt->keyword(), value);
+		return {};
+	}
+	Completion visit_stmt(Sleep* stmt) override {
+		auto* expression = optimize(stmt->expression());
+		m_stmt = expression == stmt->expression() ? stmt : m_arena.make<Sleep>(stmt->token(), expression);
+		return {};
+	}
+	Completion visit_stmt(Var* stmt) override {
+		auto* initializer = stmt->initializer() ? optimize(stmt->initializer()) : nullptr;
+		m_stmt = initializer == stmt->initializer() ? stmt : m_arena.make<Var>(stmt->name(), initializer);
+		return {};
+	}
+	Completion visit_stmt(While* stmt) override {
+		auto* condition = optimize(stmt->condition());
+		auto* body = optimize_body(stmt->body());
+		m_stmt = condition == stmt->condition() && body == stmt->body() ? stmt : m_arena.make<While>(condition, body);
+		return {};
+	}
+
+private:
+	AstArena& m_arena;
+	Heap& m_heap;
+	ExprPtr m_expr{nullptr};
+	StmtPtr m_stmt{nullptr};
+};
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+
+// What a Binary node has been quickened to by the tree-walker.
+// A node starts out UNINITIALIZED and specializes on the operand types of
+// its first evaluation. Specialized variants check their operand types with
+// a guard and deoptimize to GENERIC for good when it fails.
+enum class BinarySpecialization : uint8_t {
+	UNINITIALIZED,
+	// Mixed or changing operand types, or an operator without a specialized variant
+	GENERIC,
+	NUMBER_ADD,
+	NUMBER_SUBTRACT,
+	NUMBER_MULTIPLY,
+	NUMBER_DIVIDE,
+	NUMBER_GREATER,
+	NUMBER_GREATER_EQUAL,
+	NUMBER_LESS,
+	NUMBER_LESS_EQUAL,
+	STRING_CONCAT,
+};
@@ -1,273 +1,360 @@
-#pragma once
-#include <cassert>
-#include <memory>
-#include <string>
-
-#include "../Value.h"
-
-#include "Token.h"
-
-class StmtVisitor;
-class Stmt {
-public:
-	virtual void accept(StmtVisitor * visitor) {
-		assert(false && "Not implemented");
-	}
-};
-
-using StmtPtr = std::shared_ptr<Stmt>;
-
-class Block final : public Stmt {
-public:
-	Block(std::vector<StmtPtr> statements)
-		 : m_statements(statements) { }
-	void accept(StmtVisitor* visitor) override;
-
-	std::vector<StmtPtr> statements() const {
-		return m_statements;
-	}
-private:
-	std::vector<StmtPtr> m_statements{};
-};
-
-class Break final : public Stmt {
-public:
-	Break() {} 
-	void accept(StmtVisitor* visitor) override;
-
-private:
-};
-
-class Continue final : public Stmt {
-public:
-	Continue() {} 
-	void accept(StmtVisitor* visitor) override;
-
-private:
-};
-
-class Expression final : public Stmt {
-public:
-	Expression(ExprPtr expression)
-		 : m_expression(expression) { }
-	void accept(StmtVisitor* visitor) override;
-
-	ExprPtr expression() const {
-		return m_expression;
-	}
-private:
-	ExprPtr m_expression{};
-};
-
-class Function final : public Stmt {
-public:
-	Function(Token name, std::vector<Token> params, std::vector<StmtPtr> body)
-		 : m_name(name), m_params(params), m_body(body) { }
-	void accept(StmtVisitor* visitor) override;
-
-	Token name() const {
-		return m_name;
-	}
-	std::vector<Token> params() const {
-		return m_params;
-	}
-	std::vector<StmtPtr> body() const {
-		return m_body;
-	}
-private:
-	Token m_name{};
-	std::vector<Token> m_params{};
-	std::vector<StmtPtr> m_body{};
-};
-
-class For final : public Stmt {
-public:
-	For(StmtPtr initializer, ExprPtr condition, ExprPtr increment, StmtPtr body)
-		 : m_initializer(initializer), m_condition(condition), m_increment(increment), m_body(body) { }
-	void accept(StmtVisitor* visitor) override;
-
-	StmtPtr initializer() const {
-		return m_initializer;
-	}
-	ExprPtr condition() const {
-		return m_condition;
-	}
-	ExprPtr increment() const {
-		return m_increment;
-	}
-	StmtPtr body() const {
-		return m_body;
-	}
-private:
-	StmtPtr m_initializer{};
-	ExprPtr m_condition{};
-	ExprPtr m_increment{};
-	StmtPtr m_body{};
-};
-
-class If final : public Stmt {
-public:
-	If(ExprPtr condition, StmtPtr then_branch, StmtPtr else_branch)
-		 : m_condition(condition), m_then_branch(then_branch), m_else_branch(else_branch) { }
-	void accept(StmtVisitor* visitor) override;
-
-	ExprPtr condition() const {
-		return m_condition;
-	}
-	StmtPtr then_branch() const {
-		return m_then_branch;
-	}
-	StmtPtr else_branch() const {
-		return m_else_branch;
-	}
-private:
-	ExprPtr m_condition{};
-	StmtPtr m_then_branch{};
-	StmtPtr m_else_branch{};
-};
-
-class Print final : public Stmt {
-public:
-	Print(ExprPtr expression)
-		 : m_expression(expression) { }
-	void accept(StmtVisitor* visitor) override;
-
-	ExprPtr expression() const {
-		return m_expression;
-	}
-private:
-	ExprPtr m_expression{};
-};
-
-class Return final : public Stmt {
-public:
-	Return(Token keyword, ExprPtr value)
-		 : m_keyword(keyword), m_value(value) { }
-	void accept(StmtVisitor* visitor) override;
-
-	Token keyword() const {
-		return m_keyword;
-	}
-	ExprPtr value() const {
-		return m_value;
-	}
-private:
-	Token m_keyword{};
-	ExprPtr m_value{};
-};
-
-class Sleep final : public Stmt {
-public:
-	Sleep(Token token, ExprPtr expression)
-		 : m_token(token), m_expression(expression) { }
-	void accept(StmtVisitor* visitor) override;
-
-	Token token() const {
-		return m_token;
-	}
-	ExprPtr expression() const {
-		return m_expression;
-	}
-private:
-	Token m_token{};
-	ExprPtr m_expression{};
-};
-
-class Var final : public Stmt {
-public:
-	Var(Token name, ExprPtr initializer)
-		 : m_name(name), m_initializer(initializer) { }
-	void accept(StmtVisitor* visitor) override;
-
-	Token name() const {
-		return m_name;
-	}
-	ExprPtr initializer() const {
-		return m_initializer;
-	}
-private:
-	Token m_name{};
-	ExprPtr m_initializer{};
-};
-
-class While final : public Stmt {
-public:
-	While(ExprPtr condition, StmtPtr body)
-		 : m_condition(condition), m_body(body) { }
-	void accept(StmtVisitor* visitor) override;
-
-	ExprPtr condition() const {
-		return m_condition;
-	}
-	StmtPtr body() const {
-		return m_body;
-	}
-private:
-	ExprPtr m_condition{};
-	StmtPtr m_body{};
-};
-
-class StmtVisitor {
-public:
-	virtual void visit_stmt(Block*) = 0;
-	virtual void visit_stmt(Break*) = 0;
-	virtual void visit_stmt(Continue*) = 0;
-	virtual void visit_stmt(Expression*) = 0;
-	virtual void visit_stmt(Function*) = 0;
-	virtual void visit_stmt(For*) = 0;
-	virtual void visit_stmt(If*) = 0;
-	virtual void visit_stmt(Print*) = 0;
-	virtual void visit_stmt(Return*) = 0;
-	virtual void visit_stmt(Sleep*) = 0;
-	virtual void visit_stmt(Var*) = 0;
-	virtual void visit_stmt(While*) = 0;
-};
-
-inline void Block::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void Break::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void Continue::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void Expression::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void Function::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void For::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void If::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void Print::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void Return::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void Sleep::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void Var::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
-inline void While::accept(StmtVisitor* visitor) {
-	visitor->visit_stmt(this);
-}
-
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../Value.h"
+#include "../Completion.h"
+#include "Binding.h"
+
+#include "Token.h"
+
+class StmtVisitor;
+// Concrete class of a node, lets passes switch over nodes instead of visiting them
+enum class StmtKind : uint8_t {
+	BLOCK,
+	BREAK,
+	CONTINUE,
+	EXPRESSION,
+	FUNCTION,
+	FOR,
+	IF,
+	PRINT,
+	RETURN,
+	SLEEP,
+	VAR,
+	WHILE,
+};
+
+class Stmt {
+public:
+	Stmt(StmtKind node_kind) : m_node_kind(node_kind) { }
+
+	virtual Completion accept(StmtVisitor * visitor) {
+		assert(false && "Not implemented");
+		return {};
+	}
+
+	StmtKind node_kind() const {
+		return m_node_kind;
+	}
+private:
+	StmtKind m_node_kind;
+};
+
+using StmtPtr = Stmt*;
+
+class Block final : public Stmt {
+public:
+	Block(std::vector<StmtPtr> statements)
+		 : Stmt(StmtKind::BLOCK), m_statements(std::move(statements)) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	const std::vector<StmtPtr>& statements() const {
+		return m_statements;
+	}
+	int close_from() const {
+		return m_close_from;
+	}
+	void set_close_from(int close_from) {
+		m_close_from = close_from;
+	}
+private:
+	std::vector<StmtPtr> m_statements{};
+	int m_close_from{-1};
+};
+
+class Break final : public Stmt {
+public:
+	Break()
+		 : Stmt(StmtKind::BREAK) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+private:
+};
+
+class Continue final : public Stmt {
+public:
+	Continue()
+		 : Stmt(StmtKind::CONTINUE) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+private:
+};
+
+class Expression final : public Stmt {
+public:
+	Expression(ExprPtr expression)
+		 : Stmt(StmtKind::EXPRESSION), m_expression(expression) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	ExprPtr expression() const {
+		return m_expression;
+	}
+private:
+	ExprPtr m_expression{};
+};
+
+class Function final : public Stmt {
+public:
+	Function(Token name, std::vector<Token> params, std::vector<StmtPtr> body)
+		 : Stmt(StmtKind::FUNCTION), m_name(std::move(name)), m_params(std::move(params)), m_body(std::move(body)) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	const Token& name() const {
+		return m_name;
+	}
+	const std::vector<Token>& params() const {
+		return m_params;
+	}
+	const std::vector<StmtPtr>& body() const {
+		return m_body;
+	}
+	VariableKind kind() const {
+		return m_kind;
+	}
+	void set_kind(VariableKind kind) {
+		m_kind = kind;
+	}
+	int slot() const {
+		return m_slot;
+	}
+	void set_slot(int slot) {
+		m_slot = slot;
+	}
+	const std::vector<UpvalueRef>& upvalues() const {
+		return m_upvalues;
+	}
+	void set_upvalues(std::vector<UpvalueRef> upvalues) {
+		m_upvalues = std::move(upvalues);
+	}
+	int frame_size() const {
+		return m_frame_size;
+	}
+	void set_frame_size(int frame_size) {
+		m_frame_size = frame_size;
+	}
+private:
+	Token m_name{};
+	std::vector<Token> m_params{};
+	std::vector<StmtPtr> m_body{};
+	VariableKind m_kind{VariableKind::GLOBAL};
+	int m_slot{-1};
+	std::vector<UpvalueRef> m_upvalues{};
+	int m_frame_size{0};
+};
+
+class For final : public Stmt {
+public:
+	For(StmtPtr initializer, ExprPtr condition, ExprPtr increment, StmtPtr body)
+		 : Stmt(StmtKind::FOR), m_initializer(initializer), m_condition(condition), m_increment(increment), m_body(body) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	StmtPtr initializer() const {
+		return m_initializer;
+	}
+	ExprPtr condition() const {
+		return m_condition;
+	}
+	ExprPtr increment() const {
+		return m_increment;
+	}
+	StmtPtr body() const {
+		return m_body;
+	}
+private:
+	StmtPtr m_initializer{};
+	ExprPtr m_condition{};
+	ExprPtr m_increment{};
+	StmtPtr m_body{};
+};
+
+class If final : public Stmt {
+public:
+	If(ExprPtr condition, StmtPtr then_branch, StmtPtr else_branch)
+		 : Stmt(StmtKind::IF), m_condition(condition), m_then_branch(then_branch), m_else_branch(else_branch) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	ExprPtr condition() const {
+		return m_condition;
+	}
+	StmtPtr then_branch() const {
+		return m_then_branch;
+	}
+	StmtPtr else_branch() const {
+		return m_else_branch;
+	}
+private:
+	ExprPtr m_condition{};
+	StmtPtr m_then_branch{};
+	StmtPtr m_else_branch{};
+};
+
+class Print final : public Stmt {
+public:
+	Print(ExprPtr expression)
+		 : Stmt(StmtKind::PRINT), m_expression(expression) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	ExprPtr expression() const {
+		return m_expression;
+	}
+private:
+	ExprPtr m_expression{};
+};
+
+class Return final : public Stmt {
+public:
+	Return(Token keyword, ExprPtr value)
+		 : Stmt(StmtKind::RETURN), m_keyword(std::move(keyword)), m_value(value) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	const Token& keyword() const {
+		return m_keyword;
+	}
+	ExprPtr value() const {
+		return m_value;
+	}
+	bool tail_call() const {
+		return m_tail_call;
+	}
+	void set_tail_call(bool tail_call) {
+		m_tail_call = tail_call;
+	}
+private:
+	Token m_keyword{};
+	ExprPtr m_value{};
+	bool m_tail_call{false};
+};
+
+class Sleep final : public Stmt {
+public:
+	Sleep(Token token, ExprPtr expression)
+		 : Stmt(StmtKind::SLEEP), m_token(std::move(token)), m_expression(expression) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	const Token& token() const {
+		return m_token;
+	}
+	ExprPtr expression() const {
+		return m_expression;
+	}
+private:
+	Token m_token{};
+	ExprPtr m_expression{};
+};
+
+class Var final : public Stmt {
+public:
+	Var(Token name, ExprPtr initializer)
+		 : Stmt(StmtKind::VAR), m_name(std::move(name)), m_initializer(initializer) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	const Token& name() const {
+		return m_name;
+	}
+	ExprPtr initializer() const {
+		return m_initializer;
+	}
+	VariableKind kind() const {
+		return m_kind;
+	}
+	void set_kind(VariableKind kind) {
+		m_kind = kind;
+	}
+	int slot() const {
+		return m_slot;
+	}
+	void set_slot(int slot) {
+		m_slot = slot;
+	}
+private:
+	Token m_name{};
+	ExprPtr m_initializer{};
+	VariableKind m_kind{VariableKind::GLOBAL};
+	int m_slot{-1};
+};
+
+class While final : public Stmt {
+public:
+	While(ExprPtr condition, StmtPtr body)
+		 : Stmt(StmtKind::WHILE), m_condition(condition), m_body(body) { }
+	Completion accept(StmtVisitor* visitor) override;
+
+	ExprPtr condition() const {
+		return m_condition;
+	}
+	StmtPtr body() const {
+		return m_body;
+	}
+private:
+	ExprPtr m_condition{};
+	StmtPtr m_body{};
+};
+
+class StmtVisitor {
+public:
+	virtual Completion visit_stmt(Block*) = 0;
+	virtual Completion visit_stmt(Break*) = 0;
+	virtual Completion visit_stmt(Continue*) = 0;
+	virtual Completion visit_stmt(Expression*) = 0;
+	virtual Completion visit_stmt(Function*) = 0;
+	virtual Completion visit_stmt(For*) = 0;
+	virtual Completion visit_stmt(If*) = 0;
+	virtual Completion visit_stmt(Print*) = 0;
+	virtual Completion visit_stmt(Return*) = 0;
+	virtual Completion visit_stmt(Sleep*) = 0;
+	virtual Completion visit_stmt(Var*) = 0;
+	virtual Completion visit_stmt(While*) = 0;
+};
+
+inline Completion Block::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion Break::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion Continue::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion Expression::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion Function::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion For::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion If::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion Print::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion Return::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion Sleep::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion Var::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
+inline Completion While::accept(StmtVisitor* visitor) {
+	return visitor->visit_stmt(this);
+}
+
@@ -1,166 +1,169 @@
-#pragma once
-
-#include <string>
-#include <vector>
-#include <unordered_map>
-#include "Token.h"
-#include "../Toy.h"
-#include "../Value.h"
-
-
-class Lexer {
-public:
-    Lexer(Toy& toy, std::string source) : m_toy(toy), m_source(std::move(source)) {}
-
-    const std::vector<Token>& scan_tokens() {
-        while (!has_reached_end()) {
-            m_start = m_current;
-            scan_token();
-        }
-        m_tokens.emplace_back(TokenType::TOKEN_EOF, "", nullptr, m_line);
-
-        return m_tokens;
-    }
-
-private:
-    char advance() {
-        return m_source.at(m_current++);
-    }
-
-    bool match(char expected) {
-        if (has_reached_end()) return false;
-        if (m_source.at(m_current) != expected) return false;
-        m_current++;
-        return true;
-    }
-
-    char peek() const {
-        if (has_reached_end()) return '\0';
-        return m_source.at(m_current);
-    }
-
-    char peek_next() const {
-        if (m_current + 1 >= m_source.length()) return '\0';
-        return m_source.at(m_current + 1);
-    }
-
-    // TODO: use stack to allow nested comments
-    void block_comment() {
-        // Advance until we find the closing */
-        while (peek() != '*' && peek_next() != '/' && !has_reached_end()) {
-            // We allow newlines in comment
-            if (peek() == '\n') m_line++;
-            advance();
-        }
-        if (has_reached_end()) {
-            m_toy.error(m_line, "Unterminated string");
-            return;
-        }
-        // Advance closing * /
-        advance();
-        advance();
-
-        std::string value = m_source.substr(m_start + 1, m_current - 1 - m_start);
-        add_token(TokenType::STRING, value);
-    }
-
-    void string() {
-		// Keep track of where the string started for error reporting
-		int original_line = m_line;
-        // Advance until we find the closing "
-        while (peek() != '"' && !has_reached_end()) {
-            // We allow newlines in string
-            if (peek() == '\n') m_line++;
-            advance();
-        }
-        if (has_reached_end()) {
-            m_toy.error(original_line, "Unterminated string");
-            return;
-        }
-        // Advance closing "
-        advance();
-
-        std::string value = m_source.substr(m_start + 1, m_current - 1 - m_start - 1);
-        add_token(TokenType::STRING, value);
-    }
-
-    void number() {
-        while (std::isdigit(peek())) { advance(); }
-
-        if (peek() == '.' && std::isdigit(peek_next())) {
-            advance();
-            while (std::isdigit(peek())) { advance(); }
-        }
-
-        std::string number_str = m_source.substr(m_start, m_current - m_start);
-
-        add_token(TokenType::NUMBER, std::stod(number_str));
-    }
-
-	bool is_alpha(char c) {
-		return std::isalpha(c) || c == '_';
-	}
-    bool is_alphanumeric(char c) {
-        return is_alpha(c) || std::isdigit(c);
-    }
-
-    void identifier() {
-        while (is_alphanumeric(peek())) {
-            advance();
-        }
-        std::string text = m_source.substr(m_start, m_current - m_start);
-        TokenType type = TokenType::IDENTIFIER;
-
-        if (auto it = m_keywords.find(text); it != m_keywords.end()) {
-            type = it->second;
-        }
-
-        add_token(type);
-    }
-
-    void scan_token();
-
-    void add_token(TokenType type) {
-        add_token(type, nullptr);
-    }
-
-    void add_token(TokenType type, Value literal) {
-        std::string text = m_source.substr(m_start, m_current - m_start);
-        m_tokens.emplace_back(type, text, literal, m_line);
-    }
-
-    bool has_reached_end() const {
-        return m_current >= m_source.length();
-    }
-
-private:
-    Toy& m_toy;
-    std::string m_source{};
-    std::vector<Token> m_tokens{};
-
-    int m_start{0};
-    int m_current{0};
-    int m_line{0};
-
-    std::unordered_map<std::string, TokenType> m_keywords{
-            {"and",    TokenType::AND},
-            {"or",     TokenType::OR},
-            {"class",  TokenType::CLASS},
-            {"super",  TokenType::SUPER},
-            {"this",   TokenType::THIS},
-            {"if",     TokenType::IF},
-            {"else",   TokenType::ELSE},
-            {"true",   TokenType::TRUE},
-            {"false",  TokenType::FALSE},
-            {"fun",    TokenType::FUN},
-            {"return", TokenType::RETURN},
-            {"for",    TokenType::FOR},
-            {"while",  TokenType::WHILE},
-            {"break",  TokenType::BREAK},
-            {"continue",  TokenType::CONTINUE},
-            {"var",    TokenType::VAR},
-            {"nil",    TokenType::NIL},
-            {"print",  TokenType::PRINT},
-            {"sleep",  TokenType::SLEEP},
-    };
-};
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Token.h"
+#include "../Toy.h"
+
+// Keyword or IDENTIFIER. Dispatches on the first character (and length where
+// that's ambiguous) so there is at most one string compare per identifier
+constexpr TokenType keyword_type(std::string_view text) {
+    const auto keyword = [text](std::string_view keyword, TokenType type) {
+        return text == keyword ? type : TokenType::IDENTIFIER;
+    };
+    switch (text[0]) {
+        case 'a': return keyword("and", TokenType::AND);
+        case 'b': return keyword("break", TokenType::BREAK);
+        case 'c':
+            if (text.size() == 5) return keyword("class", TokenType::CLASS);
+            return keyword("continue", TokenType::CONTINUE);
+        case 'e': return keyword("else", TokenType::ELSE);
+        case 'f':
+            if (text.size() == 5) return keyword("false", TokenType::FALSE);
+            if (text.size() == 3 && text[1] == 'u') return keyword("fun", TokenType::FUN);
+            return keyword("for", TokenType::FOR);
+        case 'i': return keyword("if", TokenType::IF);
+        case 'n': return keyword("nil", TokenType::NIL);
+        case 'o': return keyword("or", TokenType::OR);
+        case 'p': return keyword("print", TokenType::PRINT);
+        case 'r': return keyword("return", TokenType::RETURN);
+        case 's':
+            if (text.size() == 5 && text[1] == 'u') return keyword("super", TokenType::SUPER);
+            return keyword("sleep", TokenType::SLEEP);
+        case 't':
+            if (text.size() == 4 && text[1] == 'h') return keyword("this", TokenType::THIS);
+            return keyword("true", TokenType::TRUE);
+        case 'v': return keyword("var", TokenType::VAR);
+        case 'w': return keyword("while", TokenType::WHILE);
+    }
+    return TokenType::IDENTIFIER;
+}
+
+static_assert(keyword_type("and") == TokenType::AND && keyword_type("or") == TokenType::OR);
+static_assert(keyword_type("class") == TokenType::CLASS && keyword_type("continue") == TokenType::CONTINUE);
+static_assert(keyword_type("false") == TokenType::FALSE && keyword_type("fun") == TokenType::FUN
+    && keyword_type("for") == TokenType::FOR);
+static_assert(keyword_type("super") == TokenType::SUPER && keyword_type("sleep") == TokenType::SLEEP);
+static_assert(keyword_type("this") == TokenType::THIS && keyword_type("true") == TokenType::TRUE);
+static_assert(keyword_type("fo") == TokenType::IDENTIFIER && keyword_type("format") == TokenType::IDENTIFIER
+    && keyword_type("classy") == TokenType::IDENTIFIER && keyword_type("_if") == TokenType::IDENTIFIER);
+
+class Lexer {
+public:
+    // source isn't copied, the tokens point into it so it has to outlive them
+    Lexer(Toy& toy, std::string_view source) : m_toy(toy), m_source(source) {}
+
+    const std::vector<Token>& scan_tokens() {
+        while (!has_reached_end()) {
+            m_start = m_current;
+            scan_token();
+        }
+        m_tokens.emplace_back(TokenType::TOKEN_EOF, "", m_line);
+
+        return m_tokens;
+    }
+
+private:
+    char advance() {
+        return m_source[m_current++];
+    }
+
+    bool match(char expected) {
+        if (has_reached_end()) return false;
+        if (m_source[m_current] != expected) return false;
+        m_current++;
+        return true;
+    }
+
+    char peek() const {
+        if (has_reached_end()) return '\0';
+        return m_source[m_current];
+    }
+
+    char peek_next() const {
+        if (m_current + 1 >= m_source.length()) return '\0';
+        return m_source[m_current + 1];
+    }
+
+    // TODO: use stack to allow nested comments
+    void block_comment() {
+        // Advance until we find the closing */
+        while (!(peek() == '*' && peek_next() == '/') && !has_reached_end()) {
+            // We allow newlines in comment
+            if (peek() == '\n') m_line++;
+            advance();
+        }
+        if (has_reached_end()) {
+            m_toy.error(m_line, "Unterminated block comment");
+            return;
+        }
+        // Advance closing * /
+        advance();
+        advance();
+    }
+
+    void string() {
+		// Keep track of where the string started for error reporting
+		int original_line = m_line;
+        // Advance until we find the closing "
+        while (peek() != '"' && !has_reached_end()) {
+            // We allow newlines in string
+            if (peek() == '\n') m_line++;
+            advance();
+        }
+        if (has_reached_end()) {
+            m_toy.error(original_line, "Unterminated string");
+            return;
+        }
+        // Advance closing "
+        advance();
+
+        // The lexeme keeps its quotes, the parser strips them when it creates the literal
+        add_token(TokenType::STRING);
+    }
+
+    void number() {
+        while (std::isdigit(peek())) { advance(); }
+
+        if (peek() == '.' && std::isdigit(peek_next())) {
+            advance();
+            while (std::isdigit(peek())) { advance(); }
+        }
+
+        add_token(TokenType::NUMBER);
+    }
+
+	bool is_alpha(char c) {
+		return std::isalpha(c) || c == '_';
+	}
+    bool is_alphanumeric(char c) {
+        return is_alpha(c) || std::isdigit(c);
+    }
+
+    void identifier() {
+        while (is_alphanumeric(peek())) {
+            advance();
+        }
+        add_token(keyword_type(m_source.substr(m_start, m_current - m_start)));
+    }
+
+    void scan_token();
+
+    void add_token(TokenType type) {
+        m_tokens.emplace_back(type, m_source.substr(m_start, m_current - m_start), m_line);
+    }
+
+    bool has_reached_end() const {
+        return m_current >= m_source.length();
+    }
+
+private:
+    Toy& m_toy;
+    std::string_view m_source{};
+    std::vector<Token> m_tokens{};
+
+    int m_start{0};
+    int m_current{0};
+    int m_line{0};
+};
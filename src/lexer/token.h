@@ -1,89 +1,86 @@
-#pragma once
-
-#include <string>
-#include <utility>
-#include <any>
-#include <variant>
-#include "../Value.h"
-
-enum class TokenType {
-    // Single-character tokens
-    LEFT_PAREN, RIGHT_PAREN,
-    LEFT_BRACE, RIGHT_BRACE,
-    COMMA,
-    DOT,
-    MINUS,
-    PLUS,
-    SEMICOLON,
-    SLASH,
-    STAR,
-
-    // One or two character tokens
-    BANG, BANG_EQUAL,
-    EQUAL, EQUAL_EQUAL,
-    GREATER, GREATER_EQUAL,
-    LESS, LESS_EQUAL,
-
-    // Literals
-    IDENTIFIER, STRING, NUMBER,
-
-    // Keywords
-    AND, OR,
-    CLASS, SUPER, THIS,
-    IF, ELSE,
-    TRUE, FALSE, // Also literals
-    FUN, RETURN,
-    FOR, WHILE, BREAK, CONTINUE,
-    VAR,
-    NIL, // Also literal
-
-    PRINT,
-	SLEEP,
-
-    TOKEN_EOF
-};
-
-//enum class Nil {
-//	NIL
-//};
-
-//inline std::ostream& operator<<(std::ostream& os, const Nil&) {
-//	return os << std::string("Nil");
-//}
-
-class Token {
-public:
-    Token(TokenType type, std::string lexeme, Value literal, int line) : m_type(type), m_lexeme(std::move(lexeme)),
-                                                                         m_literal(std::move(literal)),
-                                                                         m_line(line) {}
-	Token() = default;
-
-    [[nodiscard]] TokenType type() const { return m_type; }
-
-    [[nodiscard]] const std::string& lexeme() const {
-        return m_lexeme;
-    }
-    [[nodiscard]] const Value& literal() const {
-        return m_literal;
-    }
-	[[nodiscard]] int line() const {
-		return m_line;
-    }
-
-	[[nodiscard]] bool is_literal() const {
-		return m_type == TokenType::STRING
-			|| m_type == TokenType::NUMBER
-			|| m_type == TokenType::IDENTIFIER
-			|| m_type == TokenType::NIL
-			|| m_type == TokenType::TRUE
-			|| m_type == TokenType::FALSE;
-	}
-
-private:
-    TokenType m_type{TokenType::TOKEN_EOF};
-    std::string m_lexeme{};
-    Value m_literal{};
-    int m_line{-1};
-};
-
+#pragma once
+
+#include <ostream>
+#include <string_view>
+#include <type_traits>
+
+enum class TokenType {
+    // Single-character tokens
+    LEFT_PAREN, RIGHT_PAREN,
+    LEFT_BRACE, RIGHT_BRACE,
+    COMMA,
+    DOT,
+    MINUS,
+    PLUS,
+    SEMICOLON,
+    SLASH,
+    STAR,
+
+    // One or two character tokens
+    BANG, BANG_EQUAL,
+    EQUAL, EQUAL_EQUAL,
+    GREATER, GREATER_EQUAL,
+    LESS, LESS_EQUAL,
+
+    // Literals
+    IDENTIFIER, STRING, NUMBER,
+
+    // Keywords
+    AND, OR,
+    CLASS, SUPER, THIS,
+    IF, ELSE,
+    TRUE, FALSE, // Also literals
+    FUN, RETURN,
+    FOR, WHILE, BREAK, CONTINUE,
+    VAR,
+    NIL, // Also literal
+
+    PRINT,
+	SLEEP,
+
+    TOKEN_EOF
+};
+
+//enum class Nil {
+//	NIL
+//};
+
+//inline std::ostream& operator<<(std::ostream& os, const Nil&) {
+//	return os << std::string("Nil");
+//}
+
+// Tokens are plain records pointing into the source buffer, which Toy::run
+// keeps alive for as long as the tokens and the AST built from them.
+// Literal values are decoded from the lexeme by the parser.
+class Token {
+public:
+    Token(TokenType type, std::string_view lexeme, int line) : m_lexeme(lexeme), m_type(type), m_line(line) {}
+	Token() = default;
+
+    [[nodiscard]] TokenType type() const { return m_type; }
+
+    [[nodiscard]] std::string_view lexeme() const {
+        return m_lexeme;
+    }
+	[[nodiscard]] int line() const {
+		return m_line;
+    }
+
+	[[nodiscard]] bool is_literal() const {
+		return m_type == TokenType::STRING
+			|| m_type == TokenType::NUMBER
+			|| m_type == TokenType::IDENTIFIER
+			|| m_type == TokenType::NIL
+			|| m_type == TokenType::TRUE
+			|| m_type == TokenType::FALSE;
+	}
+
+private:
+    std::string_view m_lexeme{};
+    TokenType m_type{TokenType::TOKEN_EOF};
+    int m_line{-1};
+};
+
+static_assert(std::is_trivially_copyable_v<Token>, "Tokens are copied around freely");
+
 std::ostream& operator<<(std::ostream& os, const Token& token);
\ No newline at end of file
@@ -4,15 +4,112 @@
 #include "Lexer/Lexer.h"
 #include "Lexer/Parser.h"
 #include "Lexer/AstPrinter.h"
+#include "Lexer/Optimizer.h"
 
 #include "../external/magic_enum.hpp"
+#include "AOT/Transpiler.h"
+#include "Interpreter/Inliner.h"
 #include "Interpreter/Interpreter.h"
+#include "Interpreter/Resolver.h"
+#include "Interpreter/TypeInference.h"
+#include "VM/Compiler.h"
+#include "VM/ScriptCache.h"
+#include "VM/VM.h"
 
 void Toy::run(const std::string& source) {
+	// Everything allocated while running the script, declared first so it outlives the tokens and AST
+	Heap heap(m_gc_config);
+	run(source, heap);
+	if (m_gc_stats) {
+		std::cerr << heap.stats() << "\n";
+	}
+}
+
+void Toy::run(const std::string& source, Heap& heap) {
+	if (m_engine == Engine::BYTECODE) {
+		run_bytecode(source, heap);
+		return;
+	}
+
+	// Owns the AST, the interpreter only holds on to nodes while the script runs
+	AstArena arena;
+	auto statements = parse(source, heap, arena);
+	if (m_has_error) {
+		// exit with code 65
+		return;
+	}
+
+	Interpreter interpreter(*this, heap);
+
+	Resolver resolver(interpreter.globals());
+	resolver.resolve(statements);
+	if (m_optimize) {
+		// Both need the slots the resolver assigned
+		Inliner inliner(arena);
+		inliner.inline_calls(statements);
+		if (m_inline_report) {
+			std::cerr << inliner.report();
+		}
+		TypeInference inference;
+		inference.infer(statements, resolver.frame_size());
+	}
+
+	interpreter.interpret(statements, resolver.frame_size());
+	if (m_jit_stats) {
+		std::cerr << interpreter.jit().stats() << "\n";
+	}
+}
+
+void Toy::run_bytecode(const std::string& source, Heap& heap) {
+	VM vm(*this, heap);
+
+	// Unchanged scripts skip the front end and the compiler altogether, unless
+	// the AST is asked for
+	const ScriptCache cache(m_dump_ast ? std::string() : m_cache_dir, source, m_optimize);
+	if (auto script = cache.load(vm.globals(), heap)) {
+		vm.interpret(script.get());
+		return;
+	}
+
+	AstArena arena;
+	auto statements = parse(source, heap, arena);
+	if (m_has_error) {
+		return;
+	}
+
+	Compiler compiler(*this, vm.globals());
+	auto script = compiler.compile(statements);
+	if (m_has_error) {
+		return;
+	}
+	cache.store(*script, vm.globals());
+	vm.interpret(script.get());
+}
+
+bool Toy::transpile(const std::string& source, std::ostream& out) {
+	Heap heap(m_gc_config);
+	AstArena arena;
+	auto statements = parse(source, heap, arena);
+	if (m_has_error) {
+		return false;
+	}
+
+	// Natives come first, the runtime defines them in the same slots
+	GlobalEnvironment globals;
+	globals.slot("clock");
+	Resolver resolver(globals);
+	resolver.resolve(statements);
+
+	Transpiler transpiler(globals);
+	out << transpiler.transpile(statements, resolver.frame_size());
+	return true;
+}
+
+std::vector<StmtPtr> Toy::parse(const std::string& source, Heap& heap, AstArena& arena) {
     Lexer lexer(*this, source);
 
     const auto tokens = lexer.scan_tokens();
-	Parser parser(*this, tokens);
+	Parser parser(*this, tokens, arena, heap);
 	//auto expression = parser.parse();
 
  //   for (const auto& token: tokens) {
@@ -36,18 +133,23 @@ void Toy::run(const std::string& source) {
 
 
 	auto statements = parser.parse();
-
 	if (m_has_error) {
-		// exit with code 65
-		return;
+		return statements;
 	}
 
-	if (m_has_runtime_error) {
-		// exit with code 70
-		return;
+	if (m_dump_ast) {
+		AstPrinter printer{};
+		std::cerr << "-- parsed --\n" << printer.print(statements);
+	}
+	if (m_optimize) {
+		Optimizer optimizer(arena, heap);
+		statements = optimizer.optimize(statements);
+		if (m_dump_ast) {
+			AstPrinter printer{};
+			std::cerr << "-- optimized --\n" << printer.print(statements);
+		}
 	}
-	Interpreter interpreter(*this);
-	interpreter.interpret(statements);
+	return statements;
 }
 
 void Toy::run_prompt() {
@@ -1,35 +1,94 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <iostream>
 
+#include "Heap.h"
+#include "JIT/Jit.h"
 #include "Lexer/Errors.h"
 #include "Lexer/Token.h"
 
+class AstArena;
 class Lexer;
 class Parser;
+class Stmt;
 class Interpreter;
+class Compiler;
+class VM;
 
 
 class Toy {
 public:
+	// Which engine Toy::run executes scripts with
+	enum class Engine {
+		TREE_WALKER,
+		BYTECODE,
+	};
+
 	Toy() = default;
 
+	void set_engine(Engine engine) {
+		m_engine = engine;
+	}
+
+	void set_gc_config(Heap::Config config) {
+		m_gc_config = config;
+	}
+	// Print collector statistics after every run
+	void set_gc_stats(bool enabled) {
+		m_gc_stats = enabled;
+	}
+	// Where the bytecode engine caches compiled scripts, empty to disable
+	void set_cache_dir(std::string directory) {
+		m_cache_dir = std::move(directory);
+	}
+	// Fold constants and drop dead branches before running
+	void set_optimize(bool enabled) {
+		m_optimize = enabled;
+	}
+	// Print which calls the optimizer expanded in place to stderr
+	void set_inline_report(bool enabled) {
+		m_inline_report = enabled;
+	}
+	// Print the tree before and after optimizing to stderr
+	void set_dump_ast(bool enabled) {
+		m_dump_ast = enabled;
+	}
+	// Compile hot functions of the tree-walker to native code
+	void set_jit_config(Jit::Config config) {
+		m_jit_config = config;
+	}
+	// Print what the JIT compiled and how often it ran after every run
+	void set_jit_stats(bool enabled) {
+		m_jit_stats = enabled;
+	}
+
     [[maybe_unused]] void run(const std::string& source);
 
     [[maybe_unused]] void run_prompt();
 
+	// Writes the script as a C++ translation unit for the AOT runtime,
+	// returns false if it doesn't parse
+	bool transpile(const std::string& source, std::ostream& out);
+
     friend Lexer;
 	friend Parser;
 	friend Interpreter;
+	friend Compiler;
+	friend VM;
 private:
+	void run(const std::string& source, Heap& heap);
+	void run_bytecode(const std::string& source, Heap& heap);
+	std::vector<Stmt*> parse(const std::string& source, Heap& heap, AstArena& arena);
+
 	void runtime_error(RuntimeError error);
 
     void error(Token token, std::string message) {
 		if (token.type() == TokenType::TOKEN_EOF) {
 		  report(token.line(), " at end", message);
 		} else {
-		  report(token.line(), " at '" + token.lexeme() + "'", message);
+		  report(token.line(), " at '" + std::string(token.lexeme()) + "'", message);
 		}
 	  }
     void error(int line, const std::string& message) {
@@ -44,4 +103,13 @@ private:
 private:
 	bool m_has_error{ false };
 	bool m_has_runtime_error{ false };
+	Engine m_engine{ Engine::TREE_WALKER };
+	Heap::Config m_gc_config{};
+	bool m_gc_stats{ false };
+	std::string m_cache_dir{};
+	bool m_optimize{ true };
+	bool m_inline_report{ false };
+	bool m_dump_ast{ false };
+	Jit::Config m_jit_config{};
+	bool m_jit_stats{ false };
 };
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Times whole runs of the interpreter on a few fixed workloads, once with the
+ * tree-walker and once with the bytecode VM.
+ * Pass more than one executable to compare builds, e.g. one configured with
+ * -DTOY_THREADED_DISPATCH=ON (or -DTOY_SWITCH_DISPATCH=ON for the
+ * tree-walker) and one with it OFF:
+ *
+ *	benchmark [--runs=N] <cpp_toy_language> [<cpp_toy_language>...]
+ */
+
+struct Workload {
+	std::string name;
+	std::string source;
+};
+
+const std::vector<Workload> workloads{
+	{ "fib", R"(
+fun fib(n) {
+	if (n <= 1) {
+		return n;
+	}
+	return fib(n - 2) + fib(n - 1);
+}
+print fib(27);
+)" },
+	{ "loop", R"(
+var sum = 0;
+for (var i = 0; i < 2000000; i = i + 1) {
+	var x = i * 2;
+	if (x > 10) {
+		sum = sum + x - i;
+	} else {
+		sum = sum - 1;
+	}
+}
+print sum;
+)" },
+	{ "closure", R"(
+fun make_counter() {
+	var count = 0;
+	fun increment() {
+		count = count + 1;
+		return count;
+	}
+	return increment;
+}
+var counter = make_counter();
+var i = 0;
+while (i < 500000) {
+	counter();
+	i = i + 1;
+}
+print counter();
+)" },
+};
+
+struct Engine {
+	std::string name;
+	std::string flags;
+};
+
+const std::vector<Engine> engines{
+	{ "tree-walker", "" },
+	{ "vm", "--vm" },
+};
+
+#ifdef _WIN32
+const std::string null_device = "NUL";
+#else
+const std::string null_device = "/dev/null";
+#endif
+
+double time_run(const std::string& command) {
+	const auto start = std::chrono::steady_clock::now();
+	if (std::system(command.c_str()) != 0) {
+		std::cerr << "Command failed: " << command << "\n";
+		std::exit(1);
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	int runs = 5;
+	std::vector<std::string> executables{};
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg.rfind("--runs=", 0) == 0) {
+			runs = std::max(1, std::stoi(arg.substr(7)));
+		} else {
+			executables.push_back(arg);
+		}
+	}
+	if (executables.empty()) {
+		std::cerr << "Usage: benchmark [--runs=N] <cpp_toy_language> [<cpp_toy_language>...]\n";
+		return 64;
+	}
+
+	const auto directory = std::filesystem::temp_directory_path() / "toy_benchmark";
+	std::filesystem::create_directories(directory);
+
+	std::cout << std::left << std::setw(10) << "workload" << std::setw(14) << "engine" << std::setw(10) << "min (s)"
+		<< std::setw(12) << "median (s)" << "executable\n";
+	for (const auto& workload : workloads) {
+		const auto script = directory / (workload.name + ".toy");
+		std::ofstream(script) << workload.source;
+
+		for (const auto& engine : engines) {
+			for (const auto& executable : executables) {
+				const auto command = "\"" + executable + "\" " + engine.flags + " \"" + script.string() + "\" > " + null_device;
+				std::vector<double> times{};
+				for (int run = 0; run < runs; run++) {
+					times.push_back(time_run(command));
+				}
+				std::sort(times.begin(), times.end());
+				std::cout << std::setw(10) << workload.name << std::setw(14) << engine.name
+					<< std::fixed << std::setprecision(3) << std::setw(10) << times.front()
+					<< std::setw(12) << times[times.size() / 2] << executable << "\n";
+			}
+		}
+	}
+	return 0;
+}
@@ -40,7 +40,22 @@ std::string str_lower(std::string data) {
 	std::transform(data.begin(), data.end(), data.begin(), [](unsigned char c) {return std::tolower(c); });
 	return data;
 }
-void define_type(std::fstream& f, std::string base_name, std::string return_type, std::string class_name, std::string field_list) {
+std::string str_upper(std::string data) {
+	std::transform(data.begin(), data.end(), data.begin(), [](unsigned char c) {return std::toupper(c); });
+	return data;
+}
+// Tokens, values and containers are handed out by const reference and moved
+// into the node, pointers, enums and numbers are simply copied
+bool is_class_type(const std::string& type) {
+	return type == "Token" || type == "Value" || type.rfind("std::", 0) == 0;
+}
+std::string getter_type(const std::string& type) {
+	return is_class_type(type) ? "const " + type + "&" : type;
+}
+std::string move_if_class(const std::string& type, const std::string& name) {
+	return is_class_type(type) ? "std::move(" + name + ")" : name;
+}
+void define_type(std::fstream& f, std::string base_name, std::string return_type, std::string class_name, std::string field_list, std::string annotation_list) {
 	// class [class_name] final : [base_name] {
 	f << "class " << class_name << " final : public " << base_name << " {\n";
 	f << "public:\n";
@@ -54,22 +69,18 @@ void define_type(std::fstream& f, std::string base_name, std::string return_type
 		const auto& field = fields.at(i);
 		f << field << (i == fields.size() - 1 ? "" : ",");
 	}
-	if (!fields.empty()) {
-		f << ")\n";
-		// Indent
-		f << "\t\t : ";
-
-		// Initialize fields
-		for (size_t i = 0; i < fields.size(); i++) {
-			const auto& field = fields.at(i);
-			std::string field_name = split(field, " ").at(1);
-			f << "m_" << field_name << "(" << field_name << ")" << (i == fields.size() - 1 ? "" : ", ");
-		}
-		f << " { }\n";
-	}
-	else {
-		f << ") {} \n";
+	f << ")\n";
+	// Indent
+	f << "\t\t : " << base_name << "(" << base_name << "Kind::" << str_upper(class_name) << ")";
+
+	// Initialize fields
+	for (const auto& field : fields) {
+		const auto field_components = split(field, " ");
+		const auto field_type = field_components.at(0);
+		const auto field_name = field_components.at(1);
+		f << ", m_" << field_name << "(" << move_if_class(field_type, field_name) << ")";
 	}
+	f << " { }\n";
 
 
 	// Accept override
@@ -81,11 +92,28 @@ void define_type(std::fstream& f, std::string base_name, std::string return_type
 		const auto field_type = field_components.at(0);
 		const auto field_name = field_components.at(1);
 		
-		f << "\t" << field_type << " " << field_name << "() const {\n";
+		f << "\t" << getter_type(field_type) << " " << field_name << "() const {\n";
 		f << "\t\treturn m_" << field_name << ";\n";
 		f << "\t}\n";
 	}
 
+	// Annotations are filled in by later passes (e.g. the resolver), so they
+	// aren't part of the constructor and get a setter as well as a getter.
+	// [type] [name] = [default]
+	const auto annotations = split(annotation_list, ";");
+	for (const auto& annotation : annotations) {
+		const auto annotation_components = split(annotation, " ");
+		const auto annotation_type = annotation_components.at(0);
+		const auto annotation_name = annotation_components.at(1);
+
+		f << "\t" << getter_type(annotation_type) << " " << annotation_name << "() const {\n";
+		f << "\t\treturn m_" << annotation_name << ";\n";
+		f << "\t}\n";
+		f << "\tvoid set_" << annotation_name << "(" << annotation_type << " " << annotation_name << ") {\n";
+		f << "\t\tm_" << annotation_name << " = " << move_if_class(annotation_type, annotation_name) << ";\n";
+		f << "\t}\n";
+	}
+
 	// Field declarations
 	f << "private:\n";
 	for (const auto& field : fields) {
@@ -95,17 +123,31 @@ void define_type(std::fstream& f, std::string base_name, std::string return_type
 		
 		f << "\t" << field_type << " m_" << field_name << "{};\n";
 	}
+	for (const auto& annotation : annotations) {
+		const auto annotation_components = split(annotation, " ");
+		const auto annotation_type = annotation_components.at(0);
+		const auto annotation_name = annotation_components.at(1);
+		const auto annotation_default = annotation_components.size() > 3 ? annotation_components.at(3) : "";
+
+		f << "\t" << annotation_type << " m_" << annotation_name << "{" << annotation_default << "};\n";
+	}
 
 	f << "};\n\n";
 }
-void define_start(std::fstream& f, std::string base_name) {
+void define_start(std::fstream& f, std::string base_name, const std::vector<std::string>& includes) {
 	// #pragma once
 	f << "#pragma once\n";
 	f << "#include <cassert>\n";
+	f << "#include <cstdint>\n";
 	//f << "#include <variant>\n";
-	f << "#include <memory>\n";
-	f << "#include <string>\n\n";
-	f << "#include \"../Value.h\"\n\n";
+	f << "#include <string>\n";
+	f << "#include <utility>\n";
+	f << "#include <vector>\n\n";
+	f << "#include \"../Value.h\"\n";
+	for (const auto& include : includes) {
+		f << "#include \"" << include << "\"\n";
+	}
+	f << "\n";
 	// #include "token.h"
 	f << "#include \"Token.h\"\n\n";
 	//f << "namespace " << base_name << " {\n\n";
@@ -114,23 +156,41 @@ void define_start(std::fstream& f, std::string base_name) {
 void define_end(std::fstream& f) {
 	//f << "}\n";
 }
+void define_kind_enum(std::fstream& f, std::string base_name, const std::vector<std::string>& types) {
+	// enum class [base_name]Kind : uint8_t {
+	f << "// Concrete class of a node, lets passes switch over nodes instead of visiting them\n";
+	f << "enum class " << base_name << "Kind : uint8_t {\n";
+	for (std::string type : types) {
+		std::string class_name = split(type, "|")[0];
+		trim(class_name);
+		f << "\t" << str_upper(class_name) << ",\n";
+	}
+	f << "};\n\n";
+}
 void define_base_class(std::fstream& f, std::string base_name, std::string return_type) {
 
 	// class [base_name] {
 	f << "class " << base_name << " {\n";
 	f << "public:\n";
+	f << "\t" << base_name << "(" << base_name << "Kind node_kind) : m_node_kind(node_kind) { }\n\n";
 	f << "\tvirtual " << return_type << " accept(" << base_name << "Visitor * visitor) {\n";
-	f << "\t\tassert(false, \"Not implemented\");\n";
+	f << "\t\tassert(false && \"Not implemented\");\n";
 	if (return_type != "void") {
 		f << "\t\treturn {};\n";
 	}
+	f << "\t}\n\n";
+
+	f << "\t" << base_name << "Kind node_kind() const {\n";
+	f << "\t\treturn m_node_kind;\n";
 	f << "\t}\n";
+	f << "private:\n";
+	f << "\t" << base_name << "Kind m_node_kind;\n";
 
 	// }
 	f << "};\n\n";
 
-	// Define Ptr
-	f << "using " << base_name << "Ptr = std::shared_ptr<" << base_name << ">;\n\n";
+	// Define Ptr, nodes are owned by the AstArena they were parsed into
+	f << "using " << base_name << "Ptr = " << base_name << "*;\n\n";
 }
 
 void define_base_visitor(std::fstream& f, std::string base_name, std::string return_type, std::vector<std::string> types) {
@@ -162,7 +222,7 @@ void define_visitors_accept(std::fstream& f, std::string base_name, std::string
 	}
 }
 
-void define_ast(const std::string& output_dir, std::string base_name, std::string return_type, const std::vector<std::string>& types) {
+void define_ast(const std::string& output_dir, std::string base_name, std::string return_type, const std::vector<std::string>& types, const std::vector<std::string>& includes = {}) {
 	std::string path = output_dir + "/" + base_name + ".h";
 	std::fstream f(path, std::fstream::out);
 	if (!f.is_open()) {
@@ -172,8 +232,9 @@ void define_ast(const std::string& output_dir, std::string base_name, std::strin
 		return;
 	}
 
-	define_start(f, base_name);
+	define_start(f, base_name, includes);
 
+	define_kind_enum(f, base_name, types);
 	define_base_class(f, base_name, return_type);
 
 	for (std::string type : types) {
@@ -181,7 +242,10 @@ void define_ast(const std::string& output_dir, std::string base_name, std::strin
 		trim(class_name);
 		std::string fields = split(type, "|")[1];
 		trim(fields);
-		define_type(f, base_name, return_type, class_name, fields);
+		const auto parts = split(type, "|");
+		std::string annotations = parts.size() > 2 ? parts[2] : "";
+		trim(annotations);
+		define_type(f, base_name, return_type, class_name, fields, annotations);
 	}
 
 	define_base_visitor(f, base_name, return_type, types);
@@ -194,29 +258,29 @@ int main() {
 
 	static auto output_dir = R"(G:\repos\cpp_toy_language\src\lexer)";
 
-	define_ast(output_dir, "Expr", "ValuePtr", std::vector<std::string>{
-		"Assign   | Token name; ExprPtr value",
-		"Binary   | ExprPtr left; Token op; ExprPtr right",
-		"Call     | ExprPtr callee; Token paren; std::vector<ExprPtr> arguments",
+	define_ast(output_dir, "Expr", "Value", std::vector<std::string>{
+		"Assign   | Token name; ExprPtr value | VariableKind kind = VariableKind::GLOBAL; int slot = -1",
+		"Binary   | ExprPtr left; Token op; ExprPtr right | BinarySpecialization specialization = BinarySpecialization::UNINITIALIZED; bool number_operands = false",
+		"Call     | ExprPtr callee; Token paren; std::vector<ExprPtr> arguments | bool global_callee = false; ToyCallable* cached_callee = nullptr; uint32_t cached_version = 0; Function* inlined_function = nullptr; ExprPtr inlined_body = nullptr",
 		"Grouping | ExprPtr expression",
-		"Literal  | ValuePtr value",
+		"Literal  | Value value",
 		"Logical  | ExprPtr left; Token op; ExprPtr right",
-		"Unary    | Token op; ExprPtr right",
-		"Variable | Token name"
-	});
-	define_ast(output_dir, "Stmt", "void", std::vector<std::string>{
-		"Block		| std::vector<StmtPtr> statements",
+		"Unary    | Token op; ExprPtr right | bool number_operand = false",
+		"Variable | Token name | VariableKind kind = VariableKind::GLOBAL; int slot = -1"
+	}, { "Binding.h", "Specialization.h" });
+	define_ast(output_dir, "Stmt", "Completion", std::vector<std::string>{
+		"Block		| std::vector<StmtPtr> statements | int close_from = -1",
 		"Break		| ",
 		"Continue	| ",
 		"Expression	| ExprPtr expression",
-		"Function   | Token name; std::vector<Token> params; std::vector<StmtPtr> body",
+		"Function   | Token name; std::vector<Token> params; std::vector<StmtPtr> body | VariableKind kind = VariableKind::GLOBAL; int slot = -1; std::vector<UpvalueRef> upvalues; int frame_size = 0",
 		"For		| StmtPtr initializer; ExprPtr condition; ExprPtr increment; StmtPtr body",
 		"If			| ExprPtr condition; StmtPtr then_branch; StmtPtr else_branch",
 		"Print		| ExprPtr expression",
-		"Return     | Token keyword; ExprPtr value",
+		"Return     | Token keyword; ExprPtr value | bool tail_call = false",
 		"Sleep		| Token token; ExprPtr expression",
-		"Var		| Token name; ExprPtr initializer",
+		"Var		| Token name; ExprPtr initializer | VariableKind kind = VariableKind::GLOBAL; int slot = -1",
 		"While      | ExprPtr condition; StmtPtr body"
-	});
+	}, { "../Completion.h", "Binding.h" });
 	return 0;
 }
@@ -0,0 +1,200 @@
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Checks that the JIT doesn't change what scripts do.
+ * Every workload is run once with --no-jit and once with every function
+ * compiled on its first call, the printed output (errors included) has to
+ * be the same. The workloads stay within what the JIT compiles and poke at
+ * its guards: bad argument types, division by zero, a rebound global,
+ * NaN comparisons and recursion deep enough to run out of native stack.
+ * Neither run may crash, which also covers expressions too long to parse.
+ *
+ *	jit_check <cpp_toy_language>
+ */
+
+struct Workload {
+	std::string name;
+	std::string source;
+};
+
+// A left associative chain of terms additions, as deep as it is long
+static std::string chain(int terms) {
+	std::string expression = "1";
+	for (int i = 1; i < terms; i++) {
+		expression += " + 1";
+	}
+	return expression;
+}
+
+const std::vector<Workload> workloads{
+	{ "fib", R"(
+fun fib(n) {
+	if (n <= 1) {
+		return n;
+	}
+	return fib(n - 2) + fib(n - 1);
+}
+for (var i = 0; i < 20; i = i + 1) {
+	print fib(i);
+}
+)" },
+	{ "loops", R"(
+fun iterative_fib(n) {
+	var a = 0;
+	var b = 1;
+	for (var i = 0; i < n; i = i + 1) {
+		var tmp = a;
+		a = b;
+		b = tmp + b;
+	}
+	return a;
+}
+fun skip(n) {
+	var sum = 0;
+	var i = 0;
+	while (true) {
+		i = i + 1;
+		if (i > n) break;
+		if (i == 3 or i == 7) continue;
+		sum = sum + i;
+	}
+	return sum;
+}
+fun nested(n) {
+	var count = 0;
+	for (var i = 0; i < n; i = i + 1) {
+		for (var j = 0; j < i; j = j + 1) {
+			if (!(j < 3) and j != 5) count = count + 1;
+			else count = count - 0.5;
+		}
+	}
+	return count;
+}
+print iterative_fib(70);
+print skip(100);
+print nested(20);
+print -nested(3);
+)" },
+	{ "tail_calls", R"(
+fun count(n, acc) {
+	if (n <= 0) return acc;
+	return count(n - 1, acc + 1);
+}
+fun swap(a, b, n) {
+	if (n == 0) return a - b;
+	return swap(b, a, n - 1);
+}
+print count(100000, 0);
+print swap(1, 2, 11);
+)" },
+	{ "guards", R"(
+fun add(a, b) {
+	return a + b;
+}
+fun half(n) {
+	return n / 2;
+}
+fun divide(a, b) {
+	return a / b;
+}
+print add(1, 2);
+print add("a", "b");
+print add(1, "b");
+print half(5);
+print divide(1, 0 / 0 * 0);
+fun nothing(n) {
+	if (n > 0) return;
+}
+print nothing(1);
+print nothing(-1);
+fun compare(a, b) {
+	var result = 0;
+	if (a < b) result = result + 1;
+	if (a <= b) result = result + 10;
+	if (a > b) result = result + 100;
+	if (a >= b) result = result + 1000;
+	if (a == b) result = result + 10000;
+	if (a != b) result = result + 100000;
+	return result;
+}
+print compare(1, 2);
+print compare(2, 2);
+print compare(3, 2);
+var nan = divide(0, 1) * 0;
+print compare(nan, 1);
+print divide(1, 0);
+)" },
+	{ "rebinding", R"(
+fun down(n) {
+	if (n <= 0) return 0;
+	return 1 + down(n - 1);
+}
+print down(10);
+var original = down;
+fun down(n) {
+	return -n;
+}
+print original(10);
+print down(10);
+)" },
+	{ "deep_recursion", R"(
+fun depth(n) {
+	if (n <= 0) return 0;
+	return depth(n - 1) + 1;
+}
+print depth(100);
+print depth(2500);
+)" },
+	{ "long_chain", "fun sum() {\n\treturn " + chain(1000) + ";\n}\nprint sum();\n" },
+	{ "too_long_chain", "print " + chain(200000) + ";\n" },
+};
+
+struct Run {
+	std::string output;
+	int status;
+};
+
+int main(int argc, char* argv[]) {
+	if (argc != 2) {
+		std::cerr << "Usage: jit_check <cpp_toy_language>\n";
+		return 64;
+	}
+	const std::string executable = argv[1];
+
+	const auto directory = std::filesystem::temp_directory_path() / "toy_jit_check";
+	std::filesystem::create_directories(directory);
+
+	const auto run = [&](const std::filesystem::path& script, const std::string& flags) {
+		const auto output = directory / "output.txt";
+		const auto command = "\"" + executable + "\" " + flags + " \"" + script.string() + "\" > \"" + output.string() + "\"";
+		// Errors in the script don't change the exit code, anything but 0 is a crash
+		const int status = std::system(command.c_str());
+		std::stringstream ss;
+		ss << std::ifstream(output).rdbuf();
+		return Run{ ss.str(), status };
+	};
+
+	int failures = 0;
+	for (const auto& workload : workloads) {
+		const auto script = directory / (workload.name + ".toy");
+		std::ofstream(script) << workload.source;
+
+		const auto expected = run(script, "--no-jit");
+		const auto actual = run(script, "--jit-threshold=1");
+		if (expected.status == 0 && actual.status == 0 && expected.output == actual.output) {
+			std::cout << "ok      " << workload.name << "\n";
+			continue;
+		}
+		failures++;
+		std::cout << "FAILED  " << workload.name << "\n"
+			<< "-- interpreter (status " << expected.status << ") --\n" << expected.output
+			<< "-- jit (status " << actual.status << ") --\n" << actual.output;
+	}
+	return failures == 0 ? 0 : 1;
+}